@@ -0,0 +1,477 @@
+/* Copyright (c) 2006-2013 Jonas Fonseca <fonseca@diku.dk>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "tig.h"
+#include "parse.h"
+#include "blamecache.h"
+
+#include <dirent.h>
+#include <utime.h>
+
+/*
+ * Each blamed file is stored in a file named after a hash of its key.
+ * The file starts with a header followed by the key, the commits, the
+ * commit and line number of each line and finally a table with the
+ * strings of the commits. Files are touched when they are read so the
+ * least recently used ones can be removed when the cache gets too big.
+ */
+
+#define BLAME_CACHE_MAGIC	"TIGBLM1"
+#define BLAME_CACHE_IDSIZE	20
+#define BLAME_CACHE_NAMELEN	16
+#define BLAME_CACHE_NO_COMMIT	((uint32_t) -1)
+
+/* Seconds after which the lock of an unfinished store is removed. */
+#define BLAME_CACHE_LOCK_STALE	600
+
+struct blame_cache_header {
+	char magic[8];
+	uint32_t keysize;
+	uint32_t commits;
+	uint32_t lines;
+	uint32_t strings;		/* Size of the string table. */
+};
+
+struct blame_cache_commit {
+	unsigned char id[BLAME_CACHE_IDSIZE];
+	unsigned char parent_id[BLAME_CACHE_IDSIZE];
+	int64_t time;
+	int32_t tz;
+	uint32_t strings;		/* Offset of the author name followed by
+					 * the email, title, filename and parent
+					 * filename. */
+};
+
+struct blame_cache_entry {
+	uint32_t commit;
+	uint32_t lineno;
+};
+
+struct blame_cache_file {
+	char name[BLAME_CACHE_NAMELEN + 1];
+	time_t mtime;
+	off_t size;
+};
+
+DEFINE_ALLOCATOR(realloc_blame_cache_strings, char, 4096)
+DEFINE_ALLOCATOR(realloc_blame_cache_files, struct blame_cache_file, 64)
+
+#define BLAME_CACHE_PADDING(size)	(((size) + 7) & ~((size_t) 7))
+
+static bool
+blame_cache_path(char path[SIZEOF_STR], const char *dir, const char *key, size_t keysize)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	size_t i;
+
+	for (i = 0; i < keysize; i++)
+		hash = (hash ^ (unsigned char) key[i]) * 1099511628211ULL;
+
+	return string_format_size(path, SIZEOF_STR, "%s/%016llx", dir, hash);
+}
+
+static int
+blame_cache_hexval(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+static bool
+blame_cache_parse_id(unsigned char id[BLAME_CACHE_IDSIZE], const char *hex)
+{
+	int i;
+
+	for (i = 0; i < BLAME_CACHE_IDSIZE; i++) {
+		int hi = blame_cache_hexval(hex[i * 2]);
+		int lo = hi < 0 ? -1 : blame_cache_hexval(hex[i * 2 + 1]);
+
+		if (lo < 0)
+			return FALSE;
+		id[i] = (hi << 4) | lo;
+	}
+
+	return TRUE;
+}
+
+static void
+blame_cache_format_id(char hex[SIZEOF_REV], const unsigned char id[BLAME_CACHE_IDSIZE])
+{
+	static const char digits[] = "0123456789abcdef";
+	int i;
+
+	for (i = 0; i < BLAME_CACHE_IDSIZE; i++) {
+		hex[i * 2] = digits[id[i] >> 4];
+		hex[i * 2 + 1] = digits[id[i] & 0xf];
+	}
+	hex[i * 2] = 0;
+}
+
+/*
+ * Loading.
+ */
+
+/* Get the next string of a commit from the string table. */
+static const char *
+blame_cache_string(const char *strings, size_t strings_size, size_t *offset)
+{
+	const char *string = strings + *offset;
+	const char *end;
+
+	if (*offset >= strings_size)
+		return NULL;
+
+	end = memchr(string, 0, strings_size - *offset);
+	if (!end)
+		return NULL;
+
+	*offset += end - string + 1;
+	return string;
+}
+
+static bool
+blame_cache_read_commit(struct blame_commits *commits, const struct blame_cache_commit *entry,
+			const char *strings, size_t strings_size, struct blame_commit **commitp)
+{
+	static const unsigned char no_id[BLAME_CACHE_IDSIZE];
+	const char *name, *email, *title, *filename, *parent_filename;
+	size_t offset = entry->strings;
+	struct blame_commit *commit;
+	char id[SIZEOF_REV];
+
+	if (!(name = blame_cache_string(strings, strings_size, &offset)) ||
+	    !(email = blame_cache_string(strings, strings_size, &offset)) ||
+	    !(title = blame_cache_string(strings, strings_size, &offset)) ||
+	    !(filename = blame_cache_string(strings, strings_size, &offset)) ||
+	    !(parent_filename = blame_cache_string(strings, strings_size, &offset)))
+		return FALSE;
+
+	blame_cache_format_id(id, entry->id);
+	commit = get_blame_commit(commits, id);
+	if (!commit)
+		return FALSE;
+
+	if (memcmp(entry->parent_id, no_id, sizeof(no_id)))
+		blame_cache_format_id(commit->parent_id, entry->parent_id);
+	commit->time.sec = entry->time;
+	commit->time.tz = entry->tz;
+	commit->author = *name ? get_author(name, email) : NULL;
+	string_ncopy(commit->title, title, strlen(title));
+	string_ncopy(commit->filename, filename, strlen(filename));
+	string_ncopy(commit->parent_filename, parent_filename, strlen(parent_filename));
+
+	*commitp = commit;
+	return TRUE;
+}
+
+static bool
+blame_cache_parse(const char *buf, size_t size, const char *key, size_t keysize,
+		  struct blame_commits *commits, struct blame_cache_line *lines, size_t lines_size)
+{
+	const struct blame_cache_header *header = (const struct blame_cache_header *) buf;
+	const struct blame_cache_commit *entries;
+	const struct blame_cache_entry *line_entries;
+	struct blame_commit **commit_list;
+	const char *strings;
+	size_t offset, i;
+	bool ok = TRUE;
+
+	if (size < sizeof(*header) ||
+	    memcmp(header->magic, BLAME_CACHE_MAGIC, sizeof(header->magic)) ||
+	    header->keysize != keysize || header->lines != lines_size)
+		return FALSE;
+
+	offset = BLAME_CACHE_PADDING(sizeof(*header) + keysize);
+	if (offset + (size_t) header->commits * sizeof(*entries)
+		   + (size_t) header->lines * sizeof(*line_entries)
+		   + header->strings != size ||
+	    memcmp(buf + sizeof(*header), key, keysize))
+		return FALSE;
+
+	entries = (const struct blame_cache_commit *) (buf + offset);
+	offset += header->commits * sizeof(*entries);
+	line_entries = (const struct blame_cache_entry *) (buf + offset);
+	offset += header->lines * sizeof(*line_entries);
+	strings = buf + offset;
+
+	commit_list = calloc(header->commits ? header->commits : 1, sizeof(*commit_list));
+	if (!commit_list)
+		return FALSE;
+
+	for (i = 0; i < header->commits && ok; i++)
+		ok = blame_cache_read_commit(commits, &entries[i], strings, header->strings, &commit_list[i]);
+
+	for (i = 0; i < lines_size && ok; i++) {
+		uint32_t commit = line_entries[i].commit;
+
+		if (commit != BLAME_CACHE_NO_COMMIT && commit >= header->commits)
+			ok = FALSE;
+		lines[i].commit = commit == BLAME_CACHE_NO_COMMIT || !ok ? NULL : commit_list[commit];
+		lines[i].lineno = line_entries[i].lineno;
+	}
+
+	free(commit_list);
+	return ok;
+}
+
+bool
+blame_cache_load(const char *dir, const char *key, size_t keysize,
+		 struct blame_commits *commits, struct blame_cache_line *lines, size_t lines_size)
+{
+	char path[SIZEOF_STR];
+	struct stat st;
+	FILE *file;
+	char *buf;
+	bool ok;
+
+	if (!blame_cache_path(path, dir, key, keysize) ||
+	    !(file = fopen(path, "rb")))
+		return FALSE;
+
+	if (fstat(fileno(file), &st) || st.st_size < sizeof(struct blame_cache_header) ||
+	    !(buf = malloc(st.st_size))) {
+		fclose(file);
+		return FALSE;
+	}
+
+	ok = fread(buf, st.st_size, 1, file) == 1 &&
+	     blame_cache_parse(buf, st.st_size, key, keysize, commits, lines, lines_size);
+	fclose(file);
+	free(buf);
+
+	/* Mark the file as recently used. */
+	if (ok)
+		utime(path, NULL);
+	return ok;
+}
+
+/*
+ * Storing.
+ */
+
+static int
+compare_blame_cache_commits(const void *commit1_, const void *commit2_)
+{
+	const struct blame_commit *commit1 = *(const struct blame_commit **) commit1_;
+	const struct blame_commit *commit2 = *(const struct blame_commit **) commit2_;
+
+	return commit1 < commit2 ? -1 : commit1 > commit2;
+}
+
+static bool
+blame_cache_add_string(char **strings, size_t *strings_size, const char *string)
+{
+	size_t size = strlen(string) + 1;
+
+	if (!realloc_blame_cache_strings(strings, *strings_size, size))
+		return FALSE;
+	memcpy(*strings + *strings_size, string, size);
+	*strings_size += size;
+	return TRUE;
+}
+
+static bool
+blame_cache_write(FILE *file, const char *key, size_t keysize,
+		  const struct blame_cache_line *lines, size_t lines_size,
+		  struct blame_commit **commit_list, size_t commits_size)
+{
+	static const char padding[8];
+	size_t padsize = BLAME_CACHE_PADDING(sizeof(struct blame_cache_header) + keysize)
+		       - sizeof(struct blame_cache_header) - keysize;
+	struct blame_cache_header header = {};
+	struct blame_cache_commit *entries = calloc(commits_size ? commits_size : 1, sizeof(*entries));
+	char *strings = NULL;
+	size_t strings_size = 0;
+	size_t i;
+	bool ok = !!entries;
+
+	/* The string table is written last but built first to know the
+	 * string offsets of each commit. */
+	for (i = 0; i < commits_size && ok; i++) {
+		const struct blame_commit *commit = commit_list[i];
+		const struct ident *author = commit->author;
+
+		entries[i].time = commit->time.sec;
+		entries[i].tz = commit->time.tz;
+		entries[i].strings = strings_size;
+		ok = blame_cache_parse_id(entries[i].id, commit->id) &&
+		     (!*commit->parent_id || blame_cache_parse_id(entries[i].parent_id, commit->parent_id)) &&
+		     blame_cache_add_string(&strings, &strings_size, author ? author->name : "") &&
+		     blame_cache_add_string(&strings, &strings_size, author ? author->email : "") &&
+		     blame_cache_add_string(&strings, &strings_size, commit->title) &&
+		     blame_cache_add_string(&strings, &strings_size, commit->filename) &&
+		     blame_cache_add_string(&strings, &strings_size, commit->parent_filename);
+	}
+
+	memcpy(header.magic, BLAME_CACHE_MAGIC, sizeof(header.magic));
+	header.keysize = keysize;
+	header.commits = commits_size;
+	header.lines = lines_size;
+	header.strings = strings_size;
+
+	ok = ok &&
+	     fwrite(&header, sizeof(header), 1, file) == 1 &&
+	     fwrite(key, keysize, 1, file) == 1 &&
+	     (!padsize || fwrite(padding, padsize, 1, file) == 1) &&
+	     (!commits_size || fwrite(entries, sizeof(*entries), commits_size, file) == commits_size);
+
+	for (i = 0; i < lines_size && ok; i++) {
+		struct blame_cache_entry entry = { BLAME_CACHE_NO_COMMIT, lines[i].lineno };
+		struct blame_commit **commit = NULL;
+
+		if (lines[i].commit)
+			commit = bsearch(&lines[i].commit, commit_list, commits_size,
+					 sizeof(*commit_list), compare_blame_cache_commits);
+		if (commit)
+			entry.commit = commit - commit_list;
+		ok = fwrite(&entry, sizeof(entry), 1, file) == 1;
+	}
+
+	ok = ok && (!strings_size || fwrite(strings, strings_size, 1, file) == 1);
+	free(entries);
+	free(strings);
+	return ok;
+}
+
+static int
+compare_blame_cache_files(const void *file1_, const void *file2_)
+{
+	const struct blame_cache_file *file1 = file1_;
+	const struct blame_cache_file *file2 = file2_;
+
+	return file1->mtime < file2->mtime ? -1 : file1->mtime > file2->mtime;
+}
+
+/* Remove the least recently used files until the cache fits. */
+static void
+blame_cache_evict(const char *dir, size_t max_size)
+{
+	struct blame_cache_file *files = NULL;
+	size_t files_size = 0;
+	unsigned long long total = 0;
+	struct dirent *dirent;
+	DIR *dirp = opendir(dir);
+	size_t i;
+
+	if (!dirp)
+		return;
+
+	while ((dirent = readdir(dirp))) {
+		char path[SIZEOF_STR];
+		struct stat st;
+
+		if (strlen(dirent->d_name) != BLAME_CACHE_NAMELEN ||
+		    strspn(dirent->d_name, "0123456789abcdef") != BLAME_CACHE_NAMELEN ||
+		    !string_format(path, "%s/%s", dir, dirent->d_name) ||
+		    stat(path, &st) ||
+		    !realloc_blame_cache_files(&files, files_size, 1))
+			continue;
+
+		string_copy(files[files_size].name, dirent->d_name);
+		files[files_size].mtime = st.st_mtime;
+		files[files_size].size = st.st_size;
+		total += st.st_size;
+		files_size++;
+	}
+	closedir(dirp);
+
+	if (total > max_size) {
+		qsort(files, files_size, sizeof(*files), compare_blame_cache_files);
+		for (i = 0; i < files_size && total > max_size; i++) {
+			char path[SIZEOF_STR];
+
+			if (string_format(path, "%s/%s", dir, files[i].name) && !unlink(path))
+				total -= files[i].size;
+		}
+	}
+
+	free(files);
+}
+
+/* Create the lock file, which fails while another tig stores the file. */
+static int
+blame_cache_lock(const char *lock)
+{
+	int fd = open(lock, O_WRONLY | O_CREAT | O_EXCL, 0666);
+	struct stat st;
+
+	if (fd == -1 && errno == EEXIST && !stat(lock, &st) &&
+	    st.st_mtime + BLAME_CACHE_LOCK_STALE < time(NULL) && !unlink(lock))
+		fd = open(lock, O_WRONLY | O_CREAT | O_EXCL, 0666);
+	return fd;
+}
+
+bool
+blame_cache_store(const char *dir, const char *key, size_t keysize,
+		  const struct blame_cache_line *lines, size_t lines_size, size_t max_size)
+{
+	struct blame_commit **commit_list = calloc(lines_size ? lines_size : 1, sizeof(*commit_list));
+	size_t commits_size = 0, unique = 0;
+	char path[SIZEOF_STR];
+	char lock[SIZEOF_STR];
+	FILE *file;
+	size_t i;
+	int fd;
+	bool ok;
+
+	if (!commit_list)
+		return FALSE;
+
+	for (i = 0; i < lines_size; i++)
+		if (lines[i].commit)
+			commit_list[commits_size++] = lines[i].commit;
+	qsort(commit_list, commits_size, sizeof(*commit_list), compare_blame_cache_commits);
+	for (i = 0; i < commits_size; i++)
+		if (!unique || commit_list[i] != commit_list[unique - 1])
+			commit_list[unique++] = commit_list[i];
+	commits_size = unique;
+
+	if (!blame_cache_path(path, dir, key, keysize) ||
+	    !string_format(lock, "%s.lock", path)) {
+		free(commit_list);
+		return FALSE;
+	}
+
+	/* Leave the file to the tig already storing it. */
+	fd = blame_cache_lock(lock);
+	if (fd == -1) {
+		bool locked = errno == EEXIST;
+
+		free(commit_list);
+		return locked;
+	}
+
+	if (!(file = fdopen(fd, "wb"))) {
+		close(fd);
+		unlink(lock);
+		free(commit_list);
+		return FALSE;
+	}
+
+	ok = blame_cache_write(file, key, keysize, lines, lines_size, commit_list, commits_size);
+	ok = !fclose(file) && ok;
+	free(commit_list);
+
+	if (!ok || rename(lock, path)) {
+		unlink(lock);
+		return FALSE;
+	}
+
+	blame_cache_evict(dir, max_size);
+	return TRUE;
+}
+
+/* vim: set ts=8 sw=8 noexpandtab: */
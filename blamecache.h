@@ -0,0 +1,36 @@
+/* Copyright (c) 2006-2013 Jonas Fonseca <fonseca@diku.dk>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef TIG_BLAMECACHE_H
+#define TIG_BLAMECACHE_H
+
+#include "tig.h"
+#include "parse.h"
+
+/*
+ * Persistent cache of blamed files.
+ */
+
+struct blame_cache_line {
+	struct blame_commit *commit;
+	unsigned long lineno;		/* Line number in the commit. */
+};
+
+bool blame_cache_load(const char *dir, const char *key, size_t keysize,
+		      struct blame_commits *commits, struct blame_cache_line *lines, size_t lines_size);
+bool blame_cache_store(const char *dir, const char *key, size_t keysize,
+		       const struct blame_cache_line *lines, size_t lines_size, size_t max_size);
+
+#endif
+
+/* vim: set ts=8 sw=8 noexpandtab: */
@@ -261,6 +261,7 @@ io_init(struct io *io)
 {
 	memset(io, 0, sizeof(*io));
 	io->pipe = -1;
+	io->write_pipe = -1;
 }
 
 bool
@@ -296,6 +297,8 @@ io_done(struct io *io)
 
 	if (io->pipe != -1)
 		close(io->pipe);
+	if (io->write_pipe != -1)
+		close(io->write_pipe);
 	free(io->buf);
 	io_init(io);
 
@@ -322,8 +325,8 @@ io_done(struct io *io)
 	return TRUE;
 }
 
-static int
-open_trace(int devnull, const char *argv[])
+static const char *
+get_trace_file(void)
 {
 	static const char *trace_file;
 
@@ -333,6 +336,14 @@ open_trace(int devnull, const char *argv[])
 			trace_file = "";
 	}
 
+	return trace_file;
+}
+
+static int
+open_trace(int devnull, const char *argv[])
+{
+	const char *trace_file = get_trace_file();
+
 	if (*trace_file) {
 		int fd = open(trace_file, O_RDWR | O_CREAT | O_APPEND, 0666);
 		int i;
@@ -353,12 +364,40 @@ open_trace(int devnull, const char *argv[])
 	return devnull;
 }
 
+bool
+io_trace(const char *fmt, ...)
+{
+	const char *trace_file = get_trace_file();
+	char buf[SIZEOF_STR];
+	va_list args;
+	int fd, retval;
+
+	if (!*trace_file)
+		return FALSE;
+
+	va_start(args, fmt);
+	retval = vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	if (retval < 0)
+		return FALSE;
+
+	fd = open(trace_file, O_RDWR | O_CREAT | O_APPEND, 0666);
+	if (fd == -1)
+		return FALSE;
+
+	retval = write(fd, buf, MIN(retval, sizeof(buf) - 1));
+	close(fd);
+	return retval != -1;
+}
+
 bool
 io_run(struct io *io, enum io_type type, const char *dir, char * const env[], const char *argv[], ...)
 {
 	int pipefds[2] = { -1, -1 };
+	int writefds[2] = { -1, -1 };
 	va_list args;
 	bool read_from_stdin = type == IO_RD_STDIN;
+	bool read_write = type == IO_RD_WR;
 
 	io_init(io);
 
@@ -368,8 +407,22 @@ io_run(struct io *io, enum io_type type, const char *dir, char * const env[], co
 	if (dir && !strcmp(dir, argv[0]))
 		return io_open(io, "%s%s", dir, argv[1]);
 
+	/* The output of a read and write command is read like IO_RD and
+	 * its input is written to a second pipe. */
+	if (read_write) {
+		if (pipe(writefds) < 0) {
+			io->error = errno;
+			return FALSE;
+		}
+		type = IO_RD;
+	}
+
 	if ((type == IO_RD || type == IO_WR) && pipe(pipefds) < 0) {
 		io->error = errno;
+		if (read_write) {
+			close(writefds[0]);
+			close(writefds[1]);
+		}
 		return FALSE;
 	} else if (type == IO_AP) {
 		va_start(args, argv);
@@ -382,8 +435,18 @@ io_run(struct io *io, enum io_type type, const char *dir, char * const env[], co
 			io->error = errno;
 		if (pipefds[!(type == IO_WR)] != -1)
 			close(pipefds[!(type == IO_WR)]);
+		if (writefds[0] != -1)
+			close(writefds[0]);
 		if (io->pid != -1) {
 			io->pipe = pipefds[!!(type == IO_WR)];
+			io->write_pipe = writefds[1];
+			/* Keep the pipes from leaking into commands started
+			 * later. A command inheriting the write end of another
+			 * command's input would keep it from seeing EOF. */
+			if (io->pipe != -1)
+				fcntl(io->pipe, F_SETFD, FD_CLOEXEC);
+			if (io->write_pipe != -1)
+				fcntl(io->write_pipe, F_SETFD, FD_CLOEXEC);
 			return TRUE;
 		}
 
@@ -398,6 +461,8 @@ io_run(struct io *io, enum io_type type, const char *dir, char * const env[], co
 			/* Inject stdin given on the command line. */
 			if (read_from_stdin)
 				readfd = dup(STDIN_FILENO);
+			else if (read_write)
+				readfd = writefds[0];
 
 			dup2(readfd,  STDIN_FILENO);
 			dup2(writefd, STDOUT_FILENO);
@@ -410,6 +475,10 @@ io_run(struct io *io, enum io_type type, const char *dir, char * const env[], co
 				close(pipefds[0]);
 			if (pipefds[1] != -1)
 				close(pipefds[1]);
+			if (read_write) {
+				close(writefds[0]);
+				close(writefds[1]);
+			}
 		}
 
 		if (dir && *dir && chdir(dir) == -1)
@@ -429,15 +498,51 @@ io_run(struct io *io, enum io_type type, const char *dir, char * const env[], co
 
 	if (pipefds[!!(type == IO_WR)] != -1)
 		close(pipefds[!!(type == IO_WR)]);
+	if (writefds[1] != -1)
+		close(writefds[1]);
 	return FALSE;
 }
 
+/*
+ * Accounting of time spent waiting for commands.
+ */
+
+static struct io_sync_stats io_sync_stats;
+
+static unsigned long long
+io_sync_begin(void)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return now.tv_sec * 1000000ULL + now.tv_usec;
+}
+
+static void
+io_sync_end(unsigned long long start)
+{
+	io_sync_stats.usecs += io_sync_begin() - start;
+	io_sync_stats.runs++;
+}
+
+const struct io_sync_stats *
+io_get_sync_stats(void)
+{
+	return &io_sync_stats;
+}
+
 bool
 io_complete(enum io_type type, const char **argv, const char *dir, int fd)
 {
+	unsigned long long start = io_sync_begin();
 	struct io io;
+	bool ok = io_run(&io, type, dir, NULL, argv, fd) && io_done(&io);
 
-	return io_run(&io, type, dir, NULL, argv, fd) && io_done(&io);
+	/* Leave out the time spent in the editor and other external
+	 * programs the user interacts with. */
+	if (type != IO_FG)
+		io_sync_end(start);
+	return ok;
 }
 
 bool
@@ -488,6 +593,38 @@ io_can_read(struct io *io, bool can_block)
 	return select(io->pipe + 1, &fds, NULL, NULL, can_block ? NULL : &tv) > 0;
 }
 
+/* Block until there is something to read or the time has passed. */
+bool
+io_can_read_within(struct io *io, unsigned long long usecs)
+{
+	struct timeval tv = { usecs / 1000000, usecs % 1000000 };
+	fd_set fds;
+
+	FD_ZERO(&fds);
+	FD_SET(io->pipe, &fds);
+
+	return select(io->pipe + 1, &fds, NULL, NULL, &tv) > 0;
+}
+
+/* Block until at least one of the commands has something to read. */
+bool
+io_can_read_any(struct io *ios[], size_t ios_size)
+{
+	fd_set fds;
+	int maxfd = -1;
+	size_t i;
+
+	FD_ZERO(&fds);
+	for (i = 0; i < ios_size; i++) {
+		if (ios[i]->pipe == -1)
+			continue;
+		FD_SET(ios[i]->pipe, &fds);
+		maxfd = MAX(maxfd, ios[i]->pipe);
+	}
+
+	return maxfd >= 0 && select(maxfd + 1, &fds, NULL, NULL, NULL) > 0;
+}
+
 ssize_t
 io_read(struct io *io, void *buf, size_t bufsize)
 {
@@ -557,12 +694,13 @@ io_get(struct io *io, int c, bool can_read)
 bool
 io_write(struct io *io, const void *buf, size_t bufsize)
 {
+	int fd = io->write_pipe != -1 ? io->write_pipe : io->pipe;
 	size_t written = 0;
 
 	while (!io_error(io) && written < bufsize) {
 		ssize_t size;
 
-		size = write(io->pipe, buf + written, bufsize - written);
+		size = write(fd, buf + written, bufsize - written);
 		if (size < 0 && (errno == EAGAIN || errno == EINTR))
 			continue;
 		else if (size == -1)
@@ -574,6 +712,16 @@ io_write(struct io *io, const void *buf, size_t bufsize)
 	return written == bufsize;
 }
 
+/* Let a read and write command see the end of its input. */
+bool
+io_close_write(struct io *io)
+{
+	int fd = io->write_pipe;
+
+	io->write_pipe = -1;
+	return fd != -1 && !close(fd);
+}
+
 bool
 io_printf(struct io *io, const char *fmt, ...)
 {
@@ -605,9 +753,12 @@ io_read_buf(struct io *io, char buf[], size_t bufsize)
 bool
 io_run_buf(const char **argv, char buf[], size_t bufsize)
 {
+	unsigned long long start = io_sync_begin();
 	struct io io;
+	bool ok = io_run(&io, IO_RD, NULL, NULL, argv) && io_read_buf(&io, buf, bufsize);
 
-	return io_run(&io, IO_RD, NULL, NULL, argv) && io_read_buf(&io, buf, bufsize);
+	io_sync_end(start);
+	return ok;
 }
 
 int
@@ -649,11 +800,14 @@ int
 io_run_load(const char **argv, const char *separators,
 	    io_read_fn read_property, void *data)
 {
+	unsigned long long start = io_sync_begin();
 	struct io io;
+	int status = ERR;
 
-	if (!io_run(&io, IO_RD, NULL, NULL, argv))
-		return ERR;
-	return io_load(&io, separators, read_property, data);
+	if (io_run(&io, IO_RD, NULL, NULL, argv))
+		status = io_load(&io, separators, read_property, data);
+	io_sync_end(start);
+	return status;
 }
 
 /* vim: set ts=8 sw=8 noexpandtab: */
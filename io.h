@@ -52,11 +52,13 @@ enum io_type {
 	IO_RD,			/* Read only fork+exec IO. */
 	IO_RD_STDIN,		/* Read only fork+exec IO with stdin. */
 	IO_WR,			/* Write only fork+exec IO. */
+	IO_RD_WR,		/* Read and write fork+exec IO. */
 	IO_AP,			/* Append fork+exec output to file. */
 };
 
 struct io {
 	int pipe;		/* Pipe end for reading or writing. */
+	int write_pipe;		/* Pipe end for writing to IO_RD_WR. */
 	pid_t pid;		/* PID of spawned process. */
 	int error;		/* Error status. */
 	char *buf;		/* Read buffer. */
@@ -69,6 +71,12 @@ struct io {
 
 typedef int (*io_read_fn)(char *, size_t, char *, size_t, void *data);
 
+/* Commands run to completion while tig waits for them. */
+struct io_sync_stats {
+	unsigned long runs;		/* Number of commands run. */
+	unsigned long long usecs;	/* Time spent running them. */
+};
+
 bool io_open(struct io *io, const char *fmt, ...) PRINTF_LIKE(2, 3);
 bool io_kill(struct io *io);
 bool io_done(struct io *io);
@@ -80,9 +88,12 @@ bool io_eof(struct io *io);
 int io_error(struct io *io);
 char * io_strerror(struct io *io);
 bool io_can_read(struct io *io, bool can_block);
+bool io_can_read_any(struct io *ios[], size_t ios_size);
+bool io_can_read_within(struct io *io, unsigned long long usecs);
 ssize_t io_read(struct io *io, void *buf, size_t bufsize);
 char * io_get(struct io *io, int c, bool can_read);
 bool io_write(struct io *io, const void *buf, size_t bufsize);
+bool io_close_write(struct io *io);
 bool io_printf(struct io *io, const char *fmt, ...) PRINTF_LIKE(2, 3);
 bool io_read_buf(struct io *io, char buf[], size_t bufsize);
 bool io_run_buf(const char **argv, char buf[], size_t bufsize);
@@ -90,6 +101,8 @@ int io_load(struct io *io, const char *separators,
 	    io_read_fn read_property, void *data);
 int io_run_load(const char **argv, const char *separators,
 		io_read_fn read_property, void *data);
+const struct io_sync_stats *io_get_sync_stats(void);
+bool io_trace(const char *fmt, ...) PRINTF_LIKE(1, 2);
 
 #endif
 
@@ -0,0 +1,289 @@
+/* Copyright (c) 2006-2013 Jonas Fonseca <fonseca@diku.dk>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "tig.h"
+#include "line.h"
+
+static struct line_info line_info[] = {
+#define LINE(type, line, fg, bg, attr) \
+	{ #type, STRING_SIZE(#type), (line), STRING_SIZE(line), (fg), (bg), (attr) }
+	LINE_INFO
+#undef	LINE
+};
+
+static struct line_info **color_pair;
+static size_t color_pairs;
+
+static struct line_info *custom_color;
+static size_t custom_colors;
+
+DEFINE_ALLOCATOR(realloc_custom_color, struct line_info, 8)
+DEFINE_ALLOCATOR(realloc_color_pair, struct line_info *, 8)
+
+#define TO_CUSTOM_COLOR_TYPE(type)	(LINE_NONE + 1 + (type))
+#define TO_CUSTOM_COLOR_OFFSET(type)	((type) - LINE_NONE - 1)
+
+/*
+ * The start of lines to match are compiled into a trie of case folded
+ * bytes with a table for dispatching on the first byte. Each rule has a
+ * priority given by its position, custom colors first, and the rule with
+ * the lowest priority among those matching the line wins.
+ */
+
+struct line_rule_node {
+	unsigned char c;	/* Case folded byte. */
+	int rule;		/* Rule of lines ending here or -1. */
+	int child;		/* First child or 0 for none. */
+	int next;		/* Next sibling or 0 for none. */
+};
+
+static struct line_rule_node *line_rule_nodes;
+static size_t line_rule_nodes_size;
+static int line_rule_table[256];	/* Nodes of the first byte. */
+static int line_rule_default;		/* Rule matching the empty string. */
+static bool line_rules_compiled;
+
+DEFINE_ALLOCATOR(realloc_line_rule_nodes, struct line_rule_node, 64)
+
+static int
+new_line_rule_node(unsigned char c, int next)
+{
+	int node;
+
+	if (!realloc_line_rule_nodes(&line_rule_nodes, line_rule_nodes_size, 1))
+		return 0;
+
+	node = line_rule_nodes_size++;
+	line_rule_nodes[node].c = c;
+	line_rule_nodes[node].rule = -1;
+	line_rule_nodes[node].child = 0;
+	line_rule_nodes[node].next = next;
+	return node;
+}
+
+static int
+add_line_rule_node(int parent, unsigned char c)
+{
+	int node;
+
+	for (node = line_rule_nodes[parent].child; node; node = line_rule_nodes[node].next)
+		if (line_rule_nodes[node].c == c)
+			return node;
+
+	node = new_line_rule_node(c, line_rule_nodes[parent].child);
+	if (node)
+		line_rule_nodes[parent].child = node;
+	return node;
+}
+
+static bool
+add_line_rule(const char *line, int rule)
+{
+	unsigned char c = ascii_tolower(*line);
+	int node;
+
+	if (!*line) {
+		if (line_rule_default < 0 || rule < line_rule_default)
+			line_rule_default = rule;
+		return TRUE;
+	}
+
+	node = line_rule_table[c];
+	if (!node) {
+		node = new_line_rule_node(c, 0);
+		if (!node)
+			return FALSE;
+		line_rule_table[c] = node;
+	}
+
+	while (*++line) {
+		node = add_line_rule_node(node, ascii_tolower(*line));
+		if (!node)
+			return FALSE;
+	}
+
+	if (line_rule_nodes[node].rule < 0 || rule < line_rule_nodes[node].rule)
+		line_rule_nodes[node].rule = rule;
+	return TRUE;
+}
+
+static bool
+compile_line_rules(void)
+{
+	enum line_type type;
+
+	memset(line_rule_table, 0, sizeof(line_rule_table));
+	line_rule_default = -1;
+
+	/* Node 0 is reserved so 0 can mean no node. */
+	if (!realloc_line_rule_nodes(&line_rule_nodes, 0, 1))
+		return FALSE;
+	line_rule_nodes_size = 1;
+
+	for (type = 0; type < custom_colors; type++)
+		if (!add_line_rule(custom_color[type].line, type))
+			return FALSE;
+
+	for (type = 0; type < ARRAY_SIZE(line_info); type++)
+		if (!add_line_rule(line_info[type].line, custom_colors + type))
+			return FALSE;
+
+	line_rules_compiled = TRUE;
+	return TRUE;
+}
+
+static enum line_type
+get_line_type_from_rule(int rule)
+{
+	if (rule < 0)
+		return LINE_DEFAULT;
+	if (rule < custom_colors)
+		return TO_CUSTOM_COLOR_TYPE(rule);
+	return rule - custom_colors;
+}
+
+enum line_type
+get_line_type(const char *line)
+{
+	int rule, node;
+
+	if (!line_rules_compiled && !compile_line_rules())
+		return LINE_DEFAULT;
+
+	rule = line_rule_default;
+	for (node = line_rule_table[ascii_tolower(*line) & 0xff]; node; ) {
+		int node_rule = line_rule_nodes[node].rule;
+		unsigned char c;
+
+		if (node_rule >= 0 && (rule < 0 || node_rule < rule))
+			rule = node_rule;
+
+		c = ascii_tolower(*++line);
+		if (!c)
+			break;
+		for (node = line_rule_nodes[node].child; node; node = line_rule_nodes[node].next)
+			if (line_rule_nodes[node].c == c)
+				break;
+	}
+
+	return get_line_type_from_rule(rule);
+}
+
+struct line_info *
+get_line(enum line_type type)
+{
+	if (type > LINE_NONE) {
+		assert(TO_CUSTOM_COLOR_OFFSET(type) < custom_colors);
+		return &custom_color[TO_CUSTOM_COLOR_OFFSET(type)];
+	} else {
+		assert(type < ARRAY_SIZE(line_info));
+		return &line_info[type];
+	}
+}
+
+struct line_info *
+get_line_info(const char *name)
+{
+	size_t namelen = strlen(name);
+	enum line_type type;
+
+	for (type = 0; type < ARRAY_SIZE(line_info); type++)
+		if (enum_equals(line_info[type], name, namelen))
+			return &line_info[type];
+
+	return NULL;
+}
+
+struct line_info *
+add_custom_color(const char *quoted_line)
+{
+	struct line_info *info;
+	char *line;
+	size_t linelen;
+
+	if (!realloc_custom_color(&custom_color, custom_colors, 1))
+		return NULL;
+
+	linelen = strlen(quoted_line) - 1;
+	line = malloc(linelen);
+	if (!line)
+		return NULL;
+
+	strncpy(line, quoted_line + 1, linelen);
+	line[linelen - 1] = 0;
+
+	info = &custom_color[custom_colors++];
+	info->name = info->line = line;
+	info->namelen = info->linelen = strlen(line);
+	line_rules_compiled = FALSE;
+
+	return info;
+}
+
+static bool
+init_line_info_color_pair(struct line_info *info, enum line_type type,
+	int default_bg, int default_fg)
+{
+	int bg = info->bg == COLOR_DEFAULT ? default_bg : info->bg;
+	int fg = info->fg == COLOR_DEFAULT ? default_fg : info->fg;
+	int i;
+
+	for (i = 0; i < color_pairs; i++) {
+		if (color_pair[i]->fg == info->fg && color_pair[i]->bg == info->bg) {
+			info->color_pair = i;
+			return TRUE;
+		}
+	}
+
+	if (!realloc_color_pair(&color_pair, color_pairs, 1))
+		return FALSE;
+
+	color_pair[color_pairs] = info;
+	info->color_pair = color_pairs++;
+	init_pair(COLOR_ID(info->color_pair), fg, bg);
+	return TRUE;
+}
+
+bool
+init_colors(void)
+{
+	int default_bg = line_info[LINE_DEFAULT].bg;
+	int default_fg = line_info[LINE_DEFAULT].fg;
+	enum line_type type;
+
+	start_color();
+
+	if (assume_default_colors(default_fg, default_bg) == ERR) {
+		default_bg = COLOR_BLACK;
+		default_fg = COLOR_WHITE;
+	}
+
+	for (type = 0; type < ARRAY_SIZE(line_info); type++) {
+		struct line_info *info = &line_info[type];
+
+		if (!init_line_info_color_pair(info, type, default_bg, default_fg))
+			return FALSE;
+	}
+
+	for (type = 0; type < custom_colors; type++) {
+		struct line_info *info = &custom_color[type];
+
+		if (!init_line_info_color_pair(info, TO_CUSTOM_COLOR_TYPE(type),
+					       default_bg, default_fg))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* vim: set ts=8 sw=8 noexpandtab: */
@@ -0,0 +1,592 @@
+/* Copyright (c) 2006-2013 Jonas Fonseca <fonseca@diku.dk>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "tig.h"
+#include "parse.h"
+
+const struct ident unknown_ident = { "Unknown", "unknown@localhost" };
+
+DEFINE_ALLOCATOR(realloc_authors, struct ident *, 256)
+
+/* Small author cache to reduce memory consumption. It uses binary
+ * search to lookup or find place to position new entries. No entries
+ * are ever freed. */
+struct ident *
+get_author(const char *name, const char *email)
+{
+	static struct ident **authors;
+	static size_t authors_size;
+	int from = 0, to = authors_size - 1;
+	struct ident *ident;
+
+	while (from <= to) {
+		size_t pos = (to + from) / 2;
+		int cmp = strcmp(name, authors[pos]->name);
+
+		if (!cmp)
+			return authors[pos];
+
+		if (cmp < 0)
+			to = pos - 1;
+		else
+			from = pos + 1;
+	}
+
+	if (!realloc_authors(&authors, authors_size, 1))
+		return NULL;
+	ident = calloc(1, sizeof(*ident));
+	if (!ident)
+		return NULL;
+	ident->name = strdup(name);
+	ident->email = strdup(email);
+	if (!ident->name || !ident->email) {
+		free((void *) ident->name);
+		free(ident);
+		return NULL;
+	}
+
+	memmove(authors + from + 1, authors + from, (authors_size - from) * sizeof(*authors));
+	authors[from] = ident;
+	authors_size++;
+
+	return ident;
+}
+
+void
+parse_timesec(struct time *time, const char *sec)
+{
+	time->sec = (time_t) atol(sec);
+}
+
+void
+parse_timezone(struct time *time, const char *zone)
+{
+	long tz;
+
+	tz  = ('0' - zone[1]) * 60 * 60 * 10;
+	tz += ('0' - zone[2]) * 60 * 60;
+	tz += ('0' - zone[3]) * 60 * 10;
+	tz += ('0' - zone[4]) * 60;
+
+	if (zone[0] == '-')
+		tz = -tz;
+
+	time->tz = tz;
+	time->sec -= tz;
+}
+
+/* Parse author lines where the name may be empty:
+ *	author  <email@address.tld> 1138474660 +0100
+ */
+void
+parse_author_line(char *ident, const struct ident **author, struct time *time)
+{
+	char *nameend = strchr(ident, '<');
+	char *emailend = strchr(ident, '>');
+	const char *name, *email = "";
+
+	if (nameend && emailend)
+		*nameend = *emailend = 0;
+	name = chomp_string(ident);
+	if (nameend)
+		email = chomp_string(nameend + 1);
+	if (!*name)
+		name = *email ? email : unknown_ident.name;
+	if (!*email)
+		email = *name ? name : unknown_ident.email;
+
+	*author = get_author(name, email);
+
+	/* Parse epoch and timezone */
+	if (time && emailend && emailend[1] == ' ') {
+		char *secs = emailend + 2;
+		char *zone = strchr(secs, ' ');
+
+		parse_timesec(time, secs);
+
+		if (zone && strlen(zone) == STRING_SIZE(" +0700"))
+			parse_timezone(time, zone + 1);
+	}
+}
+
+/* Register a commit from the IDs on its commit line, which lists the
+ * parents after the commit ID. */
+void
+parse_commit_ids(struct commit *commit, struct graph *graph, const char *ids, bool is_boundary)
+{
+	string_copy_rev(commit->id, ids);
+	if (graph)
+		graph_add_commit(graph, &commit->graph, commit->id, ids, is_boundary);
+}
+
+/* Move the commit being read into its allocated copy, which has room
+ * for the title, and clear it for the next commit. */
+void
+move_commit(struct commit *commit, struct commit *template, struct graph *graph,
+	    const char *title, size_t titlelen)
+{
+	*commit = *template;
+	memcpy(commit->title, title, titlelen);
+	commit->title[titlelen] = 0;
+	if (graph)
+		graph->canvas = &commit->graph;
+	memset(template, 0, sizeof(*template));
+}
+
+enum commit_line
+parse_commit_line(struct commit_parser *parser, char *line, char **text)
+{
+	struct commit *commit = &parser->commit;
+	struct graph *graph = parser->graph;
+	enum line_type type = get_line_type(line);
+
+	if (type == LINE_COMMIT) {
+		parser->in_header = TRUE;
+		line += STRING_SIZE("commit ");
+		parser->is_boundary = *line == '-';
+		if (parser->is_boundary || !isalnum(*line))
+			line++;
+		*text = line;
+		return COMMIT_LINE_ID;
+	}
+
+	if (!*commit->id)
+		return COMMIT_LINE_NONE;
+
+	/* Empty line separates the commit header from the log itself. */
+	if (*line == '\0')
+		parser->in_header = FALSE;
+
+	switch (type) {
+	case LINE_PARENT:
+		if (graph && !graph->has_parents)
+			graph_add_parent(graph, line + STRING_SIZE("parent "));
+		break;
+
+	case LINE_AUTHOR:
+		parse_author_line(line + STRING_SIZE("author "),
+				  &commit->author, &commit->time);
+		if (graph)
+			graph_render_parents(graph);
+		break;
+
+	default:
+		/* Fill in the commit title if it has not already been set. */
+		if (*commit->title)
+			break;
+
+		/* Skip lines in the commit header. */
+		if (parser->in_header)
+			break;
+
+		/* Require titles to start with a non-space character at the
+		 * offset used by git log. */
+		if (strncmp(line, "    ", 4))
+			break;
+		line += 4;
+		/* Well, if the title starts with a whitespace character,
+		 * try to be forgiving.  Otherwise we end up with no title. */
+		while (isspace(*line))
+			line++;
+		if (*line == '\0')
+			break;
+		*text = line;
+		return COMMIT_LINE_TITLE;
+	}
+
+	return COMMIT_LINE_NONE;
+}
+
+static bool
+parse_number(const char **posref, size_t *number, size_t min, size_t max)
+{
+	const char *pos = *posref;
+
+	*posref = NULL;
+	pos = strchr(pos + 1, ' ');
+	if (!pos || !isdigit(pos[1]))
+		return FALSE;
+	*number = atoi(pos + 1);
+	if (*number < min || *number > max)
+		return FALSE;
+
+	*posref = pos;
+	return TRUE;
+}
+
+bool
+parse_blame_header(struct blame_header *header, const char *text, size_t max_lineno)
+{
+	const char *pos = text + SIZEOF_REV - 2;
+
+	if (strlen(text) <= SIZEOF_REV || pos[1] != ' ')
+		return FALSE;
+
+	string_ncopy(header->id, text, SIZEOF_REV);
+
+	if (!parse_number(&pos, &header->orig_lineno, 1, 9999999) ||
+	    !parse_number(&pos, &header->lineno, 1, max_lineno) ||
+	    !parse_number(&pos, &header->group, 1, max_lineno - header->lineno + 1))
+		return FALSE;
+
+	return TRUE;
+}
+
+static bool
+match_blame_header(const char *name, char **line)
+{
+	size_t namelen = strlen(name);
+	bool matched = !strncmp(name, *line, namelen);
+
+	if (matched)
+		*line += namelen;
+
+	return matched;
+}
+
+bool
+parse_blame_info(struct blame_commit *commit, char *line)
+{
+	if (match_blame_header("author ", &line)) {
+		parse_author_line(line, &commit->author, NULL);
+
+	} else if (match_blame_header("author-time ", &line)) {
+		parse_timesec(&commit->time, line);
+
+	} else if (match_blame_header("author-tz ", &line)) {
+		parse_timezone(&commit->time, line);
+
+	} else if (match_blame_header("summary ", &line)) {
+		string_ncopy(commit->title, line, strlen(line));
+
+	} else if (match_blame_header("previous ", &line)) {
+		if (strlen(line) <= SIZEOF_REV)
+			return FALSE;
+		string_copy_rev(commit->parent_id, line);
+		line += SIZEOF_REV;
+		string_ncopy(commit->parent_filename, line, strlen(line));
+
+	} else if (match_blame_header("filename ", &line)) {
+		string_ncopy(commit->filename, line, strlen(line));
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+#define BLAME_COMMITS_MIN_SIZE	256
+
+static size_t
+blame_commit_hash(const char *id)
+{
+	size_t hash = 2166136261U;
+	int i;
+
+	for (i = 0; i < SIZEOF_REV - 1 && id[i]; i++)
+		hash = (hash ^ (unsigned char) id[i]) * 16777619U;
+
+	return hash;
+}
+
+/* Find the slot of the commit with the given ID or the empty slot where
+ * it should be added. */
+static struct blame_commit **
+find_blame_commit_slot(struct blame_commit **table, size_t size, const char *id)
+{
+	size_t pos = blame_commit_hash(id) & (size - 1);
+
+	while (table[pos] && strncmp(table[pos]->id, id, SIZEOF_REV - 1))
+		pos = (pos + 1) & (size - 1);
+
+	return &table[pos];
+}
+
+static bool
+grow_blame_commits(struct blame_commits *commits)
+{
+	size_t size = commits->size ? commits->size * 2 : BLAME_COMMITS_MIN_SIZE;
+	struct blame_commit **table = calloc(size, sizeof(*table));
+	size_t i;
+
+	if (!table)
+		return FALSE;
+
+	for (i = 0; i < commits->size; i++) {
+		struct blame_commit *commit = commits->table[i];
+
+		if (commit)
+			*find_blame_commit_slot(table, size, commit->id) = commit;
+	}
+
+	free(commits->table);
+	commits->table = table;
+	commits->size = size;
+	return TRUE;
+}
+
+/* Get the commit with the given ID, which can be the start of a blame
+ * header, or add a new one. The table is kept at most 3/4 full. */
+struct blame_commit *
+get_blame_commit(struct blame_commits *commits, const char *id)
+{
+	struct blame_commit **slot;
+	struct blame_commit *commit;
+
+	if (commits->size) {
+		slot = find_blame_commit_slot(commits->table, commits->size, id);
+		if (*slot)
+			return *slot;
+	}
+
+	if ((commits->count + 1) * 4 > commits->size * 3 &&
+	    !grow_blame_commits(commits))
+		return NULL;
+
+	commit = calloc(1, sizeof(*commit));
+	if (!commit)
+		return NULL;
+
+	string_ncopy(commit->id, id, SIZEOF_REV);
+	slot = find_blame_commit_slot(commits->table, commits->size, commit->id);
+	*slot = commit;
+	commits->count++;
+	return commit;
+}
+
+void
+free_blame_commits(struct blame_commits *commits)
+{
+	size_t i;
+
+	for (i = 0; i < commits->size; i++)
+		free(commits->table[i]);
+	free(commits->table);
+	memset(commits, 0, sizeof(*commits));
+}
+
+/* Get the type of a line of git-show(1) output with --patch-with-stat.
+ * Diff stat lines get the LINE_DIFF_STAT type and commit_title is set for
+ * the first line of the commit message. */
+enum line_type
+parse_diff_line(struct diff_parser *parser, const char *data, bool first_line, bool *commit_title)
+{
+	enum line_type type = get_line_type(data);
+
+	*commit_title = FALSE;
+
+	if (first_line && type != LINE_COMMIT)
+		parser->reading_diff_stat = TRUE;
+
+	if (parser->combined_diff && !parser->after_diff && data[0] == ' ' && data[1] != ' ')
+		parser->reading_diff_stat = TRUE;
+
+	if (parser->reading_diff_stat) {
+		size_t len = strlen(data);
+		char *pipe = strchr(data, '|');
+		bool has_histogram = data[len - 1] == '-' || data[len - 1] == '+';
+		bool has_bin_diff = pipe && strstr(pipe, "Bin") && strstr(pipe, "->");
+		bool has_rename = data[len - 1] == '0' && (strstr(data, "=>") || !strncmp(data, " ...", 4));
+
+		if (pipe && (has_histogram || has_bin_diff || has_rename)) {
+			return LINE_DIFF_STAT;
+		} else {
+			parser->reading_diff_stat = FALSE;
+		}
+
+	} else if (!strcmp(data, "---")) {
+		parser->reading_diff_stat = TRUE;
+	}
+
+	if (!parser->after_commit_title && !prefixcmp(data, "    ")) {
+		parser->after_commit_title = TRUE;
+		*commit_title = TRUE;
+		return LINE_DEFAULT;
+	}
+
+	if (type == LINE_DIFF_HEADER) {
+		const int len = STRING_SIZE("diff --");
+
+		parser->after_diff = TRUE;
+		if (!strncmp(data + len, "combined ", strlen("combined ")) ||
+		    !strncmp(data + len, "cc ", strlen("cc ")))
+			parser->combined_diff = TRUE;
+
+	} else if (type == LINE_PP_MERGE) {
+		parser->combined_diff = TRUE;
+	}
+
+	/* ADD2 and DEL2 are only valid in combined diff hunks */
+	if (!parser->combined_diff && (type == LINE_DIFF_ADD2 || type == LINE_DIFF_DEL2))
+		type = LINE_DEFAULT;
+
+	return type;
+}
+
+/* Unquote a path quoted by git like a C string:
+ * "caf\303\251 \"menu\".txt"
+ * Paths which are not quoted are copied as they are. */
+bool
+unquote_path(char *dst, size_t dstsize, const char *src, size_t srclen)
+{
+	static const char escapes[] = "abfnrtv\\\"";
+	static const char escaped[] = "\a\b\f\n\r\t\v\\\"";
+	const char *end = src + srclen;
+	size_t pos = 0;
+
+	if (srclen < 2 || *src != '"' || end[-1] != '"') {
+		if (srclen >= dstsize)
+			return FALSE;
+		memcpy(dst, src, srclen);
+		dst[srclen] = 0;
+		return TRUE;
+	}
+
+	for (src++, end--; src < end; src++) {
+		char c = *src;
+
+		if (c == '\\') {
+			const char *escape;
+
+			if (++src == end)
+				return FALSE;
+			if (end - src >= 3 &&
+			    '0' <= src[0] && src[0] <= '3' &&
+			    '0' <= src[1] && src[1] <= '7' &&
+			    '0' <= src[2] && src[2] <= '7') {
+				c = ((src[0] - '0') << 6) | ((src[1] - '0') << 3) | (src[2] - '0');
+				src += 2;
+			} else if ((escape = strchr(escapes, *src))) {
+				c = escaped[escape - escapes];
+			} else {
+				return FALSE;
+			}
+		}
+
+		if (pos + 1 >= dstsize)
+			return FALSE;
+		dst[pos++] = c;
+	}
+
+	dst[pos] = 0;
+	return TRUE;
+}
+
+/* Get fields from the diff line:
+ * :100644 100644 06a5d6ae9eca55be2e0e585a152e6b1336f2b20e 0000000000000000000000000000000000000000 M
+ */
+bool
+status_get_diff(struct status *file, const char *buf, size_t bufsize)
+{
+	const char *old_mode = buf +  1;
+	const char *new_mode = buf +  8;
+	const char *old_rev  = buf + 15;
+	const char *new_rev  = buf + 56;
+	const char *status   = buf + 97;
+
+	if (bufsize < 98 ||
+	    old_mode[-1] != ':' ||
+	    new_mode[-1] != ' ' ||
+	    old_rev[-1]  != ' ' ||
+	    new_rev[-1]  != ' ' ||
+	    status[-1]   != ' ')
+		return FALSE;
+
+	file->status = *status;
+
+	string_copy_rev(file->old.rev, old_rev);
+	string_copy_rev(file->new.rev, new_rev);
+
+	file->old.mode = strtoul(old_mode, NULL, 8);
+	file->new.mode = strtoul(new_mode, NULL, 8);
+
+	file->old.name[0] = file->new.name[0] = 0;
+
+	return TRUE;
+}
+
+static inline size_t
+parse_size(const char *text, int *max_digits)
+{
+	size_t size = 0;
+	int digits = 0;
+
+	while (*text == ' ')
+		text++;
+
+	while (isdigit(*text)) {
+		size = (size * 10) + (*text++ - '0');
+		digits++;
+	}
+
+	if (digits > *max_digits)
+		*max_digits = digits;
+
+	return size;
+}
+
+/* Returns the path of the tree entry and sets its size. The size width
+ * is updated to fit the largest size seen so far. Without a size, it is
+ * set to zero and the width is left alone. */
+char *
+parse_tree_line(char *text, size_t textlen, size_t *size, int *size_width)
+{
+	char *path;
+
+	if (textlen <= SIZEOF_TREE_ATTR)
+		return NULL;
+
+	if (text[SIZEOF_TREE_ATTR - 1] == '\t') {
+		*size = 0;
+		return text + SIZEOF_TREE_ATTR;
+	}
+
+	*size = parse_size(text + SIZEOF_TREE_ATTR, size_width);
+	path = strchr(text + SIZEOF_TREE_ATTR, '\t');
+	return path ? path + 1 : NULL;
+}
+
+/* Returns the name of the entry relative to the listed directory and
+ * sets its line type and size. */
+char *
+parse_tree_entry(struct tree_parser *parser, char *text, enum line_type *type, size_t *size)
+{
+	size_t textlen = strlen(text);
+	size_t striplen = strlen(parser->path);
+	char *path = parse_tree_line(text, textlen, size, &parser->size_width);
+	size_t pathlen;
+
+	if (!path)
+		return NULL;
+
+	/* Strip the path part ... */
+	pathlen = textlen - (path - text);
+	if (striplen && pathlen > striplen && !strncmp(path, parser->path, striplen))
+		memmove(path, path + striplen, pathlen - striplen + 1);
+
+	*type = text[SIZEOF_TREE_MODE] == 't' ? LINE_TREE_DIR : LINE_TREE_FILE;
+	return path;
+}
+
+void
+set_tree_entry(struct tree_entry *entry, const char *name, const char *mode,
+	       const char *id, unsigned long size)
+{
+	memcpy(entry->name, name, strlen(name));
+	if (mode)
+		entry->mode = strtoul(mode, NULL, 8);
+	if (id)
+		string_copy_rev(entry->id, id);
+	entry->size = size;
+}
+
+/* vim: set ts=8 sw=8 noexpandtab: */
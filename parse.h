@@ -0,0 +1,183 @@
+/* Copyright (c) 2006-2013 Jonas Fonseca <fonseca@diku.dk>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef TIG_PARSE_H
+#define TIG_PARSE_H
+
+#include "tig.h"
+#include "line.h"
+#include "graph.h"
+
+/*
+ * Parsers of Git output shared by the views.
+ */
+
+struct time {
+	time_t sec;
+	int tz;
+};
+
+static inline int timecmp(const struct time *t1, const struct time *t2)
+{
+	return t1->sec - t2->sec;
+}
+
+struct ident {
+	const char *name;
+	const char *email;
+};
+
+extern const struct ident unknown_ident;
+
+static inline int
+ident_compare(const struct ident *i1, const struct ident *i2)
+{
+	if (!i1 || !i2)
+		return (!!i1) - (!!i2);
+	if (!i1->name || !i2->name)
+		return (!!i1->name) - (!!i2->name);
+	return strcmp(i1->name, i2->name);
+}
+
+struct ident *get_author(const char *name, const char *email);
+void parse_timesec(struct time *time, const char *sec);
+void parse_timezone(struct time *time, const char *zone);
+void parse_author_line(char *ident, const struct ident **author, struct time *time);
+
+struct commit {
+	char id[SIZEOF_REV];		/* SHA1 ID. */
+	const struct ident *author;	/* Author of the commit. */
+	struct time time;		/* Date from the author ident. */
+	struct graph_canvas graph;	/* Ancestry chain graphics. */
+	char title[1];			/* First line of the commit message. */
+};
+
+/* State of git log --pretty=raw output being read. */
+struct commit_parser {
+	struct commit commit;		/* Commit being read. */
+	struct graph *graph;		/* Graph of the commits or NULL. */
+	bool in_header;
+	bool is_boundary;
+};
+
+enum commit_line {
+	COMMIT_LINE_NONE,
+	COMMIT_LINE_ID,			/* A commit starts with the IDs in text. */
+	COMMIT_LINE_TITLE,		/* The commit has the title in text. */
+};
+
+/* The previous commit must be added before the IDs of a new commit
+ * are registered and when it gets its title. */
+enum commit_line parse_commit_line(struct commit_parser *parser, char *line, char **text);
+void parse_commit_ids(struct commit *commit, struct graph *graph, const char *ids, bool is_boundary);
+void move_commit(struct commit *commit, struct commit *template, struct graph *graph,
+		 const char *title, size_t titlelen);
+
+struct blame_commit {
+	char id[SIZEOF_REV];		/* SHA1 ID. */
+	char title[128];		/* First line of the commit message. */
+	const struct ident *author;	/* Author of the commit. */
+	struct time time;		/* Date from the author ident. */
+	char filename[128];		/* Name of file. */
+	char parent_id[SIZEOF_REV];	/* Parent/previous SHA1 ID. */
+	char parent_filename[128];	/* Parent/previous name of file. */
+};
+
+struct blame_header {
+	char id[SIZEOF_REV];		/* SHA1 ID. */
+	size_t orig_lineno;
+	size_t lineno;
+	size_t group;
+};
+
+bool parse_blame_header(struct blame_header *header, const char *text, size_t max_lineno);
+bool parse_blame_info(struct blame_commit *commit, char *line);
+
+/* Commits of a blame view indexed by their ID. */
+struct blame_commits {
+	struct blame_commit **table;
+	size_t size;			/* Number of slots, a power of two. */
+	size_t count;			/* Number of commits in the table. */
+};
+
+struct blame_commit *get_blame_commit(struct blame_commits *commits, const char *id);
+void free_blame_commits(struct blame_commits *commits);
+
+struct diff_parser {
+	bool after_commit_title;
+	bool after_diff;
+	bool reading_diff_stat;
+	bool combined_diff;
+};
+
+enum line_type parse_diff_line(struct diff_parser *parser, const char *data, bool first_line, bool *commit_title);
+
+struct status {
+	char status;
+	struct {
+		mode_t mode;
+		char rev[SIZEOF_REV];
+		char name[SIZEOF_STR];
+	} old;
+	struct {
+		mode_t mode;
+		char rev[SIZEOF_REV];
+		char name[SIZEOF_STR];
+	} new;
+};
+
+bool status_get_diff(struct status *file, const char *buf, size_t bufsize);
+bool unquote_path(char *dst, size_t dstsize, const char *src, size_t srclen);
+
+/* Parse output from git-ls-tree(1) with or without the size:
+ *
+ * 100644 blob 95925677ca47beb0b8cce7c0e0011bcc3f61470f  213045	tig.c
+ * 100644 blob 95925677ca47beb0b8cce7c0e0011bcc3f61470f	tig.c
+ */
+
+#define SIZEOF_TREE_ATTR \
+	STRING_SIZE("100644 blob f931e1d229c3e185caad4449bf5b66ed72462657\t")
+
+#define SIZEOF_TREE_MODE \
+	STRING_SIZE("100644 ")
+
+#define TREE_ID_OFFSET \
+	STRING_SIZE("100644 blob ")
+
+char *parse_tree_line(char *text, size_t textlen, size_t *size, int *size_width);
+
+struct tree_entry {
+	char id[SIZEOF_REV];
+	char commit[SIZEOF_REV];
+	mode_t mode;
+	struct time time;		/* Date from the author ident. */
+	const struct ident *author;	/* Author of the commit. */
+	unsigned long size;
+	unsigned int size_known:1;	/* Whether the size has been read. */
+	unsigned int size_wanted:1;	/* Whether the size has been asked for. */
+	char name[1];
+};
+
+/* State of git-ls-tree(1) output being read for a directory. */
+struct tree_parser {
+	const char *path;		/* Directory stripped from the names. */
+	int size_width;
+};
+
+char *parse_tree_entry(struct tree_parser *parser, char *text, enum line_type *type, size_t *size);
+void set_tree_entry(struct tree_entry *entry, const char *name, const char *mode,
+		    const char *id, unsigned long size);
+
+#endif
+
+/* vim: set ts=8 sw=8 noexpandtab: */
@@ -0,0 +1,166 @@
+/* Copyright (c) 2006-2013 Jonas Fonseca <fonseca@diku.dk>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "tig.h"
+#include "spill.h"
+
+#include <sys/mman.h>
+
+/*
+ * The whole file is mapped once so data handed out by spill_alloc() keeps
+ * its address while the file grows. The file is grown by writing zeros
+ * so that its blocks are allocated before they are written through the
+ * mapping, which would otherwise fail with SIGBUS when the disk is full.
+ * Pages which are not needed are given back to the kernel, which can
+ * read them in again from the file.
+ */
+
+/* Number of bytes the file is grown by. */
+#define SPILL_CHUNK	(1024 * 1024)
+
+/* Size of the mapping tried first, halved until it can be reserved. */
+#define SPILL_MAPSIZE	((size_t) -1 / 8 < (64ULL << 30) ? (size_t) -1 / 8 : (size_t) (64ULL << 30))
+#define SPILL_MAPSIZE_MIN	(64 * 1024 * 1024)
+
+static size_t
+spill_page_size(void)
+{
+	static size_t page_size;
+
+	if (!page_size) {
+		long size = sysconf(_SC_PAGESIZE);
+
+		page_size = size > 0 ? size : 4096;
+	}
+
+	return page_size;
+}
+
+bool
+spill_open(struct spill *spill, const char *dir)
+{
+	char file[SIZEOF_STR];
+	size_t mapsize;
+	int fd;
+
+	memset(spill, 0, sizeof(*spill));
+	spill->failed = TRUE;
+
+	if (!string_format(file, "%s/tigspill.XXXXXX", dir))
+		return FALSE;
+
+	fd = mkstemps(file, 0);
+	if (fd == -1)
+		return FALSE;
+	unlink(file);
+
+	for (mapsize = SPILL_MAPSIZE; mapsize >= SPILL_MAPSIZE_MIN; mapsize /= 2) {
+		void *map = mmap(NULL, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+		if (map != MAP_FAILED) {
+			spill->fd = fd;
+			spill->map = map;
+			spill->mapsize = mapsize;
+			spill->failed = FALSE;
+			return TRUE;
+		}
+	}
+
+	close(fd);
+	return FALSE;
+}
+
+void
+spill_close(struct spill *spill)
+{
+	if (spill->map) {
+		munmap(spill->map, spill->mapsize);
+		close(spill->fd);
+	}
+	memset(spill, 0, sizeof(*spill));
+}
+
+static bool
+spill_grow(struct spill *spill, size_t size)
+{
+	static const char zeros[64 * 1024];
+	size_t old_size = spill->size;
+	size_t new_size = old_size;
+
+	while (new_size < size)
+		new_size += SPILL_CHUNK;
+	if (new_size > spill->mapsize)
+		return FALSE;
+
+	while (spill->size < new_size) {
+		ssize_t written = pwrite(spill->fd, zeros, MIN(sizeof(zeros), new_size - spill->size), spill->size);
+
+		if (written <= 0) {
+			if (written < 0 && errno == EINTR)
+				continue;
+			/* Drop the partly grown chunk. */
+			if (!ftruncate(spill->fd, old_size))
+				spill->size = old_size;
+			return FALSE;
+		}
+		spill->size += written;
+	}
+
+	/* Only the pages near the end are likely to be used again soon. */
+	spill_release(spill, spill->map + old_size, spill->map + new_size);
+	return TRUE;
+}
+
+void *
+spill_alloc(struct spill *spill, size_t size)
+{
+	/* Keep the data aligned for structures and not only strings. */
+	size_t aligned = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	char *data;
+
+	if (!spill->map || aligned < size)
+		return NULL;
+
+	if (spill->used + aligned > spill->size &&
+	    (spill->used + aligned < spill->used || !spill_grow(spill, spill->used + aligned)))
+		return NULL;
+
+	data = spill->map + spill->used;
+	spill->used += aligned;
+	return data;
+}
+
+void
+spill_release(struct spill *spill, const void *from, const void *to)
+{
+	size_t page_size = spill_page_size();
+	size_t keep_from, keep_to;
+
+	if (!spill->map || !spill->used)
+		return;
+
+	keep_from = (const char *) from - spill->map;
+	keep_to = (const char *) to - spill->map;
+	keep_from -= keep_from % page_size;
+	keep_to = MIN(keep_to + page_size - 1, spill->size);
+	keep_to -= keep_to % page_size;
+	if (keep_from > keep_to)
+		return;
+
+	if (keep_from > 0)
+		madvise(spill->map, keep_from, MADV_DONTNEED);
+	if (keep_to < spill->size)
+		madvise(spill->map + keep_to, spill->size - keep_to, MADV_DONTNEED);
+}
+
+/* vim: set ts=8 sw=8 noexpandtab: */
@@ -0,0 +1,43 @@
+/* Copyright (c) 2006-2013 Jonas Fonseca <fonseca@diku.dk>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef TIG_SPILL_H
+#define TIG_SPILL_H
+
+#include "tig.h"
+
+/*
+ * Line data stored in a memory mapped temporary file.
+ */
+
+struct spill {
+	int fd;
+	char *map;		/* Mapping reserved for the whole file. */
+	size_t mapsize;		/* Size of the reserved mapping. */
+	size_t size;		/* Size of the file. */
+	size_t used;		/* Bytes handed out by spill_alloc(). */
+	bool failed;		/* The file could not be created. */
+};
+
+bool spill_open(struct spill *spill, const char *dir);
+void spill_close(struct spill *spill);
+void *spill_alloc(struct spill *spill, size_t size);
+void spill_release(struct spill *spill, const void *from, const void *to);
+
+#define spill_contains(spill, ptr) \
+	((spill)->map && (const char *) (ptr) >= (spill)->map && \
+	 (const char *) (ptr) < (spill)->map + (spill)->used)
+
+#endif
+
+/* vim: set ts=8 sw=8 noexpandtab: */
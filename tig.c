@@ -16,13 +16,20 @@
 #include "tig.h"
 #include "io.h"
 #include "refs.h"
+#include "trigram.h"
+#include "spill.h"
+#include "blamecache.h"
 #include "graph.h"
 #include "git.h"
+#include "line.h"
+#include "parse.h"
 
 static void TIG_NORETURN die(const char *err, ...) PRINTF_LIKE(1, 2);
+static void TIG_NORETURN quit(int sig);
 static void warn(const char *msg, ...) PRINTF_LIKE(1, 2);
 static void report(const char *msg, ...) PRINTF_LIKE(1, 2);
 #define report_clear() report("%s", "")
+static bool input_interrupted(void);
 
 
 enum input_status {
@@ -62,16 +69,6 @@ DEFINE_ENUM(graphic, GRAPHIC_ENUM);
 
 DEFINE_ENUM(date, DATE_ENUM);
 
-struct time {
-	time_t sec;
-	int tz;
-};
-
-static inline int timecmp(const struct time *t1, const struct time *t2)
-{
-	return t1->sec - t2->sec;
-}
-
 static const char *
 mkdate(const struct time *time, enum date date)
 {
@@ -172,23 +169,6 @@ mkfilesize(unsigned long size, enum file_size format)
 
 DEFINE_ENUM(author, AUTHOR_ENUM);
 
-struct ident {
-	const char *name;
-	const char *email;
-};
-
-static const struct ident unknown_ident = { "Unknown", "unknown@localhost" };
-
-static inline int
-ident_compare(const struct ident *i1, const struct ident *i2)
-{
-	if (!i1 || !i2)
-		return (!!i1) - (!!i2);
-	if (!i1->name || !i2->name)
-		return (!!i1->name) - (!!i2->name);
-	return strcmp(i1->name, i2->name);
-}
-
 static const char *
 get_author_initials(const char *author)
 {
@@ -375,6 +355,7 @@ get_path_encoding(const char *path, struct encoding *default_encoding)
 	REQ_(NEXT,		"Move to next"), \
 	REQ_(PREVIOUS,		"Move to previous"), \
 	REQ_(PARENT,		"Move to parent"), \
+	REQ_(BACK,		"Move back to the previous blame"), \
 	REQ_(VIEW_NEXT,		"Move focus to next view"), \
 	REQ_(REFRESH,		"Reload and refresh"), \
 	REQ_(MAXIMIZE,		"Maximize the current view"), \
@@ -412,6 +393,8 @@ get_path_encoding(const char *path, struct encoding *default_encoding)
 	REQ_(SEARCH_BACK,	"Search backwards in the view"), \
 	REQ_(FIND_NEXT,		"Find next search match"), \
 	REQ_(FIND_PREV,		"Find previous search match"), \
+	REQ_(FILTER,		"Filter the view lines"), \
+	REQ_(SEARCH_HISTORY,	"Search the history using git"), \
 	\
 	REQ_GROUP("Option manipulation") \
 	REQ_(OPTIONS,		"Open option menu"), \
@@ -503,11 +486,23 @@ static bool opt_line_number		= FALSE;
 static bool opt_show_refs		= TRUE;
 static bool opt_show_changes		= TRUE;
 static bool opt_untracked_dirs_content	= TRUE;
+static bool opt_untracked_files		= TRUE;
 static bool opt_read_git_colors		= TRUE;
 static bool opt_wrap_lines		= FALSE;
 static bool opt_ignore_case		= FALSE;
 static bool opt_stdin			= FALSE;
 static bool opt_focus_child		= TRUE;
+static bool opt_search_index		= FALSE;
+static int opt_redraw_rate		= 30;
+static bool opt_load_stats		= FALSE;
+static int opt_diff_lazy_files		= 0;
+static int opt_diff_lazy_cache		= 100000;
+static int opt_spill_threshold		= 0;
+static int opt_blame_cache		= 0;
+static int opt_blame_history		= 5;
+static int opt_blame_prefetch		= 0;
+static int opt_tree_cache		= 20;
+static bool opt_tree_prefetch		= TRUE;
 static int opt_diff_context		= 3;
 static char opt_diff_context_arg[9]	= "";
 static enum ignore_space opt_ignore_space	= IGNORE_SPACE_NO;
@@ -618,151 +613,6 @@ update_notes_arg()
 	}
 }
 
-/*
- * Line-oriented content detection.
- */
-
-#define LINE_INFO \
-LINE(DIFF_HEADER,  "diff --",	COLOR_YELLOW,	COLOR_DEFAULT,	0), \
-LINE(DIFF_CHUNK,   "@@",		COLOR_MAGENTA,	COLOR_DEFAULT,	0), \
-LINE(DIFF_ADD,	   "+",			COLOR_GREEN,	COLOR_DEFAULT,	0), \
-LINE(DIFF_ADD2,	   " +",		COLOR_GREEN,	COLOR_DEFAULT,	0), \
-LINE(DIFF_DEL,	   "-",			COLOR_RED,	COLOR_DEFAULT,	0), \
-LINE(DIFF_DEL2,	   " -",		COLOR_RED,	COLOR_DEFAULT,	0), \
-LINE(DIFF_INDEX,	"index ",	  COLOR_BLUE,	COLOR_DEFAULT,	0), \
-LINE(DIFF_OLDMODE,	"old file mode ", COLOR_YELLOW,	COLOR_DEFAULT,	0), \
-LINE(DIFF_NEWMODE,	"new file mode ", COLOR_YELLOW,	COLOR_DEFAULT,	0), \
-LINE(DIFF_DELETED_FILE_MODE, \
-		    "deleted file mode ", COLOR_YELLOW,	COLOR_DEFAULT,	0), \
-LINE(DIFF_COPY_FROM,	"copy from ",	  COLOR_YELLOW,	COLOR_DEFAULT,	0), \
-LINE(DIFF_COPY_TO,	"copy to ",	  COLOR_YELLOW,	COLOR_DEFAULT,	0), \
-LINE(DIFF_RENAME_FROM,	"rename from ",	  COLOR_YELLOW,	COLOR_DEFAULT,	0), \
-LINE(DIFF_RENAME_TO,	"rename to ",	  COLOR_YELLOW,	COLOR_DEFAULT,	0), \
-LINE(DIFF_SIMILARITY,   "similarity ",	  COLOR_YELLOW,	COLOR_DEFAULT,	0), \
-LINE(DIFF_DISSIMILARITY,"dissimilarity ", COLOR_YELLOW,	COLOR_DEFAULT,	0), \
-LINE(DIFF_TREE,		"diff-tree ",	  COLOR_BLUE,	COLOR_DEFAULT,	0), \
-LINE(PP_AUTHOR,	   "Author: ",		COLOR_CYAN,	COLOR_DEFAULT,	0), \
-LINE(PP_COMMIT,	   "Commit: ",		COLOR_MAGENTA,	COLOR_DEFAULT,	0), \
-LINE(PP_MERGE,	   "Merge: ",		COLOR_BLUE,	COLOR_DEFAULT,	0), \
-LINE(PP_DATE,	   "Date:   ",		COLOR_YELLOW,	COLOR_DEFAULT,	0), \
-LINE(PP_ADATE,	   "AuthorDate: ",	COLOR_YELLOW,	COLOR_DEFAULT,	0), \
-LINE(PP_CDATE,	   "CommitDate: ",	COLOR_YELLOW,	COLOR_DEFAULT,	0), \
-LINE(PP_REFS,	   "Refs: ",		COLOR_RED,	COLOR_DEFAULT,	0), \
-LINE(PP_REFLOG,	   "Reflog: ",		COLOR_RED,	COLOR_DEFAULT,	0), \
-LINE(PP_REFLOGMSG, "Reflog message: ",	COLOR_YELLOW,	COLOR_DEFAULT,	0), \
-LINE(STASH,	   "stash@{",		COLOR_MAGENTA,	COLOR_DEFAULT,	0), \
-LINE(COMMIT,	   "commit ",		COLOR_GREEN,	COLOR_DEFAULT,	0), \
-LINE(PARENT,	   "parent ",		COLOR_BLUE,	COLOR_DEFAULT,	0), \
-LINE(TREE,	   "tree ",		COLOR_BLUE,	COLOR_DEFAULT,	0), \
-LINE(AUTHOR,	   "author ",		COLOR_GREEN,	COLOR_DEFAULT,	0), \
-LINE(COMMITTER,	   "committer ",	COLOR_MAGENTA,	COLOR_DEFAULT,	0), \
-LINE(SIGNOFF,	   "    Signed-off-by", COLOR_YELLOW,	COLOR_DEFAULT,	0), \
-LINE(ACKED,	   "    Acked-by",	COLOR_YELLOW,	COLOR_DEFAULT,	0), \
-LINE(TESTED,	   "    Tested-by",	COLOR_YELLOW,	COLOR_DEFAULT,	0), \
-LINE(REVIEWED,	   "    Reviewed-by",	COLOR_YELLOW,	COLOR_DEFAULT,	0), \
-LINE(DEFAULT,	   "",			COLOR_DEFAULT,	COLOR_DEFAULT,	A_NORMAL), \
-LINE(CURSOR,	   "",			COLOR_WHITE,	COLOR_GREEN,	A_BOLD), \
-LINE(STATUS,	   "",			COLOR_GREEN,	COLOR_DEFAULT,	0), \
-LINE(DELIMITER,	   "",			COLOR_MAGENTA,	COLOR_DEFAULT,	0), \
-LINE(DATE,         "",			COLOR_BLUE,	COLOR_DEFAULT,	0), \
-LINE(MODE,         "",			COLOR_CYAN,	COLOR_DEFAULT,	0), \
-LINE(ID,	   "",			COLOR_MAGENTA,	COLOR_DEFAULT,	0), \
-LINE(OVERFLOW,	   "",			COLOR_RED,	COLOR_DEFAULT,	0), \
-LINE(FILENAME,     "",			COLOR_DEFAULT,	COLOR_DEFAULT,	0), \
-LINE(FILE_SIZE,    "",			COLOR_DEFAULT,	COLOR_DEFAULT,	0), \
-LINE(LINE_NUMBER,  "",			COLOR_CYAN,	COLOR_DEFAULT,	0), \
-LINE(TITLE_BLUR,   "",			COLOR_WHITE,	COLOR_BLUE,	0), \
-LINE(TITLE_FOCUS,  "",			COLOR_WHITE,	COLOR_BLUE,	A_BOLD), \
-LINE(MAIN_COMMIT,  "",			COLOR_DEFAULT,	COLOR_DEFAULT,	0), \
-LINE(MAIN_TAG,     "",			COLOR_MAGENTA,	COLOR_DEFAULT,	A_BOLD), \
-LINE(MAIN_LOCAL_TAG,"",			COLOR_MAGENTA,	COLOR_DEFAULT,	0), \
-LINE(MAIN_REMOTE,  "",			COLOR_YELLOW,	COLOR_DEFAULT,	0), \
-LINE(MAIN_REPLACE, "",			COLOR_CYAN,	COLOR_DEFAULT,	0), \
-LINE(MAIN_TRACKED, "",			COLOR_YELLOW,	COLOR_DEFAULT,	A_BOLD), \
-LINE(MAIN_REF,     "",			COLOR_CYAN,	COLOR_DEFAULT,	0), \
-LINE(MAIN_HEAD,    "",			COLOR_CYAN,	COLOR_DEFAULT,	A_BOLD), \
-LINE(MAIN_REVGRAPH,"",			COLOR_MAGENTA,	COLOR_DEFAULT,	0), \
-LINE(TREE_HEAD,    "",			COLOR_DEFAULT,	COLOR_DEFAULT,	A_BOLD), \
-LINE(TREE_DIR,     "",			COLOR_YELLOW,	COLOR_DEFAULT,	A_NORMAL), \
-LINE(TREE_FILE,    "",			COLOR_DEFAULT,	COLOR_DEFAULT,	A_NORMAL), \
-LINE(STAT_HEAD,    "",			COLOR_YELLOW,	COLOR_DEFAULT,	0), \
-LINE(STAT_SECTION, "",			COLOR_CYAN,	COLOR_DEFAULT,	0), \
-LINE(STAT_NONE,    "",			COLOR_DEFAULT,	COLOR_DEFAULT,	0), \
-LINE(STAT_STAGED,  "",			COLOR_MAGENTA,	COLOR_DEFAULT,	0), \
-LINE(STAT_UNSTAGED,"",			COLOR_MAGENTA,	COLOR_DEFAULT,	0), \
-LINE(STAT_UNTRACKED,"",			COLOR_MAGENTA,	COLOR_DEFAULT,	0), \
-LINE(HELP_KEYMAP,  "",			COLOR_CYAN,	COLOR_DEFAULT,	0), \
-LINE(HELP_GROUP,   "",			COLOR_BLUE,	COLOR_DEFAULT,	0), \
-LINE(DIFF_STAT,		"",	  	COLOR_BLUE,	COLOR_DEFAULT,	0), \
-LINE(PALETTE_0, "",			COLOR_MAGENTA,	COLOR_DEFAULT,	0), \
-LINE(PALETTE_1, "",			COLOR_YELLOW,	COLOR_DEFAULT,	0), \
-LINE(PALETTE_2, "",			COLOR_CYAN,	COLOR_DEFAULT,	0), \
-LINE(PALETTE_3, "",			COLOR_GREEN,	COLOR_DEFAULT,	0), \
-LINE(PALETTE_4, "",			COLOR_DEFAULT,	COLOR_DEFAULT,	0), \
-LINE(PALETTE_5, "",			COLOR_WHITE,	COLOR_DEFAULT,	0), \
-LINE(PALETTE_6, "",			COLOR_RED,	COLOR_DEFAULT,	0), \
-LINE(GRAPH_COMMIT, "",			COLOR_BLUE,	COLOR_DEFAULT,	0)
-
-enum line_type {
-#define LINE(type, line, fg, bg, attr) \
-	LINE_##type
-	LINE_INFO,
-	LINE_NONE
-#undef	LINE
-};
-
-struct line_info {
-	const char *name;	/* Option name. */
-	int namelen;		/* Size of option name. */
-	const char *line;	/* The start of line to match. */
-	int linelen;		/* Size of string to match. */
-	int fg, bg, attr;	/* Color and text attributes for the lines. */
-	int color_pair;
-};
-
-static struct line_info line_info[] = {
-#define LINE(type, line, fg, bg, attr) \
-	{ #type, STRING_SIZE(#type), (line), STRING_SIZE(line), (fg), (bg), (attr) }
-	LINE_INFO
-#undef	LINE
-};
-
-static struct line_info **color_pair;
-static size_t color_pairs;
-
-static struct line_info *custom_color;
-static size_t custom_colors;
-
-DEFINE_ALLOCATOR(realloc_custom_color, struct line_info, 8)
-DEFINE_ALLOCATOR(realloc_color_pair, struct line_info *, 8)
-
-#define TO_CUSTOM_COLOR_TYPE(type)	(LINE_NONE + 1 + (type))
-#define TO_CUSTOM_COLOR_OFFSET(type)	((type) - LINE_NONE - 1)
-
-/* Color IDs must be 1 or higher. [GH #15] */
-#define COLOR_ID(line_type)		((line_type) + 1)
-
-static enum line_type
-get_line_type(const char *line)
-{
-	int linelen = strlen(line);
-	enum line_type type;
-
-	for (type = 0; type < custom_colors; type++)
-		/* Case insensitive search matches Signed-off-by lines better. */
-		if (linelen >= custom_color[type].linelen &&
-		    !strncasecmp(custom_color[type].line, line, custom_color[type].linelen))
-			return TO_CUSTOM_COLOR_TYPE(type);
-
-	for (type = 0; type < ARRAY_SIZE(line_info); type++)
-		/* Case insensitive search matches Signed-off-by lines better. */
-		if (linelen >= line_info[type].linelen &&
-		    !strncasecmp(line_info[type].line, line, line_info[type].linelen))
-			return type;
-
-	return LINE_DEFAULT;
-}
-
 static enum line_type
 get_line_type_from_ref(const struct ref *ref)
 {
@@ -782,121 +632,6 @@ get_line_type_from_ref(const struct ref *ref)
 	return LINE_MAIN_REF;
 }
 
-static inline struct line_info *
-get_line(enum line_type type)
-{
-	if (type > LINE_NONE) {
-		assert(TO_CUSTOM_COLOR_OFFSET(type) < custom_colors);
-		return &custom_color[TO_CUSTOM_COLOR_OFFSET(type)];
-	} else {
-		assert(type < ARRAY_SIZE(line_info));
-		return &line_info[type];
-	}
-}
-
-static inline int
-get_line_color(enum line_type type)
-{
-	return COLOR_ID(get_line(type)->color_pair);
-}
-
-static inline int
-get_line_attr(enum line_type type)
-{
-	struct line_info *info = get_line(type);
-
-	return COLOR_PAIR(COLOR_ID(info->color_pair)) | info->attr;
-}
-
-static struct line_info *
-get_line_info(const char *name)
-{
-	size_t namelen = strlen(name);
-	enum line_type type;
-
-	for (type = 0; type < ARRAY_SIZE(line_info); type++)
-		if (enum_equals(line_info[type], name, namelen))
-			return &line_info[type];
-
-	return NULL;
-}
-
-static struct line_info *
-add_custom_color(const char *quoted_line)
-{
-	struct line_info *info;
-	char *line;
-	size_t linelen;
-
-	if (!realloc_custom_color(&custom_color, custom_colors, 1))
-		die("Failed to alloc custom line info");
-
-	linelen = strlen(quoted_line) - 1;
-	line = malloc(linelen);
-	if (!line)
-		return NULL;
-
-	strncpy(line, quoted_line + 1, linelen);
-	line[linelen - 1] = 0;
-
-	info = &custom_color[custom_colors++];
-	info->name = info->line = line;
-	info->namelen = info->linelen = strlen(line);
-
-	return info;
-}
-
-static void
-init_line_info_color_pair(struct line_info *info, enum line_type type,
-	int default_bg, int default_fg)
-{
-	int bg = info->bg == COLOR_DEFAULT ? default_bg : info->bg;
-	int fg = info->fg == COLOR_DEFAULT ? default_fg : info->fg;
-	int i;
-
-	for (i = 0; i < color_pairs; i++) {
-		if (color_pair[i]->fg == info->fg && color_pair[i]->bg == info->bg) {
-			info->color_pair = i;
-			return;
-		}
-	}
-
-	if (!realloc_color_pair(&color_pair, color_pairs, 1))
-		die("Failed to alloc color pair");
-
-	color_pair[color_pairs] = info;
-	info->color_pair = color_pairs++;
-	init_pair(COLOR_ID(info->color_pair), fg, bg);
-}
-
-static void
-init_colors(void)
-{
-	int default_bg = line_info[LINE_DEFAULT].bg;
-	int default_fg = line_info[LINE_DEFAULT].fg;
-	enum line_type type;
-
-	start_color();
-
-	if (assume_default_colors(default_fg, default_bg) == ERR) {
-		default_bg = COLOR_BLACK;
-		default_fg = COLOR_WHITE;
-	}
-
-	for (type = 0; type < ARRAY_SIZE(line_info); type++) {
-		struct line_info *info = &line_info[type];
-
-		init_line_info_color_pair(info, type, default_bg, default_fg);
-	}
-
-	for (type = 0; type < custom_colors; type++) {
-		struct line_info *info = &custom_color[type];
-
-		init_line_info_color_pair(info, TO_CUSTOM_COLOR_TYPE(type),
-					  default_bg, default_fg);
-	}
-}
-
 struct line {
 	enum line_type type;
 	unsigned int lineno:24;
@@ -905,7 +640,6 @@ struct line {
 	unsigned int selected:1;
 	unsigned int dirty:1;
 	unsigned int cleareol:1;
-	unsigned int wrapped:1;
 
 	unsigned int user_flags:6;
 	void *data;		/* User data */
@@ -948,6 +682,7 @@ static struct keybinding default_keybindings[] = {
 	{ KEY_F(5),	REQ_REFRESH },
 	{ 'O',		REQ_MAXIMIZE },
 	{ ',',		REQ_PARENT },
+	{ '<',		REQ_BACK },
 
 	/* View specific */
 	{ 'u',		REQ_STATUS_UPDATE },
@@ -987,6 +722,7 @@ static struct keybinding default_keybindings[] = {
 	{ '?',		REQ_SEARCH_BACK },
 	{ 'n',		REQ_FIND_NEXT },
 	{ 'N',		REQ_FIND_PREV },
+	{ '&',		REQ_FILTER },
 
 	/* Misc */
 	{ 'Q',		REQ_QUIT },
@@ -1457,7 +1193,7 @@ option_color_command(int argc, const char *argv[])
 
 		if (!map_enum(&index, obsolete, argv[0]))
 			return OPT_ERR_UNKNOWN_COLOR_NAME;
-		info = &line_info[index];
+		info = get_line(index);
 	}
 
 	if (!set_color(&info->fg, argv[1]) ||
@@ -1636,6 +1372,39 @@ option_set_command(int argc, const char *argv[])
 	if (!strcmp(argv[0], "tab-size"))
 		return parse_int(&opt_tab_size, argv[2], 1, 1024);
 
+	if (!strcmp(argv[0], "search-index"))
+		return parse_bool(&opt_search_index, argv[2]);
+
+	if (!strcmp(argv[0], "redraw-rate"))
+		return parse_int(&opt_redraw_rate, argv[2], 0, 1000);
+
+	if (!strcmp(argv[0], "load-stats"))
+		return parse_bool(&opt_load_stats, argv[2]);
+
+	if (!strcmp(argv[0], "diff-lazy-files"))
+		return parse_int(&opt_diff_lazy_files, argv[2], 0, 9999999);
+
+	if (!strcmp(argv[0], "diff-lazy-cache"))
+		return parse_int(&opt_diff_lazy_cache, argv[2], 0, 999999999);
+
+	if (!strcmp(argv[0], "spill-threshold"))
+		return parse_int(&opt_spill_threshold, argv[2], 0, 999999);
+
+	if (!strcmp(argv[0], "blame-cache"))
+		return parse_int(&opt_blame_cache, argv[2], 0, 999999);
+
+	if (!strcmp(argv[0], "blame-history"))
+		return parse_int(&opt_blame_history, argv[2], 0, 999);
+
+	if (!strcmp(argv[0], "blame-prefetch"))
+		return parse_int(&opt_blame_prefetch, argv[2], 0, 9999);
+
+	if (!strcmp(argv[0], "tree-cache"))
+		return parse_int(&opt_tree_cache, argv[2], 0, 9999);
+
+	if (!strcmp(argv[0], "tree-prefetch"))
+		return parse_bool(&opt_tree_prefetch, argv[2]);
+
 	if (!strcmp(argv[0], "diff-context")) {
 		enum option_code code = parse_int(&opt_diff_context, argv[2], 0, 999999);
 
@@ -1663,6 +1432,9 @@ option_set_command(int argc, const char *argv[])
 	if (!strcmp(argv[0], "status-untracked-dirs"))
 		return parse_bool(&opt_untracked_dirs_content, argv[2]);
 
+	if (!strcmp(argv[0], "status-untracked-files"))
+		return parse_bool(&opt_untracked_files, argv[2]);
+
 	if (!strcmp(argv[0], "read-git-colors"))
 		return parse_bool(&opt_read_git_colors, argv[2]);
 
@@ -1963,6 +1735,8 @@ enum view_flag {
 	VIEW_FILE_FILTER	= 1 << 10,
 	VIEW_LOG_LIKE		= 1 << 11,
 	VIEW_STATUS_LIKE	= 1 << 12,
+	VIEW_SPILL_LINES	= 1 << 13,
+	VIEW_WRAP_LINES		= 1 << 14,
 };
 
 #define view_has_flags(view, flag)	((view)->ops->flags & (flag))
@@ -1971,6 +1745,37 @@ struct position {
 	unsigned long offset;	/* Offset of the window top */
 	unsigned long col;	/* Offset from the window side. */
 	unsigned long lineno;	/* Current line number */
+	unsigned long row;	/* Rows of the top line above the window. */
+};
+
+/* While a filter is active view->line holds shallow copies of the matching
+ * lines, which share their data with the unfiltered line index. */
+struct view_filter {
+	char grep[SIZEOF_STR];	/* Filter string */
+	regex_t regex;		/* Pre-compiled filter regexp */
+	struct line *line;	/* Unfiltered line index */
+	size_t lines;		/* Total number of unfiltered lines */
+	size_t checked;		/* Number of unfiltered lines checked */
+	unsigned long *index;	/* Unfiltered line numbers of view->line */
+};
+
+/* Running sums of the rows used by wrapped lines. */
+struct view_wrap {
+	int width;		/* Width the rows were counted for. */
+	size_t lines;		/* Number of lines with counted rows. */
+	unsigned long *rows;	/* Rows used by the lines above each line. */
+};
+
+struct view_stats {
+	unsigned long long start;	/* Time the load was started in usecs. */
+	unsigned long long bytes;	/* Bytes read from the pipe. */
+	unsigned long lines;		/* Lines passed to the read callback. */
+	unsigned long first_line;	/* Usecs until the first line was read. */
+	unsigned long eof;		/* Usecs until end of file was reached. */
+	unsigned long long read_usecs;	/* Usecs spent in view->ops->read(). */
+	unsigned long long get_usecs;	/* Usecs spent in io_get(). */
+	unsigned long long alloc;	/* Bytes of line data allocated. */
+	unsigned long long spilled;	/* Bytes of line data in the spill file. */
 };
 
 struct view {
@@ -1993,6 +1798,9 @@ struct view {
 	char grep[SIZEOF_STR];	/* Search string */
 	regex_t *regex;		/* Pre-compiled regexp */
 
+	/* Filtering */
+	struct view_filter *filter; /* Non-NULL when only matching lines are shown. */
+
 	/* If non-NULL, points to the view that opened this view. If this view
 	 * is closed tig will switch back to the parent view. */
 	struct view *parent;
@@ -2002,6 +1810,9 @@ struct view {
 	size_t lines;		/* Total number of lines */
 	struct line *line;	/* Line index */
 	unsigned int digits;	/* Number of digits in the lines member. */
+	struct spill spill;	/* Line data stored in a temporary file. */
+	struct view_wrap wrap;	/* Rows of wrapped lines. */
+	struct render_entry *render; /* Rendered text of the drawn lines. */
 
 	/* Number of lines with custom status, not to be counted in the
 	 * view title. */
@@ -2009,10 +1820,12 @@ struct view {
 
 	/* Drawing */
 	struct line *curline;	/* Line currently being drawn. */
+	unsigned int currow;	/* Row of the wrapped line being drawn. */
 	enum line_type curtype;	/* Attribute currently used for drawing. */
 	unsigned long col;	/* Column when drawing. */
 	bool has_scrolled;	/* View was scrolled. */
 	bool force_redraw;	/* Whether to force a redraw after reading. */
+	bool redraw_pending;	/* Whether read lines have yet to be drawn. */
 
 	/* Loading */
 	const char **argv;	/* Shell command arguments. */
@@ -2021,6 +1834,7 @@ struct view {
 	struct io *pipe;
 	time_t start_time;
 	time_t update_secs;
+	struct view_stats stats;
 	struct encoding *encoding;
 	bool unrefreshable;
 
@@ -2113,6 +1927,202 @@ view_request(struct view *view, enum request request)
 	return view->ops->request(view, request, &view->line[view->pos.lineno]);
 }
 
+/*
+ * Line wrapping.
+ *
+ * Views with the VIEW_WRAP_LINES flag wrap long lines when drawing them.
+ * The rows used by each line are counted for the current width when first
+ * needed and kept as running sums, so the line shown in a row of the view
+ * can be found with a binary search. View positions are still given in
+ * lines, with pos.row telling how much of the top line is scrolled out of
+ * the window.
+ */
+
+DEFINE_ALLOCATOR(realloc_wrap_rows, unsigned long, 1024)
+
+static inline bool
+view_is_wrapped(struct view *view)
+{
+	return opt_wrap_lines && view_has_flags(view, VIEW_WRAP_LINES);
+}
+
+/* Width available for the text of the lines. Rows after the first start
+ * with a delimiter, so they fit one character less. */
+static int
+get_wrap_width(struct view *view)
+{
+	int width = view->width;
+
+	if (opt_line_number)
+		width -= MAX(view->digits, 3) + 2;
+	return MAX(width, 2);
+}
+
+static inline size_t
+wrap_row_length(const char *text, size_t textlen, int width, unsigned int row)
+{
+	return string_expanded_length(text, textlen, opt_tab_size, width - !!row);
+}
+
+static unsigned int
+count_wrapped_rows(const char *text, int width)
+{
+	size_t textlen = text ? strlen(text) : 0;
+	size_t rowlen = wrap_row_length(text, textlen, width, 0);
+	unsigned int rows = 1;
+
+	while (rowlen < textlen) {
+		text += rowlen;
+		textlen -= rowlen;
+		rowlen = wrap_row_length(text, textlen, width, rows++);
+	}
+
+	return rows;
+}
+
+/* Find the text shown in a row of a wrapped line. */
+static const char *
+get_wrapped_text(const char *text, int width, unsigned int row, size_t *length)
+{
+	size_t textlen = strlen(text);
+	size_t rowlen = wrap_row_length(text, textlen, width, 0);
+	unsigned int i;
+
+	for (i = 0; i < row && rowlen < textlen; i++) {
+		text += rowlen;
+		textlen -= rowlen;
+		rowlen = wrap_row_length(text, textlen, width, i + 1);
+	}
+
+	*length = rowlen;
+	return text;
+}
+
+/* Count the rows of the lines above the given line. Rows are only counted
+ * once for each width, so lines added while loading are counted as they
+ * are shown. */
+static bool
+update_view_wrap(struct view *view, size_t lines)
+{
+	struct view_wrap *wrap = &view->wrap;
+	int width = get_wrap_width(view);
+	size_t i;
+
+	if (wrap->width != width) {
+		wrap->width = width;
+		wrap->lines = 0;
+	}
+	if (wrap->lines > view->lines)
+		wrap->lines = view->lines;
+	if (lines > view->lines)
+		lines = view->lines;
+	if (wrap->rows && lines <= wrap->lines)
+		return TRUE;
+
+	if (!realloc_wrap_rows(&wrap->rows, wrap->rows ? wrap->lines + 1 : 0,
+			       lines - wrap->lines + !wrap->rows))
+		return FALSE;
+
+	if (!wrap->lines)
+		wrap->rows[0] = 0;
+	for (i = wrap->lines; i < lines; i++)
+		wrap->rows[i + 1] = wrap->rows[i] + count_wrapped_rows(view->line[i].data, width);
+	wrap->lines = lines;
+
+	return TRUE;
+}
+
+static void
+reset_view_wrap(struct view *view)
+{
+	view->wrap.lines = 0;
+}
+
+/* Number of rows above a line. */
+static unsigned long
+get_view_row(struct view *view, unsigned long lineno)
+{
+	if (!view_is_wrapped(view))
+		return lineno;
+	if (lineno > view->lines)
+		lineno = view->lines;
+	if (!update_view_wrap(view, lineno))
+		return lineno;
+	return view->wrap.rows[lineno];
+}
+
+static unsigned long
+get_view_line_rows(struct view *view, unsigned long lineno)
+{
+	return get_view_row(view, lineno + 1) - get_view_row(view, lineno);
+}
+
+/* Find the line shown in a row and which of its rows it is. Returns
+ * view->lines for rows below the last line. */
+static unsigned long
+get_view_row_line(struct view *view, unsigned long row, unsigned int *line_row)
+{
+	struct view_wrap *wrap = &view->wrap;
+	size_t low = 0, high;
+
+	*line_row = 0;
+	if (!view_is_wrapped(view))
+		return row;
+
+	/* Each line uses at least one row. */
+	if (!update_view_wrap(view, row + 1) || !wrap->lines)
+		return MIN(row, view->lines);
+	if (wrap->rows[wrap->lines] <= row)
+		return view->lines;
+
+	high = wrap->lines - 1;
+	while (low < high) {
+		size_t mid = low + (high - low + 1) / 2;
+
+		if (wrap->rows[mid] <= row)
+			low = mid;
+		else
+			high = mid - 1;
+	}
+
+	*line_row = row - wrap->rows[low];
+	return low;
+}
+
+/* Number of rows used by all lines, but at most the given number of rows.
+ * Only the lines above that row have to be counted. */
+static unsigned long
+get_view_rows_within(struct view *view, unsigned long max_rows)
+{
+	unsigned int line_row;
+
+	if (get_view_row_line(view, max_rows, &line_row) < view->lines)
+		return max_rows;
+	return get_view_row(view, view->lines);
+}
+
+static unsigned long
+get_view_top_row(struct view *view)
+{
+	unsigned long rows;
+
+	if (!view_is_wrapped(view))
+		return view->pos.offset;
+
+	rows = get_view_line_rows(view, view->pos.offset);
+	return get_view_row(view, view->pos.offset) +
+	       (view->pos.row < rows ? view->pos.row : rows ? rows - 1 : 0);
+}
+
+static void
+set_view_top_row(struct view *view, unsigned long row)
+{
+	unsigned int line_row;
+
+	view->pos.offset = get_view_row_line(view, row, &line_row);
+	view->pos.row = line_row;
+}
+
 /*
  * View drawing.
  */
@@ -2129,6 +2139,25 @@ set_view_attr(struct view *view, enum line_type type)
 
 #define VIEW_MAX_LEN(view) ((view)->width + (view)->pos.col - (view)->col)
 
+static bool
+draw_chars_length(struct view *view, enum line_type type, const char *string,
+		  int len, int col, int trimmed, bool use_tilde)
+{
+	set_view_attr(view, type);
+	if (len > 0) {
+		waddnstr(view->win, string, len);
+
+		if (trimmed && use_tilde) {
+			set_view_attr(view, LINE_DELIMITER);
+			waddch(view->win, '~');
+			col++;
+		}
+	}
+
+	view->col += col;
+	return VIEW_MAX_LEN(view) <= 0;
+}
+
 static bool
 draw_chars(struct view *view, enum line_type type, const char *string,
 	   int max_len, bool use_tilde)
@@ -2149,19 +2178,7 @@ draw_chars(struct view *view, enum line_type type, const char *string,
 
 	len = utf8_length(&string, skip, &col, max_len, &trimmed, use_tilde, opt_tab_size);
 
-	set_view_attr(view, type);
-	if (len > 0) {
-		waddnstr(view->win, string, len);
-
-		if (trimmed && use_tilde) {
-			set_view_attr(view, LINE_DELIMITER);
-			waddch(view->win, '~');
-			col++;
-		}
-	}
-
-	view->col += col;
-	return VIEW_MAX_LEN(view) <= 0;
+	return draw_chars_length(view, type, string, len, col, trimmed, use_tilde);
 }
 
 static bool
@@ -2204,38 +2221,257 @@ draw_text(struct view *view, enum line_type type, const char *string)
 	return draw_text_expanded(view, type, string, VIEW_MAX_LEN(view), TRUE);
 }
 
-static bool
-draw_text_overflow(struct view *view, const char *text, bool on, int overflow, enum line_type type)
-{
-	if (on) {
-		int max = MIN(VIEW_MAX_LEN(view), overflow);
-		int len = strlen(text);
-
-		if (draw_text_expanded(view, type, text, max, max < overflow))
-			return TRUE;
+/*
+ * Render cache.
+ *
+ * Caches the tab-expanded and output encoded text of a line together with
+ * the byte offset and column of each character, so redrawing the same line
+ * does not have to expand, convert and measure it again. Each view keeps
+ * the entries of its drawn lines in the slot given by the line number, so
+ * the lines on screen never push each other out. The line structures are
+ * copied when filtering, so entries are checked against the address of the
+ * line text and a generation number, which is bumped whenever cached text
+ * may be freed or rendered differently.
+ */
 
-		text = len > overflow ? text + overflow : "";
-		type = LINE_OVERFLOW;
-	}
+#define RENDER_CACHE_SIZE	256
+
+struct render_entry {
+	const char *string;	/* Address of the line text. */
+	unsigned long generation;
+	bool cacheable;		/* Whether the line fits in one chunk. */
+	size_t chars;		/* Number of characters in text. */
+	size_t *offset;		/* Byte offset of each character. */
+	int *width;		/* Columns used before each character. */
+	size_t *column;		/* First character starting at each column. */
+	char *text;		/* Expanded and encoded text. */
+};
 
-	if (*text && draw_text(view, type, text))
-		return TRUE;
+static unsigned long render_cache_generation = 1;
 
-	return VIEW_MAX_LEN(view) <= 0;
+static void
+invalidate_render_cache(void)
+{
+	render_cache_generation++;
 }
 
-#define draw_commit_title(view, text, offset) \
-	draw_text_overflow(view, text, opt_show_title_overflow, opt_title_overflow + offset, LINE_DEFAULT)
+/* Measure each character the same way as utf8_length(). */
+static bool
+render_entry_measure(struct render_entry *entry, const char *text)
+{
+	size_t textlen = strlen(text);
+	const char *string = text;
+	const char *end = text + textlen;
+	size_t chars = 0;
+	size_t *offset, *column;
+	int *width;
+	int col;
+
+	free(entry->text);
+	entry->text = strdup(text);
+	offset = realloc(entry->offset, (textlen + 1) * sizeof(*offset));
+	if (offset)
+		entry->offset = offset;
+	width = realloc(entry->width, (textlen + 1) * sizeof(*width));
+	if (width)
+		entry->width = width;
+	if (!entry->text || !offset || !width)
+		return FALSE;
 
-static bool PRINTF_LIKE(3, 4)
-draw_formatted(struct view *view, enum line_type type, const char *format, ...)
-{
-	char text[SIZEOF_STR];
-	int retval;
+	width[0] = 0;
+	offset[0] = 0;
 
-	FORMAT_BUFFER(text, sizeof(text), format, retval, TRUE);
-	return retval >= 0 ? draw_text(view, type, text) : VIEW_MAX_LEN(view) <= 0;
-}
+	while (string < end) {
+		unsigned char bytes = utf8_char_length(string, end);
+		unsigned long unicode;
+
+		if (string + bytes > end)
+			break;
+
+		unicode = utf8_to_unicode(string, bytes);
+		if (!unicode)
+			break;
+
+		width[chars + 1] = width[chars] + unicode_width(unicode, opt_tab_size);
+		string += bytes;
+		offset[++chars] = string - text;
+	}
+
+	entry->chars = chars;
+
+	/* Map each column to the first character starting at or after it
+	 * to find the visible characters without searching. */
+	column = realloc(entry->column, (width[chars] + 1) * sizeof(*column));
+	if (!column)
+		return FALSE;
+	entry->column = column;
+
+	for (col = 0, chars = 0; col <= width[entry->chars]; col++) {
+		while (width[chars] < col)
+			chars++;
+		column[col] = chars;
+	}
+
+	return TRUE;
+}
+
+static struct render_entry *
+get_render_entry(struct view *view, const char *string)
+{
+	struct render_entry *entry;
+	char text[SIZEOF_STR];
+	const char *encoded = text;
+	size_t pos;
+
+	if (!view->render) {
+		view->render = calloc(RENDER_CACHE_SIZE, sizeof(*view->render));
+		if (!view->render)
+			return NULL;
+	}
+
+	entry = &view->render[(view->curline - view->line) % RENDER_CACHE_SIZE];
+	if (entry->string == string && entry->generation == render_cache_generation)
+		return entry->cacheable ? entry : NULL;
+
+	entry->string = string;
+	entry->generation = render_cache_generation;
+	entry->cacheable = FALSE;
+
+	pos = string_expand(text, sizeof(text), string, opt_tab_size);
+	if (string[pos])
+		return NULL;
+
+	if (opt_iconv_out != ICONV_NONE) {
+		encoded = encoding_iconv(opt_iconv_out, text);
+		if (!encoded)
+			return NULL;
+	}
+
+	entry->cacheable = render_entry_measure(entry, encoded);
+	return entry->cacheable ? entry : NULL;
+}
+
+/* Find the first character whose column is not below the given one. */
+static size_t
+render_entry_find(struct render_entry *entry, size_t col)
+{
+	if (col > entry->width[entry->chars])
+		return entry->chars + 1;
+	return entry->column[col];
+}
+
+/* Same as draw_chars() but using the measurements of the render entry to
+ * get the same result as utf8_length() in constant time. */
+static bool
+draw_render_entry(struct view *view, enum line_type type, struct render_entry *entry,
+		  int max_len, bool use_tilde)
+{
+	size_t skip = view->pos.col > view->col ? view->pos.col - view->col : 0;
+	size_t limit, skipped, start, end;
+	int trimmed = FALSE;
+	int col;
+
+	if (max_len <= 0)
+		return VIEW_MAX_LEN(view) <= 0;
+
+	/* The last character to be looked at is the first one overflowing
+	 * the maximum width. Characters being skipped still add to the
+	 * width. */
+	limit = render_entry_find(entry, (size_t) max_len + 1);
+	if (limit > 0 && limit <= entry->chars) {
+		limit--;
+		trimmed = TRUE;
+	} else {
+		limit = entry->chars;
+	}
+
+	skipped = skip ? render_entry_find(entry, skip) : 0;
+	if (skipped > limit + trimmed)
+		skipped = limit + trimmed;
+	if (skipped > entry->chars)
+		skipped = entry->chars;
+
+	start = entry->offset[skipped];
+	end = entry->offset[limit];
+	col = entry->width[limit];
+
+	if (trimmed && use_tilde && col == max_len && limit > 0) {
+		size_t last_width = entry->width[limit] - entry->width[limit - 1];
+
+		if (last_width)
+			end = entry->offset[limit - 1];
+		col -= last_width;
+	}
+
+	return draw_chars_length(view, type, entry->text + start,
+				 (size_t) (end - start), col, trimmed, use_tilde);
+}
+
+/* Draw the text of a line, which must stay unchanged until the cache is
+ * invalidated. */
+static bool
+draw_text_cached(struct view *view, enum line_type type, const char *string)
+{
+	struct render_entry *entry = get_render_entry(view, string);
+
+	if (!entry)
+		return draw_text(view, type, string);
+	if (draw_render_entry(view, type, entry, VIEW_MAX_LEN(view), TRUE))
+		return TRUE;
+	return VIEW_MAX_LEN(view) <= 0;
+}
+
+/* Copy the part of a wrapped line shown in the row being drawn. Returns
+ * NULL when the whole line fits in one row. */
+static char *
+get_wrapped_row_text(struct view *view, struct line *line, char buf[SIZEOF_STR])
+{
+	const char *text;
+	size_t length;
+
+	if (!view_is_wrapped(view) || !line->data ||
+	    get_view_line_rows(view, line - view->line) <= 1)
+		return NULL;
+
+	text = get_wrapped_text(line->data, get_wrap_width(view), view->currow, &length);
+	length = MIN(length, SIZEOF_STR - 1);
+	memcpy(buf, text, length);
+	buf[length] = 0;
+	return buf;
+}
+
+static bool
+draw_text_overflow(struct view *view, const char *text, bool on, int overflow, enum line_type type)
+{
+	if (on) {
+		int max = MIN(VIEW_MAX_LEN(view), overflow);
+		int len = strlen(text);
+
+		if (draw_text_expanded(view, type, text, max, max < overflow))
+			return TRUE;
+
+		text = len > overflow ? text + overflow : "";
+		type = LINE_OVERFLOW;
+	}
+
+	if (*text && draw_text(view, type, text))
+		return TRUE;
+
+	return VIEW_MAX_LEN(view) <= 0;
+}
+
+#define draw_commit_title(view, text, offset) \
+	draw_text_overflow(view, text, opt_show_title_overflow, opt_title_overflow + offset, LINE_DEFAULT)
+
+static bool PRINTF_LIKE(3, 4)
+draw_formatted(struct view *view, enum line_type type, const char *format, ...)
+{
+	char text[SIZEOF_STR];
+	int retval;
+
+	FORMAT_BUFFER(text, sizeof(text), format, retval, TRUE);
+	return retval >= 0 ? draw_text(view, type, text) : VIEW_MAX_LEN(view) <= 0;
+}
 
 static bool
 draw_graphic(struct view *view, enum line_type type, const chtype graphic[], size_t size, bool separator)
@@ -2378,8 +2614,9 @@ draw_mode(struct view *view, mode_t mode)
 }
 
 static bool
-draw_lineno(struct view *view, unsigned int lineno)
+draw_lineno(struct view *view)
 {
+	unsigned long lineno = view->curline - view->line + 1;
 	char number[10];
 	int digits3 = view->digits < 3 ? 3 : view->digits;
 	int max = MIN(VIEW_MAX_LEN(view), digits3);
@@ -2389,8 +2626,7 @@ draw_lineno(struct view *view, unsigned int lineno)
 	if (!opt_line_number)
 		return FALSE;
 
-	lineno += view->pos.offset + 1;
-	if (lineno == 1 || (lineno % opt_num_interval) == 0) {
+	if (!view->currow && (lineno == 1 || (lineno % opt_num_interval) == 0)) {
 		static char fmt[] = "%1ld";
 
 		fmt[1] = '0' + (view->digits <= 9 ? digits3 : 1);
@@ -2430,20 +2666,23 @@ static bool
 draw_view_line(struct view *view, unsigned int lineno)
 {
 	struct line *line;
-	bool selected = (view->pos.offset + lineno == view->pos.lineno);
+	unsigned int row;
+	unsigned long offset = get_view_row_line(view, get_view_top_row(view) + lineno, &row);
+	bool selected = (offset == view->pos.lineno);
 
 	assert(view_is_displayed(view));
 
-	if (view->pos.offset + lineno >= view->lines)
+	if (offset >= view->lines)
 		return FALSE;
 
-	line = &view->line[view->pos.offset + lineno];
+	line = &view->line[offset];
 
 	wmove(view->win, lineno, 0);
 	if (line->cleareol)
 		wclrtoeol(view->win);
 	view->col = 0;
 	view->curline = line;
+	view->currow = row;
 	view->curtype = LINE_NONE;
 	line->selected = FALSE;
 	line->dirty = line->cleareol = 0;
@@ -2457,17 +2696,63 @@ draw_view_line(struct view *view, unsigned int lineno)
 	return view->ops->draw(view, line, lineno);
 }
 
+/* Draw the rows of a line which are inside the window. */
+static void
+draw_view_rows(struct view *view, unsigned long lineno)
+{
+	unsigned long top = get_view_top_row(view);
+	unsigned long row = get_view_row(view, lineno);
+	unsigned long end = get_view_row(view, lineno + 1);
+
+	for (row = MAX(row, top); row < end && row < top + view->height; row++)
+		draw_view_line(view, row - top);
+}
+
+/* Let the kernel drop the pages of the spill file which are not shown. */
+static void
+release_view_spill(struct view *view)
+{
+	const char *from = view->spill.map;
+	const char *to = view->spill.map;
+	bool found = FALSE;
+	int lineno;
+
+	for (lineno = 0; lineno < view->height; lineno++) {
+		const char *data;
+
+		if (view->pos.offset + lineno >= view->lines)
+			break;
+		data = view->line[view->pos.offset + lineno].data;
+		if (!spill_contains(&view->spill, data))
+			continue;
+		if (!found || data < from)
+			from = data;
+		if (!found || data >= to)
+			to = data + 1;
+		found = TRUE;
+	}
+
+	spill_release(&view->spill, from, to);
+}
+
 static void
 redraw_view_dirty(struct view *view)
 {
+	unsigned long top = get_view_top_row(view);
+	unsigned long drawn = view->lines;
 	bool dirty = FALSE;
 	int lineno;
 
 	for (lineno = 0; lineno < view->height; lineno++) {
-		if (view->pos.offset + lineno >= view->lines)
+		unsigned int row;
+		unsigned long offset = get_view_row_line(view, top + lineno, &row);
+
+		if (offset >= view->lines)
 			break;
-		if (!view->line[view->pos.offset + lineno].dirty)
+		/* Drawing the first row of a wrapped line marks it clean. */
+		if (!view->line[offset].dirty && offset != drawn)
 			continue;
+		drawn = offset;
 		dirty = TRUE;
 		if (!draw_view_line(view, lineno))
 			break;
@@ -2475,6 +2760,8 @@ redraw_view_dirty(struct view *view)
 
 	if (!dirty)
 		return;
+	if (view->spill.used)
+		release_view_spill(view);
 	wnoutrefresh(view->win);
 }
 
@@ -2488,6 +2775,8 @@ redraw_view_from(struct view *view, int lineno)
 			break;
 	}
 
+	if (view->spill.used)
+		release_view_spill(view);
 	wnoutrefresh(view->win);
 }
 
@@ -2498,6 +2787,62 @@ redraw_view(struct view *view)
 	redraw_view_from(view, 0);
 }
 
+/*
+ * Load statistics.
+ */
+
+static unsigned long long
+view_stats_clock(void)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (unsigned long long) now.tv_sec * 1000000 + now.tv_usec;
+}
+
+static const char *
+format_stats_size(char buf[], unsigned long long bytes)
+{
+	if (bytes >= 1024 * 1024)
+		string_format_size(buf, 16, "%.1fM", bytes / (1024.0 * 1024));
+	else if (bytes >= 1024)
+		string_format_size(buf, 16, "%.1fK", bytes / 1024.0);
+	else
+		string_format_size(buf, 16, "%llu", bytes);
+	return buf;
+}
+
+static bool
+format_view_stats(struct view *view, char *buf, size_t bufsize, size_t *bufpos)
+{
+	struct view_stats *stats = &view->stats;
+	unsigned long long elapsed = stats->eof || !view->pipe
+				   ? stats->eof : view_stats_clock() - stats->start;
+	char bytes[16], alloc[16], spilled[16];
+
+	if (!string_nformat(buf, bufsize, bufpos,
+			    "%sB, %lu lines, first %.3fs, %s %.3fs, io %.3fs, read %.3fs, %sB data",
+			    format_stats_size(bytes, stats->bytes), stats->lines,
+			    stats->first_line / 1000000.0,
+			    view->pipe ? "now" : "eof", elapsed / 1000000.0,
+			    stats->get_usecs / 1000000.0, stats->read_usecs / 1000000.0,
+			    format_stats_size(alloc, stats->alloc)))
+		return FALSE;
+
+	return !stats->spilled ||
+	       string_nformat(buf, bufsize, bufpos, " (%sB spilled)",
+			      format_stats_size(spilled, stats->spilled));
+}
+
+static void
+trace_view_stats(struct view *view)
+{
+	char buf[SIZEOF_STR];
+	size_t bufpos = 0;
+
+	if (format_view_stats(view, buf, sizeof(buf), &bufpos))
+		io_trace("# %s view: %s\n", view->name, buf);
+}
 
 static void
 update_view_title(struct view *view)
@@ -2512,19 +2857,24 @@ update_view_title(struct view *view)
 
 	if (!view_has_flags(view, VIEW_CUSTOM_STATUS) && view_has_line(view, line) &&
 	    line->lineno) {
-		unsigned int view_lines = view->pos.offset + view->height;
-		unsigned int lines = view->lines
-				   ? MIN(view_lines, view->lines) * 100 / view->lines
-				   : 0;
+		unsigned int line_row;
+		unsigned long last = get_view_row_line(view, get_view_top_row(view) + view->height - 1, &line_row);
+		unsigned int lines = view->lines ? MIN(last + 1, view->lines) * 100 / view->lines : 0;
+
+		size_t total = view->filter ? view->filter->lines : view->lines;
 
 		string_format_from(state, &statelen, " - %s %d of %zd (%d%%)",
 				   view->ops->type,
 				   line->lineno,
-				   view->lines - view->custom_lines,
+				   total - view->custom_lines,
 				   lines);
 
 	}
 
+	if (view->filter)
+		string_format_from(state, &statelen, " - %zd matching '%s'",
+				   view->lines, view->filter->grep);
+
 	if (view->pipe) {
 		time_t secs = time(NULL) - view->start_time;
 
@@ -2533,6 +2883,14 @@ update_view_title(struct view *view)
 			string_format_from(state, &statelen, " loading %lds", secs);
 	}
 
+	if (opt_load_stats && view->stats.start) {
+		char stats[SIZEOF_STR];
+		size_t statspos = 0;
+
+		if (format_view_stats(view, stats, sizeof(stats), &statspos))
+			string_format_from(state, &statelen, " - %s", stats);
+	}
+
 	string_format_from(buf, &bufpos, "[%s]", view->name);
 	if (*view->ref && bufpos < view->width) {
 		size_t refsize = strlen(view->ref);
@@ -2557,6 +2915,53 @@ update_view_title(struct view *view)
 	wnoutrefresh(window);
 }
 
+/*
+ * Redraw scheduling.
+ *
+ * Lines read while loading are drawn at most opt_redraw_rate times per
+ * second, except right after a key press or when loading finishes.
+ */
+
+static bool redraw_forced = TRUE;
+
+static bool
+redraw_is_due(void)
+{
+	static struct timeval last_redraw;
+	struct timeval now;
+	long elapsed;
+
+	if (redraw_forced || opt_redraw_rate <= 0)
+		return TRUE;
+
+	gettimeofday(&now, NULL);
+	elapsed = (now.tv_sec - last_redraw.tv_sec) * 1000 +
+		  (now.tv_usec - last_redraw.tv_usec) / 1000;
+	if (elapsed >= 0 && elapsed * opt_redraw_rate < 1000)
+		return FALSE;
+
+	last_redraw = now;
+	return TRUE;
+}
+
+static void
+redraw_pending_view(struct view *view)
+{
+	if (!view->redraw_pending)
+		return;
+
+	if (view->force_redraw)
+		redraw_view_from(view, 0);
+	else
+		redraw_view_dirty(view);
+	view->force_redraw = FALSE;
+	view->redraw_pending = FALSE;
+
+	/* Update the title _after_ the redraw so that if the redraw picks up a
+	 * commit reference in view->ref it'll be available here. */
+	update_view_title(view);
+}
+
 static int
 apply_step(double step, int value)
 {
@@ -2608,6 +3013,7 @@ resize_display(void)
 
 	/* Setup window dimensions */
 
+	invalidate_render_cache();
 	getmaxyx(stdscr, base->height, base->width);
 	string_format(opt_env_columns, "COLUMNS=%d", base->width);
 	string_format(opt_env_lines, "LINES=%d", base->height);
@@ -2780,45 +3186,51 @@ toggle_option(struct view *view, enum request request, char msg[SIZEOF_STR])
 static bool
 goto_view_line(struct view *view, unsigned long offset, unsigned long lineno)
 {
+	struct position old = view->pos;
+	unsigned long top = offset == view->pos.offset
+			  ? get_view_top_row(view) : get_view_row(view, offset);
+	unsigned long row;
+
 	if (lineno >= view->lines)
 		lineno = view->lines > 0 ? view->lines - 1 : 0;
 
-	if (offset > lineno || offset + view->height <= lineno) {
+	row = get_view_row(view, lineno);
+	if (top > row || top + view->height <= row) {
 		unsigned long half = view->height / 2;
 
-		if (lineno > half)
-			offset = lineno - half;
+		if (row > half)
+			top = row - half;
 		else
-			offset = 0;
+			top = 0;
 	}
 
-	if (offset != view->pos.offset || lineno != view->pos.lineno) {
-		view->pos.offset = offset;
-		view->pos.lineno = lineno;
-		return TRUE;
-	}
+	set_view_top_row(view, top);
+	view->pos.lineno = lineno;
 
-	return FALSE;
+	return old.offset != view->pos.offset || old.row != view->pos.row ||
+	       old.lineno != view->pos.lineno;
 }
 
-/* Scrolling backend */
+/* Scrolling backend, @lines is the number of rows to scroll. */
 static void
 do_scroll_view(struct view *view, int lines)
 {
 	bool redraw_current_line = FALSE;
+	unsigned long top = get_view_top_row(view) + lines;
+	unsigned int row;
 
 	/* The rendering expects the new offset. */
-	view->pos.offset += lines;
+	set_view_top_row(view, top);
 
 	assert(0 <= view->pos.offset && view->pos.offset < view->lines);
 	assert(lines);
 
 	/* Move current line into the view. */
-	if (view->pos.lineno < view->pos.offset) {
+	if (get_view_row(view, view->pos.lineno + 1) <= top) {
 		view->pos.lineno = view->pos.offset;
 		redraw_current_line = TRUE;
-	} else if (view->pos.lineno >= view->pos.offset + view->height) {
-		view->pos.lineno = view->pos.offset + view->height - 1;
+	} else if (get_view_row(view, view->pos.lineno) >= top + view->height) {
+		view->pos.lineno = get_view_row_line(view, top + view->height - 1, &row);
 		redraw_current_line = TRUE;
 	}
 
@@ -2840,7 +3252,7 @@ do_scroll_view(struct view *view, int lines)
 			line++;
 
 		if (redraw_current_line)
-			draw_view_line(view, view->pos.lineno - view->pos.offset);
+			draw_view_rows(view, view->pos.lineno);
 		wnoutrefresh(view->win);
 	}
 
@@ -2852,6 +3264,8 @@ do_scroll_view(struct view *view, int lines)
 static void
 scroll_view(struct view *view, enum request request)
 {
+	unsigned long top = get_view_top_row(view);
+	unsigned long rows;
 	int lines = 1;
 
 	assert(view_is_displayed(view));
@@ -2882,10 +3296,11 @@ scroll_view(struct view *view, enum request request)
 	case REQ_SCROLL_PAGE_DOWN:
 		lines = view->height;
 	case REQ_SCROLL_LINE_DOWN:
-		if (view->pos.offset + lines > view->lines)
-			lines = view->lines - view->pos.offset;
+		rows = get_view_rows_within(view, top + lines + view->height);
+		if (top + lines > rows)
+			lines = rows - top;
 
-		if (lines == 0 || view->pos.offset + view->height >= view->lines) {
+		if (lines == 0 || top + view->height >= rows) {
 			report("Cannot scroll beyond the last line");
 			return;
 		}
@@ -2894,8 +3309,8 @@ scroll_view(struct view *view, enum request request)
 	case REQ_SCROLL_PAGE_UP:
 		lines = view->height;
 	case REQ_SCROLL_LINE_UP:
-		if (lines > view->pos.offset)
-			lines = view->pos.offset;
+		if (lines > top)
+			lines = top;
 
 		if (lines == 0) {
 			report("Cannot scroll beyond the first line");
@@ -2916,6 +3331,9 @@ scroll_view(struct view *view, enum request request)
 static void
 move_view(struct view *view, enum request request)
 {
+	unsigned long top = get_view_top_row(view);
+	unsigned long row = get_view_row(view, view->pos.lineno);
+	unsigned int line_row;
 	int scroll_steps = 0;
 	int steps;
 
@@ -2929,13 +3347,18 @@ move_view(struct view *view, enum request request)
 		break;
 
 	case REQ_MOVE_PAGE_UP:
-		steps = view->height > view->pos.lineno
-		      ? -view->pos.lineno : -view->height;
+		steps = view->height > row ? -view->pos.lineno
+		      : get_view_row_line(view, row - view->height, &line_row) - view->pos.lineno;
+		if (!steps && view->pos.lineno)
+			steps = -1;
 		break;
 
 	case REQ_MOVE_PAGE_DOWN:
-		steps = view->pos.lineno + view->height >= view->lines
-		      ? view->lines - view->pos.lineno - 1 : view->height;
+		steps = row + view->height >= get_view_rows_within(view, row + view->height + 1)
+		      ? view->lines - view->pos.lineno - 1
+		      : get_view_row_line(view, row + view->height, &line_row) - view->pos.lineno;
+		if (!steps && view->pos.lineno + 1 < view->lines)
+			steps = 1;
 		break;
 
 	case REQ_MOVE_UP:
@@ -2965,25 +3388,31 @@ move_view(struct view *view, enum request request)
 	view->pos.lineno += steps;
 	assert(0 <= view->pos.lineno && view->pos.lineno < view->lines);
 
-	/* Check whether the view needs to be scrolled */
-	if (view->pos.lineno < view->pos.offset ||
-	    view->pos.lineno >= view->pos.offset + view->height) {
-		scroll_steps = steps;
-		if (steps < 0 && -steps > view->pos.offset) {
-			scroll_steps = -view->pos.offset;
-
-		} else if (steps > 0) {
-			if (view->pos.lineno == view->lines - 1 &&
-			    view->lines > view->height) {
-				scroll_steps = view->lines - view->pos.offset - 1;
-				if (scroll_steps >= view->height)
-					scroll_steps -= view->height - 1;
-			}
-		}
+	/* Check whether the view needs to be scrolled so that the rows of
+	 * the current line are shown. The view is scrolled as many rows as
+	 * the current line moved. */
+	row = get_view_row(view, view->pos.lineno);
+	if (row < top || get_view_row(view, view->pos.lineno + 1) > top + view->height) {
+		unsigned long end = get_view_row(view, view->pos.lineno + 1);
+		long moved = (long) row - (long) get_view_row(view, view->pos.lineno - steps);
+		unsigned long new_top = moved < 0 && -moved > top ? 0 : top + moved;
+
+		/* The last line ends where the rows of the view end. */
+		if (steps > 0 && view->pos.lineno == view->lines - 1 &&
+		    end > view->height)
+			new_top = end - view->height;
+
+		/* Show all of the current line if it fits. */
+		if (new_top > row || end - row > view->height)
+			new_top = row;
+		else if (end > new_top + view->height)
+			new_top = end - view->height;
+
+		scroll_steps = new_top - top;
 	}
 
 	if (!view_is_displayed(view)) {
-		view->pos.offset += scroll_steps;
+		set_view_top_row(view, top + scroll_steps);
 		assert(0 <= view->pos.offset && view->pos.offset < view->lines);
 		view->ops->select(view, &view->line[view->pos.lineno]);
 		return;
@@ -2991,7 +3420,7 @@ move_view(struct view *view, enum request request)
 
 	/* Repaint the old "current" line if we be scrolling */
 	if (ABS(steps) < view->height)
-		draw_view_line(view, view->pos.lineno - steps - view->pos.offset);
+		draw_view_rows(view, view->pos.lineno - steps);
 
 	if (scroll_steps) {
 		do_scroll_view(view, scroll_steps);
@@ -2999,7 +3428,7 @@ move_view(struct view *view, enum request request)
 	}
 
 	/* Draw the current line */
-	draw_view_line(view, view->pos.lineno - view->pos.offset);
+	draw_view_rows(view, view->pos.lineno);
 
 	wnoutrefresh(view->win);
 	report_clear();
@@ -3031,11 +3460,11 @@ select_view_line(struct view *view, unsigned long lineno)
 
 	if (goto_view_line(view, view->pos.offset, lineno)) {
 		if (view_is_displayed(view)) {
-			if (old.offset != view->pos.offset) {
+			if (old.offset != view->pos.offset || old.row != view->pos.row) {
 				redraw_view(view);
 			} else {
-				draw_view_line(view, old.lineno - view->pos.offset);
-				draw_view_line(view, view->pos.lineno - view->pos.offset);
+				draw_view_rows(view, old.lineno);
+				draw_view_rows(view, view->pos.lineno);
 				wnoutrefresh(view->win);
 			}
 		} else {
@@ -3125,7 +3554,7 @@ search_view(struct view *view, enum request request)
 static inline bool
 check_position(struct position *pos)
 {
-	return pos->lineno || pos->col || pos->offset;
+	return pos->lineno || pos->col || pos->offset || pos->row;
 }
 
 static inline void
@@ -3134,85 +3563,310 @@ clear_position(struct position *pos)
 	memset(pos, 0, sizeof(*pos));
 }
 
-static void
-reset_view(struct view *view)
-{
-	int i;
+/*
+ * Filtering
+ */
 
-	if (view->ops->done)
-		view->ops->done(view);
+DEFINE_ALLOCATOR(realloc_filter_lines, struct line, 256)
+DEFINE_ALLOCATOR(realloc_filter_index, unsigned long, 256)
 
-	for (i = 0; i < view->lines; i++)
-		free(view->line[i].data);
-	free(view->line);
+static bool
+filter_line(struct view *view, struct line *line)
+{
+	regex_t *regex = view->regex;
+	bool match;
 
-	view->prev_pos = view->pos;
-	clear_position(&view->pos);
+	view->regex = &view->filter->regex;
+	match = view->ops->grep(view, line);
+	view->regex = regex;
 
-	view->line = NULL;
-	view->lines  = 0;
-	view->vid[0] = 0;
-	view->custom_lines = 0;
-	view->update_secs = 0;
+	return match;
 }
 
-struct format_context {
-	struct view *view;
-	char buf[SIZEOF_STR];
-	size_t bufpos;
-	bool file_filter;
-};
-
+/* Check the unfiltered lines that were added since the last time. While
+ * loading, the last line is left for later since views like the main view
+ * only fill in the line data once the next line has been read. */
 static bool
-format_expand_arg(struct format_context *format, const char *name)
+filter_new_lines(struct view *view, bool complete)
 {
-	static struct {
-		const char *name;
-		size_t namelen;
-		const char *value;
-		const char *value_if_empty;
-	} vars[] = {
-#define FORMAT_VAR(name, value, value_if_empty) \
-	{ name, STRING_SIZE(name), value, value_if_empty }
-		FORMAT_VAR("%(directory)",	opt_path,	"."),
-		FORMAT_VAR("%(file)",		opt_file,	""),
-		FORMAT_VAR("%(ref)",		opt_ref,	"HEAD"),
-		FORMAT_VAR("%(head)",		ref_head,	""),
-		FORMAT_VAR("%(commit)",		ref_commit,	""),
-		FORMAT_VAR("%(blob)",		ref_blob,	""),
-		FORMAT_VAR("%(branch)",		ref_branch,	""),
-		FORMAT_VAR("%(stash)",		ref_stash,	""),
-	};
-	int i;
-
-	if (!prefixcmp(name, "%(prompt)")) {
-		const char *value = read_prompt("Command argument: ");
+	struct view_filter *filter = view->filter;
+	size_t lines = filter->lines;
 
-		return string_format_from(format->buf, &format->bufpos, "%s", value);
-	}
+	if (!complete && lines > 0)
+		lines--;
 
-	for (i = 0; i < ARRAY_SIZE(vars); i++) {
-		const char *value;
+	for (; filter->checked < lines; filter->checked++) {
+		struct line *line = &filter->line[filter->checked];
 
-		if (strncmp(name, vars[i].name, vars[i].namelen))
+		if (!filter_line(view, line))
 			continue;
 
-		if (vars[i].value == opt_file && !format->file_filter)
-			return TRUE;
-
-		value = *vars[i].value ? vars[i].value : vars[i].value_if_empty;
-		if (!*value)
-			return TRUE;
+		if (!realloc_filter_lines(&view->line, view->lines, 1) ||
+		    !realloc_filter_index(&filter->index, view->lines, 1))
+			return FALSE;
 
-		return string_format_from(format->buf, &format->bufpos, "%s", value);
+		filter->index[view->lines] = filter->checked;
+		view->line[view->lines] = *line;
+		view->line[view->lines++].dirty = 1;
 	}
 
-	report("Unknown replacement: `%s`", name);
-	return NULL;
+	return TRUE;
 }
 
-static bool
-format_append_arg(struct format_context *format, const char ***dst_argv, const char *arg)
+/* Filter all lines again when a view backend has reordered the lines
+ * while loading. Called with the unfiltered lines swapped in. */
+static void
+refilter_view(struct view *view)
+{
+	struct view_filter *filter = view->filter;
+
+	if (filter) {
+		filter->lines = 0;
+		filter->checked = 0;
+	}
+}
+
+/* Swap the view between the filtered and the unfiltered line index so
+ * that the view backends always operate on all lines. */
+static void
+swap_filter_lines(struct view *view)
+{
+	struct view_filter *filter = view->filter;
+	struct line *line = view->line;
+	size_t lines = view->lines;
+
+	view->line = filter->line;
+	view->lines = filter->lines;
+	filter->line = line;
+	filter->lines = lines;
+}
+
+static void
+clear_view_filter(struct view *view)
+{
+	struct view_filter *filter = view->filter;
+	unsigned long lineno = 0;
+
+	if (!filter)
+		return;
+
+	if (view->lines)
+		lineno = filter->index[view->pos.lineno];
+
+	free(view->line);
+	view->line = filter->line;
+	view->lines = filter->lines;
+	reset_view_wrap(view);
+	regfree(&filter->regex);
+	free(filter->index);
+	free(filter);
+	view->filter = NULL;
+
+	clear_position(&view->pos);
+	goto_view_line(view, 0, lineno);
+}
+
+static bool
+filter_view(struct view *view, const char *pattern)
+{
+	struct view_filter *filter = view->filter;
+	int regex_flags = opt_ignore_case ? REG_ICASE : 0;
+	unsigned long lineno = view->pos.lineno;
+	bool narrow = FALSE;
+	regex_t regex;
+	size_t i;
+
+	if (!*pattern) {
+		clear_view_filter(view);
+		if (view_is_displayed(view)) {
+			redraw_view(view);
+			update_view_title(view);
+		}
+		return TRUE;
+	}
+
+	if (!view->ops->grep) {
+		report("Filtering is not supported by the %s view", view->name);
+		return FALSE;
+	}
+
+	if (regcomp(&regex, pattern, REG_EXTENDED | regex_flags))
+		return FALSE;
+
+	if (!filter) {
+		filter = calloc(1, sizeof(*filter));
+		if (!filter) {
+			regfree(&regex);
+			return FALSE;
+		}
+		filter->line = view->line;
+		filter->lines = view->lines;
+		view->filter = filter;
+
+	} else {
+		/* Adding characters to a plain string can only narrow the
+		 * filter, so only lines that already match need checking. */
+		narrow = !prefixcmp(pattern, filter->grep) &&
+			 !strpbrk(pattern, "^$.[]|()*+?{}\\");
+		if (view->lines)
+			lineno = filter->index[lineno];
+		regfree(&filter->regex);
+	}
+
+	filter->regex = regex;
+	string_ncopy(filter->grep, pattern, strlen(pattern));
+
+	if (narrow) {
+		size_t lines = 0;
+
+		for (i = 0; i < view->lines; i++) {
+			if (!filter_line(view, &view->line[i]))
+				continue;
+			filter->index[lines] = filter->index[i];
+			view->line[lines++] = view->line[i];
+		}
+		view->lines = lines;
+		reset_view_wrap(view);
+
+	} else {
+		if (filter->line != view->line)
+			free(view->line);
+		free(filter->index);
+		filter->index = NULL;
+		view->line = NULL;
+		view->lines = 0;
+		reset_view_wrap(view);
+		filter->checked = 0;
+		if (!filter_new_lines(view, !view->pipe))
+			return FALSE;
+	}
+
+	/* Keep the selection on or near the previously selected line. */
+	for (i = 0; i < view->lines && filter->index[i] < lineno; i++)
+		;
+	clear_position(&view->pos);
+	goto_view_line(view, 0, i);
+
+	if (view_is_displayed(view)) {
+		redraw_view(view);
+		update_view_title(view);
+	}
+
+	return TRUE;
+}
+
+static enum input_status
+filter_prompt_handler(void *data, char *buf, int c)
+{
+	char pattern[SIZEOF_STR];
+
+	if (c == KEY_BACKSPACE) {
+		string_copy(pattern, buf);
+	} else if (c < 256 && isprint(c)) {
+		if (!string_format(pattern, "%s%c", buf, c))
+			return INPUT_SKIP;
+	} else {
+		return INPUT_SKIP;
+	}
+
+	filter_view(data, pattern);
+	return INPUT_OK;
+}
+
+static void
+free_line_data(struct view *view, void *data)
+{
+	if (!spill_contains(&view->spill, data))
+		free(data);
+}
+
+static void
+reset_view(struct view *view)
+{
+	int i;
+
+	clear_view_filter(view);
+	invalidate_render_cache();
+
+	if (view->ops->done)
+		view->ops->done(view);
+	if (view->private)
+		memset(view->private, 0, view->ops->private_size);
+
+	for (i = 0; i < view->lines; i++)
+		free_line_data(view, view->line[i].data);
+	free(view->line);
+	spill_close(&view->spill);
+	free(view->wrap.rows);
+	memset(&view->wrap, 0, sizeof(view->wrap));
+
+	view->prev_pos = view->pos;
+	clear_position(&view->pos);
+
+	view->line = NULL;
+	view->lines  = 0;
+	view->vid[0] = 0;
+	view->custom_lines = 0;
+	view->update_secs = 0;
+}
+
+struct format_context {
+	struct view *view;
+	char buf[SIZEOF_STR];
+	size_t bufpos;
+	bool file_filter;
+};
+
+static bool
+format_expand_arg(struct format_context *format, const char *name)
+{
+	static struct {
+		const char *name;
+		size_t namelen;
+		const char *value;
+		const char *value_if_empty;
+	} vars[] = {
+#define FORMAT_VAR(name, value, value_if_empty) \
+	{ name, STRING_SIZE(name), value, value_if_empty }
+		FORMAT_VAR("%(directory)",	opt_path,	"."),
+		FORMAT_VAR("%(file)",		opt_file,	""),
+		FORMAT_VAR("%(ref)",		opt_ref,	"HEAD"),
+		FORMAT_VAR("%(head)",		ref_head,	""),
+		FORMAT_VAR("%(commit)",		ref_commit,	""),
+		FORMAT_VAR("%(blob)",		ref_blob,	""),
+		FORMAT_VAR("%(branch)",		ref_branch,	""),
+		FORMAT_VAR("%(stash)",		ref_stash,	""),
+	};
+	int i;
+
+	if (!prefixcmp(name, "%(prompt)")) {
+		const char *value = read_prompt("Command argument: ");
+
+		return string_format_from(format->buf, &format->bufpos, "%s", value);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(vars); i++) {
+		const char *value;
+
+		if (strncmp(name, vars[i].name, vars[i].namelen))
+			continue;
+
+		if (vars[i].value == opt_file && !format->file_filter)
+			return TRUE;
+
+		value = *vars[i].value ? vars[i].value : vars[i].value_if_empty;
+		if (!*value)
+			return TRUE;
+
+		return string_format_from(format->buf, &format->bufpos, "%s", value);
+	}
+
+	report("Unknown replacement: `%s`", name);
+	return NULL;
+}
+
+static bool
+format_append_arg(struct format_context *format, const char ***dst_argv, const char *arg)
 {
 	memset(format->buf, 0, sizeof(format->buf));
 	format->bufpos = 0;
@@ -3315,18 +3969,37 @@ restore_view_position(struct view *view)
 	return TRUE;
 }
 
+static bool
+read_view_line(struct view *view, char *data)
+{
+	bool ok;
+
+	if (!view->filter)
+		return view->ops->read(view, data);
+
+	swap_filter_lines(view);
+	ok = view->ops->read(view, data);
+	swap_filter_lines(view);
+
+	return ok && filter_new_lines(view, !data);
+}
+
 static void
 end_update(struct view *view, bool force)
 {
 	if (!view->pipe)
 		return;
-	while (!view->ops->read(view, NULL))
+	while (!read_view_line(view, NULL))
 		if (!force)
 			return;
 	if (force)
 		io_kill(view->pipe);
 	io_done(view->pipe);
 	view->pipe = NULL;
+	if (view->stats.start) {
+		view->stats.eof = view_stats_clock() - view->stats.start;
+		trace_view_stats(view);
+	}
 }
 
 static void
@@ -3337,6 +4010,8 @@ setup_update(struct view *view, const char *vid)
 	string_ncopy(view->vid, vid, strlen(vid));
 	view->pipe = &view->io;
 	view->start_time = time(NULL);
+	memset(&view->stats, 0, sizeof(view->stats));
+	view->stats.start = view_stats_clock();
 }
 
 static bool
@@ -3400,6 +4075,7 @@ update_view(struct view *view)
 	bool redraw = view->lines == 0;
 	bool can_read = TRUE;
 	struct encoding *encoding = view->encoding ? view->encoding : opt_encoding;
+	unsigned long long now;
 
 	if (!view->pipe)
 		return TRUE;
@@ -3418,17 +4094,30 @@ update_view(struct view *view)
 		return TRUE;
 	}
 
-	for (; (line = io_get(view->pipe, '\n', can_read)); can_read = FALSE) {
+	for (now = view_stats_clock();
+	     (line = io_get(view->pipe, '\n', can_read));
+	     can_read = FALSE) {
+		unsigned long long read_start = view_stats_clock();
+
+		view->stats.get_usecs += read_start - now;
+		view->stats.bytes += strlen(line) + 1;
+		if (!view->stats.lines++)
+			view->stats.first_line = read_start - view->stats.start;
+
 		if (encoding) {
 			line = encoding_convert(encoding, line);
 		}
 
-		if (!view->ops->read(view, line)) {
+		if (!read_view_line(view, line)) {
 			report("Allocation failure");
 			end_update(view, TRUE);
 			return FALSE;
 		}
+
+		now = view_stats_clock();
+		view->stats.read_usecs += now - read_start;
 	}
+	view->stats.get_usecs += view_stats_clock() - now;
 
 	{
 		int digits = count_digits(view->lines);
@@ -3455,20 +4144,47 @@ update_view(struct view *view)
 	if (!view_is_displayed(view))
 		return TRUE;
 
-	if (redraw || view->force_redraw)
-		redraw_view_from(view, 0);
-	else
-		redraw_view_dirty(view);
-	view->force_redraw = FALSE;
+	if (redraw)
+		view->force_redraw = TRUE;
+	view->redraw_pending = TRUE;
+
+	/* While loading, the drawing is left to get_input() which limits
+	 * the number of redraws per second. */
+	if (!view->pipe || opt_redraw_rate <= 0) {
+		redraw_pending_view(view);
+		redraw_forced = TRUE;
+	}
 
-	/* Update the title _after_ the redraw so that if the redraw picks up a
-	 * commit reference in view->ref it'll be available here. */
-	update_view_title(view);
 	return TRUE;
 }
 
 DEFINE_ALLOCATOR(realloc_lines, struct line, 256)
 
+/* Once a view has read more than spill-threshold megabytes of line data,
+ * new line data is stored in a temporary file so that only the line
+ * index and the pages being shown need to be kept in memory. */
+static void *
+alloc_line_data(struct view *view, size_t data_size)
+{
+	struct spill *spill = &view->spill;
+
+	if (opt_spill_threshold && view_has_flags(view, VIEW_SPILL_LINES) &&
+	    view->stats.alloc >= (unsigned long long) opt_spill_threshold * 1024 * 1024) {
+		void *data;
+
+		if (!spill->map && !spill->failed && !spill_open(spill, get_temp_dir()))
+			report("Failed to create spill file, keeping lines in memory");
+
+		data = spill_alloc(spill, data_size);
+		if (data) {
+			view->stats.spilled += data_size;
+			return data;
+		}
+	}
+
+	return calloc(1, data_size);
+}
+
 static struct line *
 add_line(struct view *view, const void *data, enum line_type type, size_t data_size, bool custom)
 {
@@ -3478,7 +4194,7 @@ add_line(struct view *view, const void *data, enum line_type type, size_t data_s
 		return NULL;
 
 	if (data_size) {
-		void *alloc_data = calloc(1, data_size);
+		void *alloc_data = alloc_line_data(view, data_size);
 
 		if (!alloc_data)
 			return NULL;
@@ -3486,6 +4202,7 @@ add_line(struct view *view, const void *data, enum line_type type, size_t data_s
 		if (data)
 			memcpy(alloc_data, data, data_size);
 		data = alloc_data;
+		view->stats.alloc += data_size;
 	}
 
 	line = &view->line[view->lines++];
@@ -3544,14 +4261,19 @@ add_line_format(struct view *view, enum line_type type, const char *fmt, ...)
 static void
 split_view(struct view *prev, struct view *view)
 {
+	unsigned long top, row, end;
+
 	display[1] = view;
 	current_view = opt_focus_child ? 1 : 0;
 	view->parent = prev;
 	resize_display();
 
-	if (prev->pos.lineno - prev->pos.offset >= prev->height) {
+	top = get_view_top_row(prev);
+	row = get_view_row(prev, prev->pos.lineno);
+	end = get_view_row(prev, prev->pos.lineno + 1);
+	if (end > top + prev->height && row > top) {
 		/* Take the title line into account. */
-		int lines = prev->pos.lineno - prev->pos.offset - prev->height + 1;
+		int lines = MIN(end - top - prev->height, row - top);
 
 		/* Scroll the view that was split if the current line is
 		 * outside the new limited view. */
@@ -3582,12 +4304,10 @@ load_view(struct view *view, struct view *prev, enum open_flags flags)
 {
 	if (view->pipe)
 		end_update(view, TRUE);
-	if (view->ops->private_size) {
-		if (!view->private)
-			view->private = calloc(1, view->ops->private_size);
-		else
-			memset(view->private, 0, view->ops->private_size);
-	}
+	/* The private state is cleared together with the lines it
+	 * describes when the view is reset. */
+	if (view->ops->private_size && !view->private)
+		view->private = calloc(1, view->ops->private_size);
 
 	/* When prev == view it means this is the first loaded view. */
 	if (prev && view != prev) {
@@ -3913,6 +4633,7 @@ view_driver(struct view *view, enum request request)
 			char action[SIZEOF_STR] = "";
 			enum view_flag flags = toggle_option(view, request, action);
 	
+			invalidate_render_cache();
 			foreach_displayed_view(view, i) {
 				if (view_has_flags(view, flags))
 					reload_view(view);
@@ -3945,6 +4666,15 @@ view_driver(struct view *view, enum request request)
 		find_next(view, request);
 		break;
 
+	case REQ_FILTER:
+		if (!prompt_input("&", filter_prompt_handler, view))
+			filter_view(view, "");
+		break;
+
+	case REQ_SEARCH_HISTORY:
+		report("Searching the history is not supported by the %s view", view->name);
+		break;
+
 	case REQ_STOP_LOADING:
 		foreach_view(view, i) {
 			if (view->pipe)
@@ -4016,6 +4746,8 @@ static void
 sort_view(struct view *view, enum request request, struct sort_state *state,
 	  int (*compare)(const void *, const void *))
 {
+	clear_view_filter(view);
+
 	switch (request) {
 	case REQ_TOGGLE_SORT_FIELD:
 		state->current = (state->current + 1) % state->size;
@@ -4059,109 +4791,6 @@ update_diff_context(enum request request)
 	return diff_context != opt_diff_context;
 }
 
-DEFINE_ALLOCATOR(realloc_authors, struct ident *, 256)
-
-/* Small author cache to reduce memory consumption. It uses binary
- * search to lookup or find place to position new entries. No entries
- * are ever freed. */
-static struct ident *
-get_author(const char *name, const char *email)
-{
-	static struct ident **authors;
-	static size_t authors_size;
-	int from = 0, to = authors_size - 1;
-	struct ident *ident;
-
-	while (from <= to) {
-		size_t pos = (to + from) / 2;
-		int cmp = strcmp(name, authors[pos]->name);
-
-		if (!cmp)
-			return authors[pos];
-
-		if (cmp < 0)
-			to = pos - 1;
-		else
-			from = pos + 1;
-	}
-
-	if (!realloc_authors(&authors, authors_size, 1))
-		return NULL;
-	ident = calloc(1, sizeof(*ident));
-	if (!ident)
-		return NULL;
-	ident->name = strdup(name);
-	ident->email = strdup(email);
-	if (!ident->name || !ident->email) {
-		free((void *) ident->name);
-		free(ident);
-		return NULL;
-	}
-
-	memmove(authors + from + 1, authors + from, (authors_size - from) * sizeof(*authors));
-	authors[from] = ident;
-	authors_size++;
-
-	return ident;
-}
-
-static void
-parse_timesec(struct time *time, const char *sec)
-{
-	time->sec = (time_t) atol(sec);
-}
-
-static void
-parse_timezone(struct time *time, const char *zone)
-{
-	long tz;
-
-	tz  = ('0' - zone[1]) * 60 * 60 * 10;
-	tz += ('0' - zone[2]) * 60 * 60;
-	tz += ('0' - zone[3]) * 60 * 10;
-	tz += ('0' - zone[4]) * 60;
-
-	if (zone[0] == '-')
-		tz = -tz;
-
-	time->tz = tz;
-	time->sec -= tz;
-}
-
-/* Parse author lines where the name may be empty:
- *	author  <email@address.tld> 1138474660 +0100
- */
-static void
-parse_author_line(char *ident, const struct ident **author, struct time *time)
-{
-	char *nameend = strchr(ident, '<');
-	char *emailend = strchr(ident, '>');
-	const char *name, *email = "";
-
-	if (nameend && emailend)
-		*nameend = *emailend = 0;
-	name = chomp_string(ident);
-	if (nameend)
-		email = chomp_string(nameend + 1);
-	if (!*name)
-		name = *email ? email : unknown_ident.name;
-	if (!*email)
-		email = *name ? name : unknown_ident.email;
-
-	*author = get_author(name, email);
-
-	/* Parse epoch and timezone */
-	if (time && emailend && emailend[1] == ' ') {
-		char *secs = emailend + 2;
-		char *zone = strchr(secs, ' ');
-
-		parse_timesec(time, secs);
-
-		if (zone && strlen(zone) == STRING_SIZE(" +0700"))
-			parse_timezone(time, zone + 1);
-	}
-}
-
 static struct line *
 find_line_by_type(struct view *view, struct line *line, enum line_type type, int direction)
 {
@@ -4182,128 +4811,41 @@ find_line_by_type(struct view *view, struct line *line, enum line_type type, int
  * Blame
  */
 
-struct blame_commit {
-	char id[SIZEOF_REV];		/* SHA1 ID. */
-	char title[128];		/* First line of the commit message. */
-	const struct ident *author;	/* Author of the commit. */
-	struct time time;		/* Date from the author ident. */
-	char filename[128];		/* Name of file. */
-	char parent_id[SIZEOF_REV];	/* Parent/previous SHA1 ID. */
-	char parent_filename[128];	/* Parent/previous name of file. */
-};
-
-struct blame_header {
-	char id[SIZEOF_REV];		/* SHA1 ID. */
-	size_t orig_lineno;
-	size_t lineno;
-	size_t group;
-};
+/*
+ * Pager backend
+ */
 
 static bool
-parse_number(const char **posref, size_t *number, size_t min, size_t max)
+pager_draw(struct view *view, struct line *line, unsigned int lineno)
 {
-	const char *pos = *posref;
+	char buf[SIZEOF_STR];
+	const char *text;
 
-	*posref = NULL;
-	pos = strchr(pos + 1, ' ');
-	if (!pos || !isdigit(pos[1]))
-		return FALSE;
-	*number = atoi(pos + 1);
-	if (*number < min || *number > max)
-		return FALSE;
+	if (draw_lineno(view))
+		return TRUE;
+
+	if (view->currow && draw_text(view, LINE_DELIMITER, "+"))
+		return TRUE;
 
-	*posref = pos;
+	text = get_wrapped_row_text(view, line, buf);
+	if (text)
+		draw_text(view, line->type, text);
+	else
+		draw_text_cached(view, line->type, line->data);
 	return TRUE;
 }
 
 static bool
-parse_blame_header(struct blame_header *header, const char *text, size_t max_lineno)
+add_describe_ref(char *buf, size_t *bufpos, const char *commit_id, const char *sep)
 {
-	const char *pos = text + SIZEOF_REV - 2;
-
-	if (strlen(text) <= SIZEOF_REV || pos[1] != ' ')
-		return FALSE;
+	const char *describe_argv[] = { "git", "describe", commit_id, NULL };
+	char ref[SIZEOF_STR];
 
-	string_ncopy(header->id, text, SIZEOF_REV);
+	if (!io_run_buf(describe_argv, ref, sizeof(ref)) || !*ref)
+		return TRUE;
 
-	if (!parse_number(&pos, &header->orig_lineno, 1, 9999999) ||
-	    !parse_number(&pos, &header->lineno, 1, max_lineno) ||
-	    !parse_number(&pos, &header->group, 1, max_lineno - header->lineno + 1))
-		return FALSE;
-
-	return TRUE;
-}
-
-static bool
-match_blame_header(const char *name, char **line)
-{
-	size_t namelen = strlen(name);
-	bool matched = !strncmp(name, *line, namelen);
-
-	if (matched)
-		*line += namelen;
-
-	return matched;
-}
-
-static bool
-parse_blame_info(struct blame_commit *commit, char *line)
-{
-	if (match_blame_header("author ", &line)) {
-		parse_author_line(line, &commit->author, NULL);
-
-	} else if (match_blame_header("author-time ", &line)) {
-		parse_timesec(&commit->time, line);
-
-	} else if (match_blame_header("author-tz ", &line)) {
-		parse_timezone(&commit->time, line);
-
-	} else if (match_blame_header("summary ", &line)) {
-		string_ncopy(commit->title, line, strlen(line));
-
-	} else if (match_blame_header("previous ", &line)) {
-		if (strlen(line) <= SIZEOF_REV)
-			return FALSE;
-		string_copy_rev(commit->parent_id, line);
-		line += SIZEOF_REV;
-		string_ncopy(commit->parent_filename, line, strlen(line));
-
-	} else if (match_blame_header("filename ", &line)) {
-		string_ncopy(commit->filename, line, strlen(line));
-		return TRUE;
-	}
-
-	return FALSE;
-}
-
-/*
- * Pager backend
- */
-
-static bool
-pager_draw(struct view *view, struct line *line, unsigned int lineno)
-{
-	if (draw_lineno(view, lineno))
-		return TRUE;
-
-	if (line->wrapped && draw_text(view, LINE_DELIMITER, "+"))
-		return TRUE;
-
-	draw_text(view, line->type, line->data);
-	return TRUE;
-}
-
-static bool
-add_describe_ref(char *buf, size_t *bufpos, const char *commit_id, const char *sep)
-{
-	const char *describe_argv[] = { "git", "describe", commit_id, NULL };
-	char ref[SIZEOF_STR];
-
-	if (!io_run_buf(describe_argv, ref, sizeof(ref)) || !*ref)
-		return TRUE;
-
-	/* This is the only fatal call, since it can "corrupt" the buffer. */
-	if (!string_nformat(buf, SIZEOF_STR, bufpos, "%s%s", sep, ref))
+	/* This is the only fatal call, since it can "corrupt" the buffer. */
+	if (!string_nformat(buf, SIZEOF_STR, bufpos, "%s%s", sep, ref))
 		return FALSE;
 
 	return TRUE;
@@ -4350,45 +4892,6 @@ try_add_describe_ref:
 	add_line_text(view, buf, LINE_PP_REFS);
 }
 
-static struct line *
-pager_wrap_line(struct view *view, const char *data, enum line_type type)
-{
-	size_t first_line = 0;
-	bool has_first_line = FALSE;
-	size_t datalen = strlen(data);
-	size_t lineno = 0;
-
-	while (datalen > 0 || !has_first_line) {
-		bool wrapped = !!first_line;
-		size_t linelen = string_expanded_length(data, datalen, opt_tab_size, view->width - !!wrapped);
-		struct line *line;
-		char *text;
-
-		line = add_line(view, NULL, type, linelen + 1, wrapped);
-		if (!line)
-			break;
-		if (!has_first_line) {
-			first_line = view->lines - 1;
-			has_first_line = TRUE;
-		}
-
-		if (!wrapped)
-			lineno = line->lineno;
-
-		line->wrapped = wrapped;
-		line->lineno = lineno;
-		text = line->data;
-		if (linelen)
-			strncpy(text, data, linelen);
-		text[linelen] = 0;
-
-		datalen -= linelen;
-		data += linelen;
-	}
-
-	return has_first_line ? &view->line[first_line] : NULL;
-}
-
 static bool
 pager_common_read(struct view *view, const char *data, enum line_type type)
 {
@@ -4397,12 +4900,7 @@ pager_common_read(struct view *view, const char *data, enum line_type type)
 	if (!data)
 		return TRUE;
 
-	if (opt_wrap_lines) {
-		line = pager_wrap_line(view, data, type);
-	} else {
-		line = add_line_text(view, data, type);
-	}
-
+	line = add_line_text(view, data, type);
 	if (!line)
 		return FALSE;
 
@@ -4516,7 +5014,7 @@ pager_open(struct view *view, enum open_flags flags)
 static struct view_ops pager_ops = {
 	"line",
 	{ "pager" },
-	VIEW_OPEN_DIFF | VIEW_NO_REF | VIEW_NO_GIT_DIR,
+	VIEW_OPEN_DIFF | VIEW_NO_REF | VIEW_NO_GIT_DIR | VIEW_SPILL_LINES | VIEW_WRAP_LINES,
 	0,
 	pager_open,
 	pager_read,
@@ -4558,7 +5056,7 @@ log_request(struct view *view, enum request request, struct line *line)
 static struct view_ops log_ops = {
 	"line",
 	{ "log" },
-	VIEW_ADD_PAGER_REFS | VIEW_OPEN_DIFF | VIEW_SEND_CHILD_ENTER | VIEW_LOG_LIKE,
+	VIEW_ADD_PAGER_REFS | VIEW_OPEN_DIFF | VIEW_SEND_CHILD_ENTER | VIEW_LOG_LIKE | VIEW_WRAP_LINES,
 	sizeof(struct log_state),
 	log_open,
 	pager_read,
@@ -4568,13 +5066,42 @@ static struct view_ops log_ops = {
 	log_select,
 };
 
+struct diff_file {
+	unsigned long lineno;	/* Line number of the diff header. */
+	bool has_stat;		/* Has an index or similarity line. */
+	bool lazy;		/* The patch has not been loaded. */
+	bool failed;		/* Loading the patch failed. */
+	bool combined;		/* The patch is a combined diff. */
+	unsigned long used;	/* When the file was last shown. */
+	char *path;		/* Tab separated paths of the patch. */
+};
+
+struct diff_chunk {
+	unsigned long lineno;	/* Line number of the chunk header. */
+	int old_start;		/* First line in the old file or -1. */
+	int new_start;		/* First line in the new file or -1. */
+};
+
 struct diff_state {
-	bool after_commit_title;
-	bool after_diff;
-	bool reading_diff_stat;
-	bool combined_diff;
+	struct diff_parser parser;
+	struct diff_file *file;
+	size_t files;
+	struct diff_chunk *chunk;
+	size_t chunks;
+	bool lazy;		/* Load the patches on demand. */
+	size_t *fetch;		/* Files of the patches being loaded. */
+	size_t fetches;
+	struct line *fetched;	/* Lines read for the patches. */
+	size_t fetched_lines;
+	unsigned long cached;	/* Lines of patches loaded on demand. */
+	unsigned long used;	/* Counter for when files are shown. */
+	unsigned long offset;	/* View offset when last shown. */
 };
 
+DEFINE_ALLOCATOR(realloc_diff_files, struct diff_file, 32)
+DEFINE_ALLOCATOR(realloc_diff_chunks, struct diff_chunk, 256)
+DEFINE_ALLOCATOR(realloc_diff_fetch, size_t, 32)
+
 #define DIFF_LINE_COMMIT_TITLE 1
 
 static bool
@@ -4586,1351 +5113,3157 @@ diff_open(struct view *view, enum open_flags flags)
 			opt_notes_arg, opt_diff_context_arg, opt_ignore_space_arg,
 			"%(diffargs)", "--no-color", "%(commit)", "--", "%(fileargs)", NULL
 	};
+	static const char *diff_lazy_argv[] = {
+		"git", "show", opt_encoding_arg, "--pretty=fuller", "--root",
+			"--raw", "--stat", opt_notes_arg, opt_ignore_space_arg,
+			"%(diffargs)", "--no-color", "%(commit)", "--", "%(fileargs)", NULL
+	};
+	struct diff_state *state = view->private;
+	bool lazy = opt_diff_lazy_files > 0;
+
+	if (!begin_update(view, NULL, lazy ? diff_lazy_argv : diff_argv, flags))
+		return FALSE;
 
-	return begin_update(view, NULL, diff_argv, flags);
+	/* Patches read from stdin are all there is. */
+	if (view->pipe)
+		state->lazy = lazy && !view->unrefreshable;
+	return TRUE;
 }
 
 static bool
-diff_common_read(struct view *view, const char *data, struct diff_state *state)
+parse_chunk_lineno(int *lineno, const char *chunk, int marker)
 {
-	enum line_type type = get_line_type(data);
+	return prefixcmp(chunk, "@@ -") ||
+	       !(chunk = strchr(chunk, marker)) ||
+	       parse_int(lineno, chunk + 1, 0, 9999999) != OPT_OK;
+}
 
-	if (!view->lines && type != LINE_COMMIT)
-		state->reading_diff_stat = TRUE;
+/*
+ * Index of the file and chunk headers so that the diff helpers do not
+ * have to walk the lines to find the header a line belongs to. Line
+ * numbers are positions in the unfiltered view->line array.
+ */
 
-	if (state->combined_diff && !state->after_diff && data[0] == ' ' && data[1] != ' ')
-		state->reading_diff_stat = TRUE;
+static bool
+diff_index_line(struct diff_state *state, const char *data, enum line_type type, unsigned long lineno)
+{
+	if (type == LINE_DIFF_HEADER) {
+		if (!realloc_diff_files(&state->file, state->files, 1))
+			return FALSE;
+		state->file[state->files].lineno = lineno;
+		state->file[state->files++].has_stat = FALSE;
 
-	if (state->reading_diff_stat) {
-		size_t len = strlen(data);
-		char *pipe = strchr(data, '|');
-		bool has_histogram = data[len - 1] == '-' || data[len - 1] == '+';
-		bool has_bin_diff = pipe && strstr(pipe, "Bin") && strstr(pipe, "->");
-		bool has_rename = data[len - 1] == '0' && (strstr(data, "=>") || !strncmp(data, " ...", 4));
+	} else if (type == LINE_DIFF_INDEX || type == LINE_DIFF_SIMILARITY) {
+		if (state->files)
+			state->file[state->files - 1].has_stat = TRUE;
 
-		if (pipe && (has_histogram || has_bin_diff || has_rename)) {
-			return add_line_text(view, data, LINE_DIFF_STAT) != NULL;
-		} else {
-			state->reading_diff_stat = FALSE;
-		}
+	} else if (type == LINE_DIFF_CHUNK) {
+		struct diff_chunk *chunk;
+		const char *new_start = strchr(data, '+');
 
-	} else if (!strcmp(data, "---")) {
-		state->reading_diff_stat = TRUE;
+		if (!realloc_diff_chunks(&state->chunk, state->chunks, 1))
+			return FALSE;
+		chunk = &state->chunk[state->chunks++];
+		chunk->lineno = lineno;
+		if (parse_chunk_lineno(&chunk->old_start, data, '-'))
+			chunk->old_start = -1;
+		/* Combined diffs only have a usable new start. */
+		chunk->new_start = new_start ? atoi(new_start) : -1;
 	}
 
-	if (!state->after_commit_title && !prefixcmp(data, "    ")) {
-		struct line *line = add_line_text(view, data, LINE_DEFAULT);
+	return TRUE;
+}
 
-		if (line)
-			line->user_flags |= DIFF_LINE_COMMIT_TITLE;
-		state->after_commit_title = TRUE;
-		return line != NULL;
+static struct diff_file *
+diff_find_file(struct diff_state *state, unsigned long lineno)
+{
+	size_t low = 0, high = state->files;
+
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+
+		if (state->file[mid].lineno <= lineno)
+			low = mid + 1;
+		else
+			high = mid;
 	}
 
-	if (type == LINE_DIFF_HEADER) {
-		const int len = line_info[LINE_DIFF_HEADER].linelen;
+	return low ? &state->file[low - 1] : NULL;
+}
+
+static struct diff_chunk *
+diff_find_chunk(struct diff_state *state, unsigned long lineno)
+{
+	size_t low = 0, high = state->chunks;
 
-		state->after_diff = TRUE;
-		if (!strncmp(data + len, "combined ", strlen("combined ")) ||
-		    !strncmp(data + len, "cc ", strlen("cc ")))
-			state->combined_diff = TRUE;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
 
-	} else if (type == LINE_PP_MERGE) {
-		state->combined_diff = TRUE;
+		if (state->chunk[mid].lineno <= lineno)
+			low = mid + 1;
+		else
+			high = mid;
 	}
 
-	/* ADD2 and DEL2 are only valid in combined diff hunks */
-	if (!state->combined_diff && (type == LINE_DIFF_ADD2 || type == LINE_DIFF_DEL2))
-		type = LINE_DEFAULT;
+	return low ? &state->chunk[low - 1] : NULL;
+}
 
-	return pager_common_read(view, data, type);
+/* Get a line by its unfiltered line number. */
+static struct line *
+diff_get_line(struct view *view, unsigned long lineno)
+{
+	return view->filter ? &view->filter->line[lineno] : &view->line[lineno];
 }
 
-static bool
-diff_find_stat_entry(struct view *view, struct line *line, enum line_type type)
+static unsigned long
+diff_line_index(struct view *view, struct line *line)
 {
-	struct line *marker = find_next_line_by_type(view, line, type);
+	unsigned long lineno = line - view->line;
 
-	return marker &&
-		line == find_prev_line_by_type(view, marker, LINE_DIFF_HEADER);
+	return view->filter ? view->filter->index[lineno] : lineno;
 }
 
-static enum request
-diff_common_enter(struct view *view, enum request request, struct line *line)
+/* Map an unfiltered line number to the first line shown at or after it. */
+static unsigned long
+diff_view_lineno(struct view *view, unsigned long lineno)
 {
-	if (line->type == LINE_DIFF_STAT) {
-		int file_number = 0;
+	struct view_filter *filter = view->filter;
+	size_t low = 0, high = view->lines;
 
-		while (view_has_line(view, line) && line->type == LINE_DIFF_STAT) {
-			file_number++;
-			line--;
-		}
+	if (!filter)
+		return lineno;
 
-		for (line = view->line; view_has_line(view, line); line++) {
-			line = find_next_line_by_type(view, line, LINE_DIFF_HEADER);
-			if (!line)
-				break;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
 
-			if (diff_find_stat_entry(view, line, LINE_DIFF_INDEX)
-			    || diff_find_stat_entry(view, line, LINE_DIFF_SIMILARITY)) {
-				if (file_number == 1) {
-					break;
-				}
-				file_number--;
-			}
-		}
+		if (filter->index[mid] < lineno)
+			low = mid + 1;
+		else
+			high = mid;
+	}
 
-		if (!line) {
-			report("Failed to find file diff");
-			return REQ_NONE;
-		}
+	return low;
+}
 
-		select_view_line(view, line - view->line);
-		report_clear();
-		return REQ_NONE;
+static void
+diff_free_fetched(struct diff_state *state)
+{
+	size_t i;
 
-	} else {
-		return pager_request(view, request, line);
-	}
+	for (i = 0; i < state->fetched_lines; i++)
+		free(state->fetched[i].data);
+	free(state->fetched);
+	state->fetched = NULL;
+	state->fetched_lines = 0;
+	free(state->fetch);
+	state->fetch = NULL;
+	state->fetches = 0;
+}
+
+static void
+diff_done(struct view *view)
+{
+	struct diff_state *state = view->private;
+	size_t i;
+
+	for (i = 0; i < state->files; i++)
+		free(state->file[i].path);
+	free(state->file);
+	free(state->chunk);
+	diff_free_fetched(state);
 }
 
 static bool
-diff_common_draw_part(struct view *view, enum line_type *type, char **text, char c, enum line_type next_type)
+diff_common_read(struct view *view, const char *data, struct diff_state *state)
 {
-	char *sep = strchr(*text, c);
+	bool commit_title;
+	enum line_type type = parse_diff_line(&state->parser, data, !view->lines, &commit_title);
+	unsigned long lineno = view->lines;
 
-	if (sep != NULL) {
-		*sep = 0;
-		draw_text(view, *type, *text);
-		*sep = c;
-		*text = sep;
-		*type = next_type;
+	if (type == LINE_DIFF_STAT)
+		return add_line_text(view, data, LINE_DIFF_STAT) != NULL;
+
+	if (commit_title) {
+		struct line *line = add_line_text(view, data, LINE_DEFAULT);
+
+		if (line)
+			line->user_flags |= DIFF_LINE_COMMIT_TITLE;
+		return line != NULL;
 	}
 
-	return sep != NULL;
+	return pager_common_read(view, data, type) &&
+	       diff_index_line(state, data, type, lineno);
 }
 
+/*
+ * Loading of patches on demand
+ *
+ * With the diff-lazy-files option, the diff view first loads the commit
+ * header, the raw list of changed files and the diffstat. A header line
+ * is added for each file and the patches of the files are loaded with a
+ * path limited git-show(1) when the view is moved or scrolled to their
+ * headers, together with the next files in the direction the view is
+ * scrolled. Patches not
+ * shown recently are unloaded again when the loaded patches have more
+ * than diff-lazy-cache lines.
+ */
+
+#define DIFF_LAZY_PREFETCH	16
+
+/* Record a line of --raw output:
+ * :100644 100644 190423f e6ae795 M	file
+ * ::100644 100644 100644 190423f 190423f e6ae795 MM	file */
 static bool
-diff_common_draw(struct view *view, struct line *line, unsigned int lineno)
+diff_lazy_add_file(struct view *view, struct diff_state *state, char *data)
 {
-	char *text = line->data;
-	enum line_type type = line->type;
+	char old_id[SIZEOF_REV], new_id[SIZEOF_REV];
+	struct diff_file *file;
+	char *path = strchr(data, '\t');
+	char *status;
 
-	if (draw_lineno(view, lineno))
+	if (!path)
 		return TRUE;
-
-	if (line->wrapped && draw_text(view, LINE_DELIMITER, "+"))
+	*path++ = 0;
+	status = strrchr(data, ' ');
+	if (!status)
 		return TRUE;
 
-	if (type == LINE_DIFF_STAT) {
-		diff_common_draw_part(view, &type, &text, '|', LINE_DEFAULT);
-		if (diff_common_draw_part(view, &type, &text, 'B', LINE_DEFAULT)) {
-			/* Handle binary diffstat: Bin <deleted> -> <added> bytes */
-			diff_common_draw_part(view, &type, &text, ' ', LINE_DIFF_DEL);
-			diff_common_draw_part(view, &type, &text, '-', LINE_DEFAULT);
-			diff_common_draw_part(view, &type, &text, ' ', LINE_DIFF_ADD);
-			diff_common_draw_part(view, &type, &text, 'b', LINE_DEFAULT);
+	/* Show the separator which git-show(1) puts before the diffstat
+	 * in place of the empty line before the raw output. */
+	if (!state->files) {
+		struct line *last = view->lines ? &view->line[view->lines - 1] : NULL;
 
-		} else {
-			diff_common_draw_part(view, &type, &text, '+', LINE_DIFF_ADD);
-			diff_common_draw_part(view, &type, &text, '-', LINE_DIFF_DEL);
+		if (last && last->data && !*(char *) last->data) {
+			free_line_data(view, last->data);
+			view->lines--;
 		}
+		if (!diff_common_read(view, "---", state))
+			return FALSE;
 	}
 
-	if (line->user_flags & DIFF_LINE_COMMIT_TITLE)
-		draw_commit_title(view, text, 4);
-	else
-		draw_text(view, type, text);
+	if (!realloc_diff_files(&state->file, state->files, 1))
+		return FALSE;
+	file = &state->file[state->files];
+	memset(file, 0, sizeof(*file));
+	file->path = strdup(path);
+	if (!file->path)
+		return FALSE;
+	state->files++;
+
+	file->lazy = TRUE;
+	file->combined = data[1] == ':';
+
+	/* Only changes of the mode have no index line. */
+	file->has_stat = file->combined || status[1] == 'R' || status[1] == 'C' ||
+			 sscanf(data, ":%*o %*o %40s %40s", old_id, new_id) != 2 ||
+			 strcmp(old_id, new_id);
 	return TRUE;
 }
 
+/* Format a path of the --raw output as in the diff header, where the
+ * prefix goes inside the quotes of quoted paths. */
 static bool
-diff_read(struct view *view, char *data)
+diff_lazy_format_path(char buf[SIZEOF_STR], const char *prefix, const char *path, int pathlen)
 {
-	struct diff_state *state = view->private;
+	if (*path == '"')
+		return string_format_size(buf, SIZEOF_STR, "\"%s%.*s", prefix, pathlen - 1, path + 1);
+	return string_format_size(buf, SIZEOF_STR, "%s%.*s", prefix, pathlen, path);
+}
 
-	if (!data) {
-		/* Fall back to retry if no diff will be shown. */
-		if (view->lines == 0 && opt_file_argv) {
-			int pos = argv_size(view->argv)
-				- argv_size(opt_file_argv) - 1;
+static bool
+diff_lazy_add_headers(struct view *view, struct diff_state *state)
+{
+	size_t i;
 
-			if (pos > 0 && !strcmp(view->argv[pos], "--")) {
-				for (; view->argv[pos]; pos++) {
-					free((void *) view->argv[pos]);
-					view->argv[pos] = NULL;
-				}
+	if (!diff_common_read(view, "", state))
+		return FALSE;
 
-				if (view->pipe)
-					io_done(view->pipe);
-				if (io_run(&view->io, IO_RD, view->dir, opt_env, view->argv))
-					return FALSE;
-			}
-		}
-		return TRUE;
+	for (i = 0; i < state->files; i++) {
+		struct diff_file *file = &state->file[i];
+		char *new_path = strchr(file->path, '\t');
+		int old_pathlen = new_path ? new_path - file->path : strlen(file->path);
+		char old_buf[SIZEOF_STR], new_buf[SIZEOF_STR];
+		struct line *line;
+
+		if (!new_path)
+			new_path = file->path;
+		else
+			new_path++;
+
+		if (file->combined)
+			line = add_line_format(view, LINE_DIFF_HEADER, "diff --cc %s", file->path);
+		else if (diff_lazy_format_path(old_buf, "a/", file->path, old_pathlen) &&
+			 diff_lazy_format_path(new_buf, "b/", new_path, strlen(new_path)))
+			line = add_line_format(view, LINE_DIFF_HEADER, "diff --git %s %s",
+					       old_buf, new_buf);
+		else
+			line = NULL;
+		if (!line)
+			return FALSE;
+		file->lineno = line - view->line;
 	}
 
-	return diff_common_read(view, data, state);
+	return TRUE;
 }
 
 static bool
-diff_blame_line(const char *ref, const char *file, unsigned long lineno,
-		struct blame_header *header, struct blame_commit *commit)
+diff_lazy_add_fetch(struct diff_state *state, size_t i)
 {
-	char line_arg[SIZEOF_STR];
-	const char *blame_argv[] = {
-		"git", "blame", opt_encoding_arg, "-p", line_arg, ref, "--", file, NULL
-	};
-	struct io io;
-	bool ok = FALSE;
-	char *buf;
+	struct diff_file *file = &state->file[i];
 
-	if (!string_format(line_arg, "-L%ld,+1", lineno))
+	if (!file->lazy || file->failed)
+		return TRUE;
+	if (!realloc_diff_fetch(&state->fetch, state->fetches, 1))
 		return FALSE;
+	state->fetch[state->fetches++] = i;
+	return TRUE;
+}
 
-	if (!io_run(&io, IO_RD, opt_cdup, opt_env, blame_argv))
-		return FALSE;
+static int
+compare_diff_fetch(const void *a, const void *b)
+{
+	size_t i = *(const size_t *) a;
+	size_t j = *(const size_t *) b;
 
-	while ((buf = io_get(&io, '\n', TRUE))) {
-		if (header) {
-			if (!parse_blame_header(header, buf, 9999999))
-				break;
-			header = NULL;
+	return i < j ? -1 : i > j;
+}
 
-		} else if (parse_blame_info(commit, buf)) {
-			ok = TRUE;
-			break;
-		}
-	}
+/* Get the range of files shown in the view. */
+static void
+diff_lazy_shown(struct view *view, struct diff_state *state, size_t *first, size_t *end)
+{
+	unsigned long last = MIN(view->pos.offset + view->height, view->lines);
+	struct diff_file *file = diff_find_file(state, view->pos.offset);
+	size_t i;
 
-	if (io_error(&io))
-		ok = FALSE;
+	*first = file ? file - state->file : 0;
+	file = last ? diff_find_file(state, last - 1) : NULL;
+	*end = file ? file - state->file + 1 : 0;
 
-	io_done(&io);
-	return ok;
+	state->used++;
+	for (i = *first; i < *end; i++)
+		state->file[i].used = state->used;
 }
 
-static unsigned int
-diff_get_lineno(struct view *view, struct line *line)
+/* Turn the command loading the diffstat into one loading patches. The
+ * paths are passed as they are, so they must not be read as patterns. */
+static bool
+diff_lazy_argv(struct view *view, const char ***argv)
 {
-	const struct line *header, *chunk;
-	const char *data;
-	unsigned int lineno;
+	size_t i;
 
-	/* Verify that we are after a diff header and one of its chunks */
-	header = find_prev_line_by_type(view, line, LINE_DIFF_HEADER);
-	chunk = find_prev_line_by_type(view, line, LINE_DIFF_CHUNK);
-	if (!header || !chunk || chunk < header)
-		return 0;
+	if (!argv_append(argv, view->argv[0]) ||
+	    !argv_append(argv, "--literal-pathspecs"))
+		return FALSE;
 
-	/*
-	 * In a chunk header, the number after the '+' sign is the number of its
-	 * following line, in the new version of the file. We increment this
-	 * number for each non-deletion line, until the given line position.
-	 */
-	data = strchr(chunk->data, '+');
-	if (!data)
-		return 0;
+	for (i = 1; view->argv[i]; i++) {
+		const char *arg = view->argv[i];
 
-	lineno = atoi(data);
-	chunk++;
-	while (chunk++ < line)
-		if (chunk->type != LINE_DIFF_DEL)
-			lineno++;
+		if (!strcmp(arg, "--pretty=fuller"))
+			arg = "--pretty=format:";
+		else if (!strcmp(arg, "--raw"))
+			arg = "--patch";
+		else if (!strcmp(arg, "--stat"))
+			arg = opt_diff_context_arg;
+		else if (!strcmp(arg, "--"))
+			break;
 
-	return lineno;
-}
+		if (!argv_append(argv, arg))
+			return FALSE;
+	}
 
-static bool
-parse_chunk_lineno(int *lineno, const char *chunk, int marker)
-{
-	return prefixcmp(chunk, "@@ -") ||
-	       !(chunk = strchr(chunk, marker)) ||
-	       parse_int(lineno, chunk + 1, 0, 9999999) != OPT_OK;
+	return argv_append(argv, "--");
 }
 
-static enum request
-diff_trace_origin(struct view *view, struct line *line)
+static void
+diff_lazy_load(struct view *view)
 {
-	struct line *diff = find_prev_line_by_type(view, line, LINE_DIFF_HEADER);
-	struct line *chunk = find_prev_line_by_type(view, line, LINE_DIFF_CHUNK);
-	const char *chunk_data;
-	int chunk_marker = line->type == LINE_DIFF_DEL ? '-' : '+';
-	int lineno = 0;
-	const char *file = NULL;
-	char ref[SIZEOF_REF];
-	struct blame_header header;
-	struct blame_commit commit;
+	struct diff_state *state = view->private;
+	bool forward = view->pos.offset >= state->offset;
+	const char **argv = NULL;
+	size_t first, end, i;
+	bool all;
 
-	if (!diff || !chunk || chunk == line) {
-		report("The line to trace must be inside a diff chunk");
-		return REQ_NONE;
-	}
+	if (view->pipe || view->filter || !state->files || !view->argv)
+		return;
 
-	for (; diff < line && !file; diff++) {
-		const char *data = diff->data;
+	diff_lazy_shown(view, state, &first, &end);
+	state->offset = view->pos.offset;
 
-		if (!prefixcmp(data, "--- a/")) {
-			file = data + STRING_SIZE("--- a/");
-			break;
-		}
-	}
+	for (i = first; i < end; i++)
+		if (!diff_lazy_add_fetch(state, i))
+			goto failed;
+	if (!state->fetches)
+		return;
 
-	if (diff == line || !file) {
-		report("Failed to read the file name");
-		return REQ_NONE;
-	}
+	/* Load all patches of small commits at once. */
+	for (i = 0, all = state->files <= opt_diff_lazy_files; i < state->files && all; i++)
+		all = state->file[i].lazy && !state->file[i].failed;
 
-	chunk_data = chunk->data;
+	if (all) {
+		state->fetches = 0;
+		for (i = 0; i < state->files; i++)
+			if (!diff_lazy_add_fetch(state, i))
+				goto failed;
 
-	if (parse_chunk_lineno(&lineno, chunk_data, chunk_marker)) {
-		report("Failed to read the line number");
-		return REQ_NONE;
-	}
+	} else if (forward) {
+		for (i = end; i < state->files && i < end + DIFF_LAZY_PREFETCH; i++)
+			if (!diff_lazy_add_fetch(state, i))
+				goto failed;
 
-	if (lineno == 0) {
-		report("This is the origin of the line");
-		return REQ_NONE;
+	} else {
+		for (i = first; i > 0 && i + DIFF_LAZY_PREFETCH > first; i--)
+			if (!diff_lazy_add_fetch(state, i - 1))
+				goto failed;
+		qsort(state->fetch, state->fetches, sizeof(*state->fetch), compare_diff_fetch);
 	}
 
-	for (chunk += 1; chunk < line; chunk++) {
-		if (chunk->type == LINE_DIFF_ADD) {
-			lineno += chunk_marker == '+';
-		} else if (chunk->type == LINE_DIFF_DEL) {
-			lineno += chunk_marker == '-';
-		} else {
-			lineno++;
-		}
-	}
+	if (!diff_lazy_argv(view, &argv))
+		goto failed;
 
-	if (chunk_marker == '+')
-		string_copy(ref, view->vid);
-	else
-		string_format(ref, "%s^", view->vid);
+	for (i = 0; !all && i < state->fetches; i++) {
+		const char *path = state->file[state->fetch[i]].path;
+		const char *new_path = strchr(path, '\t');
+		char buf[SIZEOF_STR];
 
-	if (!diff_blame_line(ref, file, lineno, &header, &commit)) {
-		report("Failed to read blame data");
-		return REQ_NONE;
+		if (!unquote_path(buf, sizeof(buf), path, new_path ? new_path - path : strlen(path)) ||
+		    !argv_append(&argv, buf))
+			goto failed;
+		if (new_path &&
+		    (!unquote_path(buf, sizeof(buf), new_path + 1, strlen(new_path + 1)) ||
+		     !argv_append(&argv, buf)))
+			goto failed;
 	}
 
-	string_ncopy(opt_file, commit.filename, strlen(commit.filename));
-	string_copy(opt_ref, header.id);
-	opt_goto_line = header.orig_lineno - 1;
+	if (!io_run(&view->io, IO_RD, view->dir, opt_env, argv))
+		goto failed;
 
-	return REQ_VIEW_BLAME;
+	argv_free(argv);
+	free(argv);
+	/* The patches are read after the diffstat. */
+	state->parser.after_commit_title = TRUE;
+	view->pipe = &view->io;
+	view->start_time = time(NULL);
+	return;
+
+failed:
+	for (i = 0; i < state->fetches; i++)
+		state->file[state->fetch[i]].failed = TRUE;
+	diff_free_fetched(state);
+	argv_free(argv);
+	free(argv);
+	report("Failed to load the diff of %s", view->vid);
 }
 
-static const char *
-diff_get_pathname(struct view *view, struct line *line)
+static bool
+diff_lazy_read(struct view *view, struct diff_state *state, const char *data)
 {
-	const struct line *header;
-	const char *dst = NULL;
-	const char *prefixes[] = { " b/", "cc ", "combined " };
-	int i;
+	bool commit_title;
+	enum line_type type = parse_diff_line(&state->parser, data, FALSE, &commit_title);
+	size_t size = strlen(data) + 1;
+	struct line *line;
 
-	header = find_prev_line_by_type(view, line, LINE_DIFF_HEADER);
-	if (!header)
-		return NULL;
+	if (!realloc_lines(&state->fetched, state->fetched_lines, 1))
+		return FALSE;
 
-	for (i = 0; i < ARRAY_SIZE(prefixes) && !dst; i++)
-		dst = strstr(header->data, prefixes[i]);
+	line = &state->fetched[state->fetched_lines];
+	memset(line, 0, sizeof(*line));
+	line->data = malloc(size);
+	if (!line->data)
+		return FALSE;
+	memcpy(line->data, data, size);
+	line->type = type;
+	line->lineno = 1;
+	line->dirty = 1;
+	state->fetched_lines++;
+	view->stats.alloc += size;
 
-	return dst ? dst + strlen(prefixes[--i]) : NULL;
+	return TRUE;
 }
 
-static enum request
-diff_common_edit(struct view *view, enum request request, struct line *line)
+static unsigned long
+diff_lazy_size(struct view *view, struct diff_state *state, size_t i)
 {
-	const char *file = diff_get_pathname(view, line);
-	char path[SIZEOF_STR];
-	bool has_path = file && string_format(path, "%s%s", opt_cdup, file);
+	unsigned long end = i + 1 < state->files ? state->file[i + 1].lineno : view->lines;
 
-	if (has_path && access(path, R_OK)) {
-		report("Failed to open file: %s", file);
-		return REQ_NONE;
-	}
-
-	open_editor(file, diff_get_lineno(view, line));
-	return REQ_NONE;
+	return end - state->file[i].lineno - 1;
 }
 
-static enum request
-diff_request(struct view *view, enum request request, struct line *line)
+struct diff_evict {
+	unsigned long used;
+	size_t file;
+};
+
+static int
+compare_diff_evict(const void *a, const void *b)
 {
-	switch (request) {
-	case REQ_VIEW_BLAME:
-		return diff_trace_origin(view, line);
+	const struct diff_evict *i = a, *j = b;
 
-	case REQ_DIFF_CONTEXT_UP:
-	case REQ_DIFF_CONTEXT_DOWN:
-		if (!update_diff_context(request))
-			return REQ_NONE;
-		reload_view(view);
-		return REQ_NONE;
+	if (i->used != j->used)
+		return i->used < j->used ? -1 : 1;
+	return compare_diff_fetch(&i->file, &j->file);
+}
 
+/* Pick patches to unload, least recently shown first. */
+static size_t *
+diff_lazy_evict(struct view *view, struct diff_state *state, unsigned long cached, size_t *evicts)
+{
+	struct diff_evict *candidate;
+	size_t *evict = NULL;
+	size_t candidates = 0;
+	size_t first, end, i;
 
-	case REQ_EDIT:
-		return diff_common_edit(view, request, line);
+	*evicts = 0;
+	if (cached <= opt_diff_lazy_cache)
+		return NULL;
 
-	case REQ_ENTER:
-		return diff_common_enter(view, request, line);
+	candidate = calloc(state->files, sizeof(*candidate));
+	if (!candidate)
+		return NULL;
 
-	case REQ_REFRESH:
-		reload_view(view);
-		return REQ_NONE;
+	diff_lazy_shown(view, state, &first, &end);
+	for (i = 0; i < state->files; i++) {
+		struct diff_file *file = &state->file[i];
 
-	default:
-		return pager_request(view, request, line);
+		if (file->path && !file->lazy && file->used != state->used) {
+			candidate[candidates].used = file->used;
+			candidate[candidates++].file = i;
+		}
+	}
+
+	if (candidates)
+		qsort(candidate, candidates, sizeof(*candidate), compare_diff_evict);
+	for (i = 0; i < candidates && cached > opt_diff_lazy_cache; i++) {
+		if (!realloc_diff_fetch(&evict, *evicts, 1))
+			break;
+		evict[(*evicts)++] = candidate[i].file;
+		cached -= diff_lazy_size(view, state, candidate[i].file);
 	}
+
+	free(candidate);
+	if (*evicts)
+		qsort(evict, *evicts, sizeof(*evict), compare_diff_fetch);
+	return evict;
 }
 
 static void
-diff_select(struct view *view, struct line *line)
+diff_lazy_add_line(struct diff_state *state, struct line *lines, size_t *pos,
+		   struct line *line, unsigned long *numbered)
 {
-	if (line->type == LINE_DIFF_STAT) {
-		string_format(view->ref, "Press '%s' to jump to file diff",
-			      get_view_key(view, REQ_ENTER));
-	} else {
-		const char *file = diff_get_pathname(view, line);
+	lines[*pos] = *line;
+	if (line->lineno)
+		lines[*pos].lineno = ++*numbered;
+	lines[*pos].dirty = 1;
+	if (line->type == LINE_DIFF_CHUNK)
+		diff_index_line(state, line->data, line->type, *pos);
+	(*pos)++;
+}
 
-		if (file) {
-			string_format(view->ref, "Changes to '%s'", file);
-			string_format(opt_file, "%s", file);
-			ref_blob[0] = 0;
-		} else {
-			string_ncopy(view->ref, view->id, strlen(view->id));
-			pager_select(view, line);
+/* Move the loaded patches into the view after the headers of their files. */
+static bool
+diff_lazy_splice(struct view *view, struct diff_state *state)
+{
+	struct line *fetched = state->fetched;
+	size_t *fetch = state->fetch;
+	size_t fetches = state->fetches;
+	size_t *start = NULL, *evict = NULL;
+	size_t evicts = 0, total = 0;
+	unsigned long cached = state->cached;
+	unsigned long offset = 0, lineno = 0, numbered = 0;
+	struct line *lines = NULL;
+	size_t i, j, k, e, f, pos;
+
+	if (!io_eof(view->pipe) || io_error(view->pipe) || view->filter)
+		goto failed;
+
+	/* Match the patches to the files using their headers. */
+	start = calloc(fetches, sizeof(*start));
+	if (!start)
+		goto failed;
+	for (i = 0; i < fetches; i++)
+		start[i] = state->fetched_lines;
+
+	for (i = 0, k = 0; i < state->fetched_lines && k < fetches; i++) {
+		if (fetched[i].type != LINE_DIFF_HEADER)
+			continue;
+		for (j = k; j < fetches; j++)
+			if (!strcmp(view->line[state->file[fetch[j]].lineno].data, fetched[i].data))
+				break;
+		if (j < fetches) {
+			start[j] = i;
+			k = j + 1;
 		}
 	}
-}
-
-static struct view_ops diff_ops = {
-	"line",
-	{ "diff" },
-	VIEW_DIFF_LIKE | VIEW_ADD_DESCRIBE_REF | VIEW_ADD_PAGER_REFS | VIEW_STDIN | VIEW_FILE_FILTER,
-	sizeof(struct diff_state),
-	diff_open,
-	diff_read,
-	diff_common_draw,
-	diff_request,
-	pager_grep,
-	diff_select,
-};
 
-/*
- * Help backend
- */
+	for (k = 0; k < fetches; k++) {
+		if (start[k] == state->fetched_lines)
+			continue;
+		for (i = start[k] + 1; i < state->fetched_lines && fetched[i].type != LINE_DIFF_HEADER; i++)
+			;
+		cached += i - start[k] - 1;
+		total += i - start[k] - 1;
+	}
 
-static bool
-help_draw(struct view *view, struct line *line, unsigned int lineno)
-{
-	if (line->type == LINE_HELP_KEYMAP) {
-		struct keymap *keymap = line->data;
+	evict = diff_lazy_evict(view, state, cached, &evicts);
+	for (e = 0; e < evicts; e++) {
+		unsigned long size = diff_lazy_size(view, state, evict[e]);
 
-		draw_formatted(view, line->type, "[%c] %s bindings",
-			       keymap->hidden ? '+' : '-', keymap->name);
-		return TRUE;
-	} else {
-		return pager_draw(view, line, lineno);
+		cached -= size;
+		total -= size;
 	}
-}
 
-static bool
-help_open_keymap_title(struct view *view, struct keymap *keymap)
-{
-	add_line(view, keymap, LINE_HELP_KEYMAP, 0, FALSE);
-	return keymap->hidden;
-}
+	if (!realloc_lines(&lines, 0, view->lines + total))
+		goto failed;
 
-static void
-help_open_keymap(struct view *view, struct keymap *keymap)
-{
-	const char *group = NULL;
-	char buf[SIZEOF_STR];
-	bool add_title = TRUE;
-	int i;
+	state->chunks = 0;
+	for (i = 0, pos = 0, f = 0, k = 0, e = 0; i < view->lines; i++) {
+		struct diff_file *file = f < state->files && state->file[f].lineno == i
+				       ? &state->file[f++] : NULL;
+		unsigned long end = i;
 
-	for (i = 0; i < ARRAY_SIZE(req_info); i++) {
-		const char *key = NULL;
+		if (i == view->pos.offset)
+			offset = pos;
+		if (i == view->pos.lineno)
+			lineno = pos;
 
-		if (req_info[i].request == REQ_NONE)
-			continue;
+		if (file && k < fetches && fetch[k] == file - state->file) {
+			file->lineno = pos;
+			if (start[k] == state->fetched_lines) {
+				file->failed = TRUE;
+				diff_lazy_add_line(state, lines, &pos, &view->line[i], &numbered);
 
-		if (!req_info[i].request) {
-			group = req_info[i].help;
+			} else {
+				struct line *header = &fetched[start[k]];
+
+				file->lazy = FALSE;
+				file->has_stat = FALSE;
+				free_line_data(view, view->line[i].data);
+				view->line[i].data = header->data;
+				header->data = NULL;
+				diff_lazy_add_line(state, lines, &pos, &view->line[i], &numbered);
+
+				for (j = start[k] + 1; j < state->fetched_lines &&
+						       fetched[j].type != LINE_DIFF_HEADER; j++) {
+					if (fetched[j].type == LINE_DIFF_INDEX ||
+					    fetched[j].type == LINE_DIFF_SIMILARITY)
+						file->has_stat = TRUE;
+					diff_lazy_add_line(state, lines, &pos, &fetched[j], &numbered);
+					fetched[j].data = NULL;
+				}
+			}
+			k++;
 			continue;
 		}
 
-		key = get_keys(keymap, req_info[i].request, TRUE);
-		if (!key || !*key)
-			continue;
+		/* The size is taken from the header before it is moved. */
+		if (file && e < evicts && evict[e] == file - state->file) {
+			end = i + diff_lazy_size(view, state, evict[e]);
+			file->lazy = TRUE;
+			e++;
+		}
 
-		if (add_title && help_open_keymap_title(view, keymap))
-			return;
-		add_title = FALSE;
+		if (file)
+			file->lineno = pos;
+		diff_lazy_add_line(state, lines, &pos, &view->line[i], &numbered);
 
-		if (group) {
-			add_line_text(view, group, LINE_HELP_GROUP);
-			group = NULL;
+		for (; i < end; i++) {
+			if (i + 1 == view->pos.offset)
+				offset = pos - 1;
+			if (i + 1 == view->pos.lineno)
+				lineno = pos - 1;
+			free_line_data(view, view->line[i + 1].data);
 		}
-
-		add_line_format(view, LINE_DEFAULT, "    %-25s %-20s %s", key,
-				enum_name(req_info[i]), req_info[i].help);
 	}
 
-	group = "External commands:";
+	free(view->line);
+	view->line = lines;
+	view->lines = pos;
+	reset_view_wrap(view);
+	view->pos.offset = offset;
+	view->pos.row = 0;
+	view->pos.lineno = lineno;
+	view->digits = count_digits(view->lines);
+	view->force_redraw = TRUE;
+	if (view_is_displayed(view))
+		werase(view->win);
+	invalidate_render_cache();
+	state->cached = cached;
+	free(start);
+	free(evict);
+	diff_free_fetched(state);
+	return TRUE;
 
-	for (i = 0; i < run_requests; i++) {
-		struct run_request *req = get_run_request(REQ_NONE + i + 1);
-		const char *key;
+failed:
+	free(start);
+	free(evict);
+	diff_free_fetched(state);
+	return TRUE;
+}
 
-		if (!req || req->keymap != keymap)
-			continue;
+static enum request
+diff_common_enter(struct view *view, enum request request, struct line *line)
+{
+	if (line->type == LINE_DIFF_STAT) {
+		struct diff_state *state = view->private;
+		int file_number = 0;
+		size_t i;
 
-		key = get_key_name(req->key);
-		if (!*key)
-			key = "(no key defined)";
+		while (view_has_line(view, line) && line->type == LINE_DIFF_STAT) {
+			file_number++;
+			line--;
+		}
 
-		if (add_title && help_open_keymap_title(view, keymap))
-			return;
-		add_title = FALSE;
+		for (i = 0; i < state->files; i++) {
+			if (!state->file[i].has_stat)
+				continue;
+			if (file_number == 1)
+				break;
+			file_number--;
+		}
 
-		if (group) {
-			add_line_text(view, group, LINE_HELP_GROUP);
-			group = NULL;
+		if (i == state->files) {
+			report("Failed to find file diff");
+			return REQ_NONE;
 		}
 
-		if (!argv_to_string(req->argv, buf, sizeof(buf), " "))
-			return;
+		select_view_line(view, diff_view_lineno(view, state->file[i].lineno));
+		report_clear();
+		return REQ_NONE;
 
-		add_line_format(view, LINE_DEFAULT, "    %-25s `%s`", key, buf);
+	} else {
+		return pager_request(view, request, line);
 	}
 }
 
 static bool
-help_open(struct view *view, enum open_flags flags)
+diff_common_draw_part(struct view *view, enum line_type *type, char **text, char c, enum line_type next_type)
 {
-	struct keymap *keymap;
+	char *sep = strchr(*text, c);
 
-	reset_view(view);
-	add_line_text(view, "Quick reference for tig keybindings:", LINE_DEFAULT);
-	add_line_text(view, "", LINE_DEFAULT);
+	if (sep != NULL) {
+		*sep = 0;
+		draw_text(view, *type, *text);
+		*sep = c;
+		*text = sep;
+		*type = next_type;
+	}
 
-	for (keymap = keymaps; keymap; keymap = keymap->next)
-		help_open_keymap(view, keymap);
+	return sep != NULL;
+}
+
+static bool
+diff_common_draw(struct view *view, struct line *line, unsigned int lineno)
+{
+	char buf[SIZEOF_STR];
+	char *wrapped = get_wrapped_row_text(view, line, buf);
+	char *text = wrapped ? wrapped : line->data;
+	enum line_type type = line->type;
+
+	if (draw_lineno(view))
+		return TRUE;
+
+	if (view->currow && draw_text(view, LINE_DELIMITER, "+"))
+		return TRUE;
+
+	if (type == LINE_DIFF_STAT) {
+		diff_common_draw_part(view, &type, &text, '|', LINE_DEFAULT);
+		if (diff_common_draw_part(view, &type, &text, 'B', LINE_DEFAULT)) {
+			/* Handle binary diffstat: Bin <deleted> -> <added> bytes */
+			diff_common_draw_part(view, &type, &text, ' ', LINE_DIFF_DEL);
+			diff_common_draw_part(view, &type, &text, '-', LINE_DEFAULT);
+			diff_common_draw_part(view, &type, &text, ' ', LINE_DIFF_ADD);
+			diff_common_draw_part(view, &type, &text, 'b', LINE_DEFAULT);
+
+		} else {
+			diff_common_draw_part(view, &type, &text, '+', LINE_DIFF_ADD);
+			diff_common_draw_part(view, &type, &text, '-', LINE_DIFF_DEL);
+		}
+	}
 
+	if ((line->user_flags & DIFF_LINE_COMMIT_TITLE) && !view->currow)
+		draw_commit_title(view, text, 4);
+	else if (wrapped)
+		draw_text(view, type, text);
+	else
+		draw_text_cached(view, type, text);
 	return TRUE;
 }
 
+static bool
+diff_read(struct view *view, char *data)
+{
+	struct diff_state *state = view->private;
+
+	if (state->fetches)
+		return data ? diff_lazy_read(view, state, data)
+			    : diff_lazy_splice(view, state);
+
+	if (data && state->lazy && *data == ':')
+		return diff_lazy_add_file(view, state, data);
+
+	if (!data) {
+		/* Fall back to retry if no diff will be shown. */
+		if (view->lines == 0 && opt_file_argv) {
+			int pos = argv_size(view->argv)
+				- argv_size(opt_file_argv) - 1;
+
+			if (pos > 0 && !strcmp(view->argv[pos], "--")) {
+				for (; view->argv[pos]; pos++) {
+					free((void *) view->argv[pos]);
+					view->argv[pos] = NULL;
+				}
+
+				if (view->pipe)
+					io_done(view->pipe);
+				if (io_run(&view->io, IO_RD, view->dir, opt_env, view->argv))
+					return FALSE;
+			}
+		}
+
+		if (state->lazy && state->files && !diff_lazy_add_headers(view, state))
+			report("Failed to add the file headers of %s", view->vid);
+		return TRUE;
+	}
+
+	return diff_common_read(view, data, state);
+}
+
+static bool
+diff_blame_line(const char *ref, const char *file, unsigned long lineno,
+		struct blame_header *header, struct blame_commit *commit)
+{
+	char line_arg[SIZEOF_STR];
+	const char *blame_argv[] = {
+		"git", "blame", opt_encoding_arg, "-p", line_arg, ref, "--", file, NULL
+	};
+	struct io io;
+	bool ok = FALSE;
+	char *buf;
+
+	if (!string_format(line_arg, "-L%ld,+1", lineno))
+		return FALSE;
+
+	if (!io_run(&io, IO_RD, opt_cdup, opt_env, blame_argv))
+		return FALSE;
+
+	while ((buf = io_get(&io, '\n', TRUE))) {
+		if (header) {
+			if (!parse_blame_header(header, buf, 9999999))
+				break;
+			header = NULL;
+
+		} else if (parse_blame_info(commit, buf)) {
+			ok = TRUE;
+			break;
+		}
+	}
+
+	if (io_error(&io))
+		ok = FALSE;
+
+	io_done(&io);
+	return ok;
+}
+
+static unsigned int
+diff_get_lineno(struct view *view, struct line *line)
+{
+	struct diff_state *state = view->private;
+	unsigned long pos = diff_line_index(view, line);
+	const struct diff_file *header = diff_find_file(state, pos);
+	const struct diff_chunk *chunk = diff_find_chunk(state, pos);
+	unsigned int lineno;
+	unsigned long i;
+
+	/* Verify that we are after a diff header and one of its chunks */
+	if (!header || !chunk || chunk->lineno < header->lineno)
+		return 0;
+
+	/*
+	 * In a chunk header, the number after the '+' sign is the number of its
+	 * following line, in the new version of the file. We increment this
+	 * number for each non-deletion line, until the given line position.
+	 */
+	if (chunk->new_start < 0)
+		return 0;
+
+	lineno = chunk->new_start;
+	for (i = chunk->lineno + 2; i <= pos; i++)
+		if (diff_get_line(view, i)->type != LINE_DIFF_DEL)
+			lineno++;
+
+	return lineno;
+}
+
 static enum request
-help_request(struct view *view, enum request request, struct line *line)
+diff_trace_origin(struct view *view, struct line *line)
 {
-	switch (request) {
-	case REQ_ENTER:
-		if (line->type == LINE_HELP_KEYMAP) {
-			struct keymap *keymap = line->data;
+	struct diff_state *state = view->private;
+	unsigned long pos = diff_line_index(view, line);
+	const struct diff_file *diff = diff_find_file(state, pos);
+	const struct diff_chunk *chunk = diff_find_chunk(state, pos);
+	int chunk_marker = line->type == LINE_DIFF_DEL ? '-' : '+';
+	int lineno = 0;
+	const char *file = NULL;
+	char ref[SIZEOF_REF];
+	struct blame_header header;
+	struct blame_commit commit;
+	unsigned long i;
 
-			keymap->hidden = !keymap->hidden;
-			refresh_view(view);
+	if (!diff || !chunk || chunk->lineno < diff->lineno || chunk->lineno == pos) {
+		report("The line to trace must be inside a diff chunk");
+		return REQ_NONE;
+	}
+
+	for (i = diff->lineno; i < pos && !file; i++) {
+		const char *data = diff_get_line(view, i)->data;
+
+		if (!prefixcmp(data, "--- a/")) {
+			file = data + STRING_SIZE("--- a/");
+			break;
+		}
+	}
+
+	if (i == pos || !file) {
+		report("Failed to read the file name");
+		return REQ_NONE;
+	}
+
+	lineno = chunk_marker == '+' ? chunk->new_start : chunk->old_start;
+	if (chunk->old_start < 0 || lineno < 0) {
+		report("Failed to read the line number");
+		return REQ_NONE;
+	}
+
+	if (lineno == 0) {
+		report("This is the origin of the line");
+		return REQ_NONE;
+	}
+
+	for (i = chunk->lineno + 1; i < pos; i++) {
+		enum line_type type = diff_get_line(view, i)->type;
+
+		if (type == LINE_DIFF_ADD) {
+			lineno += chunk_marker == '+';
+		} else if (type == LINE_DIFF_DEL) {
+			lineno += chunk_marker == '-';
+		} else {
+			lineno++;
 		}
+	}
+
+	if (chunk_marker == '+')
+		string_copy(ref, view->vid);
+	else
+		string_format(ref, "%s^", view->vid);
+
+	if (!diff_blame_line(ref, file, lineno, &header, &commit)) {
+		report("Failed to read blame data");
+		return REQ_NONE;
+	}
+
+	string_ncopy(opt_file, commit.filename, strlen(commit.filename));
+	string_copy(opt_ref, header.id);
+	opt_goto_line = header.orig_lineno - 1;
+
+	return REQ_VIEW_BLAME;
+}
+
+static const char *
+diff_get_pathname(struct view *view, struct line *line)
+{
+	struct diff_state *state = view->private;
+	const struct diff_file *header = diff_find_file(state, diff_line_index(view, line));
+	const char *dst = NULL;
+	const char *prefixes[] = { " b/", "cc ", "combined " };
+	const char *data;
+	int i;
+
+	if (!header)
+		return NULL;
+
+	data = diff_get_line(view, header->lineno)->data;
+	for (i = 0; i < ARRAY_SIZE(prefixes) && !dst; i++)
+		dst = strstr(data, prefixes[i]);
+
+	return dst ? dst + strlen(prefixes[--i]) : NULL;
+}
+
+static enum request
+diff_common_edit(struct view *view, enum request request, struct line *line)
+{
+	const char *file = diff_get_pathname(view, line);
+	char path[SIZEOF_STR];
+	bool has_path = file && string_format(path, "%s%s", opt_cdup, file);
 
+	if (has_path && access(path, R_OK)) {
+		report("Failed to open file: %s", file);
+		return REQ_NONE;
+	}
+
+	open_editor(file, diff_get_lineno(view, line));
+	return REQ_NONE;
+}
+
+static enum request
+diff_request(struct view *view, enum request request, struct line *line)
+{
+	struct diff_state *state = view->private;
+
+	switch (request) {
+	case REQ_VIEW_BLAME:
+		return diff_trace_origin(view, line);
+
+	case REQ_DIFF_CONTEXT_UP:
+	case REQ_DIFF_CONTEXT_DOWN:
+		if (!update_diff_context(request))
+			return REQ_NONE;
+		reload_view(view);
+		return REQ_NONE;
+
+
+	case REQ_EDIT:
+		return diff_common_edit(view, request, line);
+
+	case REQ_ENTER:
+		return diff_common_enter(view, request, line);
+
+	case REQ_REFRESH:
+		reload_view(view);
+		return REQ_NONE;
+
+	case REQ_SCROLL_LINE_DOWN:
+	case REQ_SCROLL_LINE_UP:
+	case REQ_SCROLL_PAGE_DOWN:
+	case REQ_SCROLL_PAGE_UP:
+		/* Scrolling does not always select another line. */
+		scroll_view(view, request);
+		if (state->lazy)
+			diff_lazy_load(view);
+		return REQ_NONE;
+
+	default:
+		return pager_request(view, request, line);
+	}
+}
+
+static void
+diff_select(struct view *view, struct line *line)
+{
+	struct diff_state *state = view->private;
+
+	/* Load the patches of the files brought into view. */
+	if (state->lazy)
+		diff_lazy_load(view);
+
+	if (line->type == LINE_DIFF_STAT) {
+		string_format(view->ref, "Press '%s' to jump to file diff",
+			      get_view_key(view, REQ_ENTER));
+	} else {
+		const char *file = diff_get_pathname(view, line);
+
+		if (file) {
+			string_format(view->ref, "Changes to '%s'", file);
+			string_format(opt_file, "%s", file);
+			ref_blob[0] = 0;
+		} else {
+			string_ncopy(view->ref, view->id, strlen(view->id));
+			pager_select(view, line);
+		}
+	}
+}
+
+static struct view_ops diff_ops = {
+	"line",
+	{ "diff" },
+	VIEW_DIFF_LIKE | VIEW_ADD_DESCRIBE_REF | VIEW_ADD_PAGER_REFS | VIEW_STDIN | VIEW_FILE_FILTER | VIEW_SPILL_LINES | VIEW_WRAP_LINES,
+	sizeof(struct diff_state),
+	diff_open,
+	diff_read,
+	diff_common_draw,
+	diff_request,
+	pager_grep,
+	diff_select,
+	diff_done,
+};
+
+/*
+ * Help backend
+ */
+
+static bool
+help_draw(struct view *view, struct line *line, unsigned int lineno)
+{
+	if (line->type == LINE_HELP_KEYMAP) {
+		struct keymap *keymap = line->data;
+
+		draw_formatted(view, line->type, "[%c] %s bindings",
+			       keymap->hidden ? '+' : '-', keymap->name);
+		return TRUE;
+	} else {
+		return pager_draw(view, line, lineno);
+	}
+}
+
+static bool
+help_open_keymap_title(struct view *view, struct keymap *keymap)
+{
+	add_line(view, keymap, LINE_HELP_KEYMAP, 0, FALSE);
+	return keymap->hidden;
+}
+
+static void
+help_open_keymap(struct view *view, struct keymap *keymap)
+{
+	const char *group = NULL;
+	char buf[SIZEOF_STR];
+	bool add_title = TRUE;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(req_info); i++) {
+		const char *key = NULL;
+
+		if (req_info[i].request == REQ_NONE)
+			continue;
+
+		if (!req_info[i].request) {
+			group = req_info[i].help;
+			continue;
+		}
+
+		key = get_keys(keymap, req_info[i].request, TRUE);
+		if (!key || !*key)
+			continue;
+
+		if (add_title && help_open_keymap_title(view, keymap))
+			return;
+		add_title = FALSE;
+
+		if (group) {
+			add_line_text(view, group, LINE_HELP_GROUP);
+			group = NULL;
+		}
+
+		add_line_format(view, LINE_DEFAULT, "    %-25s %-20s %s", key,
+				enum_name(req_info[i]), req_info[i].help);
+	}
+
+	group = "External commands:";
+
+	for (i = 0; i < run_requests; i++) {
+		struct run_request *req = get_run_request(REQ_NONE + i + 1);
+		const char *key;
+
+		if (!req || req->keymap != keymap)
+			continue;
+
+		key = get_key_name(req->key);
+		if (!*key)
+			key = "(no key defined)";
+
+		if (add_title && help_open_keymap_title(view, keymap))
+			return;
+		add_title = FALSE;
+
+		if (group) {
+			add_line_text(view, group, LINE_HELP_GROUP);
+			group = NULL;
+		}
+
+		if (!argv_to_string(req->argv, buf, sizeof(buf), " "))
+			return;
+
+		add_line_format(view, LINE_DEFAULT, "    %-25s `%s`", key, buf);
+	}
+}
+
+static bool
+help_open(struct view *view, enum open_flags flags)
+{
+	struct keymap *keymap;
+
+	reset_view(view);
+	add_line_text(view, "Quick reference for tig keybindings:", LINE_DEFAULT);
+	add_line_text(view, "", LINE_DEFAULT);
+
+	for (keymap = keymaps; keymap; keymap = keymap->next)
+		help_open_keymap(view, keymap);
+
+	return TRUE;
+}
+
+static enum request
+help_request(struct view *view, enum request request, struct line *line)
+{
+	switch (request) {
+	case REQ_ENTER:
+		if (line->type == LINE_HELP_KEYMAP) {
+			struct keymap *keymap = line->data;
+
+			keymap->hidden = !keymap->hidden;
+			refresh_view(view);
+		}
+
+		return REQ_NONE;
+	default:
+		return pager_request(view, request, line);
+	}
+}
+
+static void
+help_done(struct view *view)
+{
+	int i;
+
+	for (i = 0; i < view->lines; i++)
+		if (view->line[i].type == LINE_HELP_KEYMAP)
+			view->line[i].data = NULL;
+}
+
+static struct view_ops help_ops = {
+	"line",
+	{ "help" },
+	VIEW_NO_GIT_DIR,
+	0,
+	help_open,
+	NULL,
+	help_draw,
+	help_request,
+	pager_grep,
+	pager_select,
+	help_done,
+};
+
+
+/*
+ * Tree backend
+ */
+
+struct tree_stack_entry {
+	struct tree_stack_entry *prev;	/* Entry below this in the stack */
+	unsigned long lineno;		/* Line number to restore */
+	char *name;			/* Position of name in opt_path */
+};
+
+/* The top of the path stack. */
+static struct tree_stack_entry *tree_stack = NULL;
+unsigned long tree_lineno = 0;
+
+static void
+pop_tree_stack_entry(void)
+{
+	struct tree_stack_entry *entry = tree_stack;
+
+	tree_lineno = entry->lineno;
+	entry->name[0] = 0;
+	tree_stack = entry->prev;
+	free(entry);
+}
+
+static void
+push_tree_stack_entry(const char *name, unsigned long lineno)
+{
+	struct tree_stack_entry *entry = calloc(1, sizeof(*entry));
+	size_t pathlen = strlen(opt_path);
+
+	if (!entry)
+		return;
+
+	entry->prev = tree_stack;
+	entry->name = opt_path + pathlen;
+	tree_stack = entry;
+
+	if (!string_format_from(opt_path, &pathlen, "%s/", name)) {
+		pop_tree_stack_entry();
+		return;
+	}
+
+	/* Move the current line to the first tree entry. */
+	tree_lineno = 1;
+	entry->lineno = lineno;
+}
+
+#define tree_path_is_parent(path)	(!strcmp("..", (path)))
+
+struct tree_state {
+	char commit[SIZEOF_REV];
+	const struct ident *author;
+	struct time author_time;
+	struct tree_parser parser;
+	bool read_date;
+	size_t *index;			/* Line numbers of the entries hashed by
+					 * name, zero for unused slots. */
+	size_t index_size;		/* Number of slots, a power of two. */
+	size_t annotated;		/* Number of entries with a date. */
+	char cache_key[SIZEOF_STR];	/* Key of the entries in the tree cache. */
+	bool cached;			/* Whether the entries are in the cache. */
+};
+
+static const char *
+tree_path(const struct line *line)
+{
+	return ((struct tree_entry *) line->data)->name;
+}
+
+static int
+tree_compare_entry(const struct line *line1, const struct line *line2)
+{
+	if (line1->type != line2->type)
+		return line1->type == LINE_TREE_DIR ? -1 : 1;
+	return strcmp(tree_path(line1), tree_path(line2));
+}
+
+static const enum sort_field tree_sort_fields[] = {
+	ORDERBY_NAME, ORDERBY_DATE, ORDERBY_AUTHOR
+};
+static struct sort_state tree_sort_state = SORT_STATE(tree_sort_fields);
+
+static int
+tree_compare(const void *l1, const void *l2)
+{
+	const struct line *line1 = (const struct line *) l1;
+	const struct line *line2 = (const struct line *) l2;
+	const struct tree_entry *entry1 = ((const struct line *) l1)->data;
+	const struct tree_entry *entry2 = ((const struct line *) l2)->data;
+
+	if (line1->type == LINE_TREE_HEAD)
+		return -1;
+	if (line2->type == LINE_TREE_HEAD)
+		return 1;
+
+	switch (get_sort_field(tree_sort_state)) {
+	case ORDERBY_DATE:
+		return sort_order(tree_sort_state, timecmp(&entry1->time, &entry2->time));
+
+	case ORDERBY_AUTHOR:
+		return sort_order(tree_sort_state, ident_compare(entry1->author, entry2->author));
+
+	case ORDERBY_NAME:
+	default:
+		return sort_order(tree_sort_state, tree_compare_entry(line1, line2));
+	}
+}
+
+
+static struct line *
+tree_entry(struct view *view, enum line_type type, const char *path,
+	   const char *mode, const char *id, unsigned long size)
+{
+	bool custom = type == LINE_TREE_HEAD || tree_path_is_parent(path);
+	struct tree_entry *entry;
+	struct line *line = add_line_alloc(view, &entry, type, strlen(path), custom);
+
+	if (!line)
+		return NULL;
+
+	set_tree_entry(entry, path, mode, id, size);
+	return line;
+}
+
+static int
+tree_compare_name(const void *l1, const void *l2)
+{
+	return tree_compare_entry(l1, l2);
+}
+
+static size_t
+tree_hash_name(const char *name)
+{
+	size_t hash = 2166136261U;
+
+	while (*name)
+		hash = (hash ^ (unsigned char) *name++) * 16777619U;
+	return hash;
+}
+
+/* Hash the names of the entries so that the date of an entry can be
+ * looked up without scanning all lines. Must be called again when the
+ * lines are reordered. */
+static void
+tree_index_entries(struct view *view, struct tree_state *state)
+{
+	size_t size = 64;
+	size_t i;
+
+	while (size < 2 * view->lines)
+		size *= 2;
+
+	free(state->index);
+	state->index = calloc(size, sizeof(*state->index));
+	state->index_size = state->index ? size : 0;
+
+	for (i = 0; state->index && i < view->lines; i++) {
+		const char *path = tree_path(&view->line[i]);
+		size_t slot = tree_hash_name(path) & (size - 1);
+
+		/* Sorting by date may move the ".." line among the entries. */
+		if (view->line[i].type == LINE_TREE_HEAD || tree_path_is_parent(path))
+			continue;
+		while (state->index[slot])
+			slot = (slot + 1) & (size - 1);
+		state->index[slot] = i;
+	}
+}
+
+static struct line *
+tree_find_entry(struct view *view, struct tree_state *state, const char *name)
+{
+	size_t slot;
+
+	if (!state->index_size)
+		return NULL;
+
+	slot = tree_hash_name(name) & (state->index_size - 1);
+	for (; state->index[slot]; slot = (slot + 1) & (state->index_size - 1)) {
+		struct line *line = &view->line[state->index[slot]];
+
+		if (!strcmp(tree_path(line), name))
+			return line;
+	}
+
+	return NULL;
+}
+
+/* Sort the entries below the "Directory ..." and ".." lines. Names are
+ * unique within a tree, so the order does not depend on how they were
+ * listed. */
+static void
+tree_sort_entries(struct view *view, struct tree_state *state)
+{
+	size_t first = view->custom_lines;
+	size_t i;
+
+	if (view->lines <= first)
+		return;
+
+	qsort(view->line + first, view->lines - first, sizeof(*view->line), tree_compare_name);
+	for (i = first; i < view->lines; i++) {
+		view->line[i].lineno = i + 1 - first;
+		view->line[i].dirty = view->line[i].cleareol = 1;
+	}
+	refilter_view(view);
+	tree_index_entries(view, state);
+}
+
+/* Read the date and author of the last commit of each entry. */
+static bool
+tree_read_dates(struct view *view, struct tree_state *state, enum open_flags flags)
+{
+	const char *log_file[] = {
+		"git", "log", opt_encoding_arg, "--no-color", "--pretty=raw",
+			"--cc", "--raw", view->id, "--", "%(directory)", NULL
+	};
+
+	if (!begin_update(view, opt_cdup, log_file, flags))
+		return FALSE;
+
+	state->read_date = TRUE;
+	return TRUE;
+}
+
+/* Select the first entry of a directory being entered or the entry a
+ * parent directory was left at. */
+static void
+tree_restore_lineno(struct view *view)
+{
+	if (tree_lineno <= view->pos.lineno)
+		tree_lineno = view->custom_lines;
+
+	if (tree_lineno > view->pos.lineno) {
+		view->pos.lineno = tree_lineno;
+		tree_lineno = 0;
+	}
+}
+
+/*
+ * Tree cache and prefetching
+ *
+ * The entries of visited directories are kept in memory together with
+ * their dates, so that going back to a directory does not run
+ * git-ls-tree(1) and git-log(1) again. While the view is idle, the
+ * entries of the selected directory are listed in the background, so
+ * that entering it only has to read the dates.
+ */
+
+struct tree_cache_line {
+	enum line_type type;
+	struct tree_entry *entry;
+};
+
+struct tree_cache {
+	char key[SIZEOF_STR];
+	struct tree_cache_line *lines;
+	size_t lines_size;
+	int size_width;
+	bool dates;			/* Whether the dates have been read. */
+	unsigned long used;		/* When the entry was last used. */
+};
+
+static struct tree_cache *tree_cache;
+static size_t tree_cache_size;
+static unsigned long tree_cache_clock;
+
+DEFINE_ALLOCATOR(realloc_tree_cache, struct tree_cache, 8)
+DEFINE_ALLOCATOR(realloc_tree_cache_lines, struct tree_cache_line, 256)
+
+/* Only the trees of commit IDs are kept, since the commit a ref points
+ * to may change. The commit is used instead of the tree ID, because the
+ * dates depend on the history leading to it. */
+static bool
+tree_cache_key(const char *commit, const char *path, char key[SIZEOF_STR])
+{
+	if (!opt_tree_cache ||
+	    strlen(commit) != SIZEOF_REV - 1 || strspn(commit, "0123456789abcdef") != SIZEOF_REV - 1 ||
+	    !string_format_size(key, SIZEOF_STR, "%s:%s", commit, path)) {
+		key[0] = 0;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void
+tree_cache_free_lines(struct tree_cache_line *lines, size_t lines_size)
+{
+	size_t i;
+
+	for (i = 0; i < lines_size; i++)
+		free(lines[i].entry);
+	free(lines);
+}
+
+static struct tree_cache *
+tree_cache_find(const char *key)
+{
+	size_t i;
+
+	for (i = 0; i < tree_cache_size; i++)
+		if (!strcmp(tree_cache[i].key, key))
+			return &tree_cache[i];
+	return NULL;
+}
+
+static void
+tree_cache_remove(struct tree_cache *entry)
+{
+	tree_cache_free_lines(entry->lines, entry->lines_size);
+	*entry = tree_cache[--tree_cache_size];
+}
+
+/* Add the entries of a directory, taking over the lines. The least
+ * recently used directory is dropped when the cache is full. */
+static void
+tree_cache_add(const char *key, struct tree_cache_line *lines, size_t lines_size,
+	       int size_width, bool dates)
+{
+	struct tree_cache *entry = tree_cache_find(key);
+
+	if (entry)
+		tree_cache_remove(entry);
+
+	while (tree_cache_size && tree_cache_size >= opt_tree_cache) {
+		struct tree_cache *oldest = &tree_cache[0];
+		size_t i;
+
+		for (i = 1; i < tree_cache_size; i++)
+			if (tree_cache[i].used < oldest->used)
+				oldest = &tree_cache[i];
+		tree_cache_remove(oldest);
+	}
+
+	if (!opt_tree_cache || !realloc_tree_cache(&tree_cache, tree_cache_size, 1)) {
+		tree_cache_free_lines(lines, lines_size);
+		return;
+	}
+
+	entry = &tree_cache[tree_cache_size++];
+	string_ncopy(entry->key, key, strlen(key));
+	entry->lines = lines;
+	entry->lines_size = lines_size;
+	entry->size_width = size_width;
+	entry->dates = dates;
+	entry->used = ++tree_cache_clock;
+}
+
+static void
+tree_store_cache(struct view *view, struct tree_state *state, bool dates)
+{
+	struct tree_cache_line *lines = NULL;
+	size_t lines_size = 0;
+	size_t i;
+
+	if (!*state->cache_key)
+		return;
+
+	for (i = 0; i < view->lines; i++) {
+		struct line *line = &view->line[i];
+		struct tree_entry *entry = line->data;
+		size_t entry_size = sizeof(*entry) + strlen(entry->name);
+
+		if (line->type == LINE_TREE_HEAD || tree_path_is_parent(entry->name))
+			continue;
+
+		if (!realloc_tree_cache_lines(&lines, lines_size, 1) ||
+		    !(lines[lines_size].entry = malloc(entry_size))) {
+			tree_cache_free_lines(lines, lines_size);
+			return;
+		}
+
+		memcpy(lines[lines_size].entry, entry, entry_size);
+		/* Sizes being asked for are asked for again when restored. */
+		lines[lines_size].entry->size_wanted = entry->size_known;
+		lines[lines_size++].type = line->type;
+	}
+
+	if (lines_size) {
+		tree_cache_add(state->cache_key, lines, lines_size, state->parser.size_width, dates);
+		state->cached = TRUE;
+	} else {
+		free(lines);
+	}
+}
+
+/* Show the cached entries of a directory. When their dates have not
+ * been read, they are read like after listing the entries. */
+static bool
+tree_restore_cache(struct view *view, enum open_flags flags, const char *key)
+{
+	struct tree_state *state = view->private;
+	struct tree_cache *cache = tree_cache_find(key);
+	size_t i;
+
+	if (!cache || (flags & OPEN_REFRESH) ||
+	    (!(flags & (OPEN_RELOAD | OPEN_PREPARED)) && !strcmp(view->vid, view->id)))
+		return FALSE;
+
+	if (cache->dates) {
+		reset_view(view);
+		string_ncopy(view->vid, view->id, strlen(view->id));
+		string_copy_rev(view->ref, view->id);
+	} else if (!tree_read_dates(view, state, flags)) {
+		return FALSE;
+	}
+
+	cache->used = ++tree_cache_clock;
+	string_ncopy(state->cache_key, key, strlen(key));
+	state->cached = TRUE;
+	state->parser.size_width = cache->size_width;
+
+	if (!tree_entry(view, LINE_TREE_HEAD, opt_path, NULL, NULL, 0) ||
+	    (*opt_path && !tree_entry(view, LINE_TREE_DIR, "..", "040000", view->ref, 0))) {
+		report("Allocation failure");
+		return TRUE;
+	}
+
+	for (i = 0; i < cache->lines_size; i++) {
+		struct tree_entry *entry = cache->lines[i].entry;
+		struct line *line = tree_entry(view, cache->lines[i].type, entry->name, NULL, NULL, 0);
+
+		if (!line) {
+			report("Allocation failure");
+			break;
+		}
+		memcpy(line->data, entry, sizeof(*entry) + strlen(entry->name));
+	}
+
+	tree_sort_entries(view, state);
+
+	/* The entries are all there, so select the line right away
+	 * instead of when reading the first entry. */
+	view->pos.lineno = tree_lineno;
+	tree_restore_lineno(view);
+	goto_view_line(view, 0, view->pos.lineno);
+	return TRUE;
+}
+
+struct tree_prefetch {
+	char key[SIZEOF_STR];		/* Key of the entries in the tree cache. */
+	char commit[SIZEOF_REV];
+	char path[SIZEOF_STR];		/* Directory with a trailing slash. */
+	unsigned long long wanted;	/* When the directory was selected. */
+	struct io io;
+	bool running;
+	bool failed;
+	struct tree_cache_line *lines;
+	size_t lines_size;
+	struct tree_parser parser;
+};
+
+static struct tree_prefetch tree_prefetch;
+
+/* Time the selection must stay on a directory before it is listed. */
+#define TREE_PREFETCH_DELAY	300000
+
+static void
+tree_prefetch_reset(struct tree_prefetch *prefetch)
+{
+	if (prefetch->running) {
+		io_kill(&prefetch->io);
+		io_done(&prefetch->io);
+	}
+	tree_cache_free_lines(prefetch->lines, prefetch->lines_size);
+	memset(prefetch, 0, sizeof(*prefetch));
+}
+
+/* Keep the key so the directory is not listed again. */
+static void
+tree_prefetch_abandon(struct tree_prefetch *prefetch)
+{
+	char key[SIZEOF_STR];
+
+	string_copy(key, prefetch->key);
+	tree_prefetch_reset(prefetch);
+	string_copy(prefetch->key, key);
+	prefetch->failed = TRUE;
+}
+
+static void
+tree_prefetch_dir(struct view *view, const char *name)
+{
+	struct tree_prefetch *prefetch = &tree_prefetch;
+	char path[SIZEOF_STR];
+	char key[SIZEOF_STR];
+
+	if (!opt_tree_prefetch ||
+	    !string_format(path, "%s%s/", opt_path, name) ||
+	    !tree_cache_key(view->vid, path, key) ||
+	    !strcmp(key, prefetch->key) || tree_cache_find(key))
+		return;
+
+	tree_prefetch_reset(prefetch);
+	string_copy(prefetch->key, key);
+	string_copy_rev(prefetch->commit, view->vid);
+	string_copy(prefetch->path, path);
+	prefetch->parser.path = prefetch->path;
+	prefetch->wanted = view_stats_clock();
+}
+
+static bool
+tree_prefetch_read(struct tree_prefetch *prefetch, char *text)
+{
+	struct tree_entry *entry;
+	enum line_type type;
+	size_t size;
+	char *path = parse_tree_entry(&prefetch->parser, text, &type, &size);
+
+	if (!path || !realloc_tree_cache_lines(&prefetch->lines, prefetch->lines_size, 1))
+		return FALSE;
+
+	entry = calloc(1, sizeof(*entry) + strlen(path));
+	if (!entry)
+		return FALSE;
+
+	set_tree_entry(entry, path, text, text + TREE_ID_OFFSET, size);
+	prefetch->lines[prefetch->lines_size].type = type;
+	prefetch->lines[prefetch->lines_size++].entry = entry;
+	return TRUE;
+}
+
+/* Start or continue listing the selected directory. Returns TRUE while
+ * there is more to do. */
+static bool
+tree_prefetch_update(void)
+{
+	struct tree_prefetch *prefetch = &tree_prefetch;
+	struct view *view = VIEW(REQ_VIEW_TREE);
+	struct encoding *encoding = view->encoding ? view->encoding : opt_encoding;
+	const char *ls_tree_argv[] = {
+		"git", "ls-tree", prefetch->commit, prefetch->path, NULL
+	};
+	bool can_read;
+	char *line;
+
+	if (!*prefetch->key || prefetch->failed)
+		return FALSE;
+
+	if (!prefetch->running) {
+		if (view->pipe || view_stats_clock() - prefetch->wanted < TREE_PREFETCH_DELAY)
+			return TRUE;
+		prefetch->running = io_run(&prefetch->io, IO_RD, opt_cdup, opt_env, ls_tree_argv);
+		prefetch->failed = !prefetch->running;
+		return prefetch->running;
+	}
+
+	for (can_read = io_can_read(&prefetch->io, FALSE);
+	     (line = io_get(&prefetch->io, '\n', can_read));
+	     can_read = FALSE) {
+		if (encoding)
+			line = encoding_convert(encoding, line);
+		if (!tree_prefetch_read(prefetch, line))
+			break;
+	}
+
+	if (line || io_error(&prefetch->io)) {
+		tree_prefetch_abandon(prefetch);
+
+	} else if (io_eof(&prefetch->io)) {
+		prefetch->running = FALSE;
+		/* The directory may have been entered while it was listed. */
+		if (io_done(&prefetch->io) && prefetch->lines_size &&
+		    !tree_cache_find(prefetch->key)) {
+			tree_cache_add(prefetch->key, prefetch->lines, prefetch->lines_size,
+				       prefetch->parser.size_width, FALSE);
+			memset(prefetch, 0, sizeof(*prefetch));
+		} else {
+			tree_prefetch_abandon(prefetch);
+		}
+	}
+
+	return prefetch->running;
+}
+
+/*
+ * Tree entry sizes
+ *
+ * Directories are listed without the sizes of their files, since that
+ * makes git-ls-tree(1) look up every blob. Instead, the sizes of the
+ * files being drawn are asked for from a git-cat-file(1) process kept
+ * running in the background and shown as they are answered.
+ */
+
+struct tree_sizes {
+	struct io io;
+	bool running;
+	bool failed;
+	struct tree_entry **pending;	/* Entries asked for, in order. */
+	size_t pending_size;
+	size_t pending_pos;		/* Entry of the next answer. */
+};
+
+static struct tree_sizes tree_sizes;
+
+DEFINE_ALLOCATOR(realloc_tree_sizes_pending, struct tree_entry *, 256)
+
+/* Limit on unanswered sizes, so that neither side blocks on a full pipe. */
+#define TREE_SIZES_PENDING	512
+
+static void
+tree_sizes_fail(struct tree_sizes *sizes)
+{
+	if (sizes->running) {
+		io_kill(&sizes->io);
+		io_done(&sizes->io);
+	}
+	free(sizes->pending);
+	memset(sizes, 0, sizeof(*sizes));
+	sizes->failed = TRUE;
+}
+
+static void
+tree_ask_size(struct tree_entry *entry)
+{
+	struct tree_sizes *sizes = &tree_sizes;
+	const char *batch_check_argv[] = {
+		"git", "cat-file", "--batch-check", NULL
+	};
+
+	if (entry->size_known || entry->size_wanted || sizes->failed ||
+	    sizes->pending_size - sizes->pending_pos >= TREE_SIZES_PENDING)
+		return;
+
+	if (!sizes->running &&
+	    !(sizes->running = io_run(&sizes->io, IO_RD_WR, opt_cdup, opt_env, batch_check_argv))) {
+		tree_sizes_fail(sizes);
+		return;
+	}
+
+	/* Drop the answered entries now and then. */
+	if (sizes->pending_pos >= TREE_SIZES_PENDING) {
+		sizes->pending_size -= sizes->pending_pos;
+		memmove(sizes->pending, sizes->pending + sizes->pending_pos,
+			sizes->pending_size * sizeof(*sizes->pending));
+		sizes->pending_pos = 0;
+	}
+
+	if (!realloc_tree_sizes_pending(&sizes->pending, sizes->pending_size, 1) ||
+	    !io_printf(&sizes->io, "%s\n", entry->id)) {
+		tree_sizes_fail(sizes);
+		return;
+	}
+
+	sizes->pending[sizes->pending_size++] = entry;
+	entry->size_wanted = 1;
+}
+
+/* The entries of a view being reset are still answered, but the
+ * answers are ignored. */
+static void
+tree_forget_sizes(void)
+{
+	struct tree_sizes *sizes = &tree_sizes;
+	size_t i;
+
+	for (i = sizes->pending_pos; i < sizes->pending_size; i++)
+		sizes->pending[i] = NULL;
+}
+
+/* Read the sizes that have been answered. Returns TRUE while there are
+ * sizes to wait for. */
+static bool
+tree_sizes_update(void)
+{
+	struct tree_sizes *sizes = &tree_sizes;
+	struct view *view = VIEW(REQ_VIEW_TREE);
+	struct tree_state *state = view->private;
+	bool updated = FALSE;
+	bool can_read;
+
+	if (!sizes->running || sizes->pending_pos == sizes->pending_size)
+		return FALSE;
+
+	can_read = io_can_read(&sizes->io, FALSE);
+	while (sizes->pending_pos < sizes->pending_size) {
+		struct tree_entry *entry = sizes->pending[sizes->pending_pos];
+		char *line = io_get(&sizes->io, '\n', can_read);
+		char *size;
+
+		if (!line)
+			break;
+		can_read = FALSE;
+		sizes->pending_pos++;
+		if (!entry)
+			continue;
+
+		if (strncmp(line, entry->id, SIZEOF_REV - 1)) {
+			tree_sizes_fail(sizes);
+			return FALSE;
+		}
+
+		/* Submodule commits are reported missing and get no size. */
+		size = strrchr(line, ' ');
+		entry->size = size && isdigit(size[1]) ? strtoul(size + 1, NULL, 10) : 0;
+		entry->size_known = 1;
+		updated = TRUE;
+
+		if (state)
+			state->parser.size_width = MAX(state->parser.size_width,
+						MAX(1, count_digits(entry->size)));
+	}
+
+	if (io_error(&sizes->io) || io_eof(&sizes->io)) {
+		tree_sizes_fail(sizes);
+		return FALSE;
+	}
+
+	/* The answered lines are not known, so all shown lines are drawn. */
+	if (updated && view_is_displayed(view)) {
+		view->force_redraw = TRUE;
+		view->redraw_pending = TRUE;
+	}
+
+	return sizes->pending_pos < sizes->pending_size;
+}
+
+static bool
+tree_read_date(struct view *view, char *text, struct tree_state *state)
+{
+	if (!text && state->read_date) {
+		state->read_date = FALSE;
+		/* The dates are incomplete when the view is closed before
+		 * all entries have one and the log has been read. */
+		if (io_eof(view->pipe) ||
+		    state->annotated == view->lines - view->custom_lines)
+			tree_store_cache(view, state, TRUE);
+		else if (!state->cached)
+			tree_store_cache(view, state, FALSE);
+		return TRUE;
+
+	} else if (!text) {
+		/* The listing was interrupted, so there is nothing to date. */
+		if (!io_eof(view->pipe))
+			return TRUE;
+
+		if (!view->lines) {
+			tree_entry(view, LINE_TREE_HEAD, opt_path, NULL, NULL, 0);
+			tree_entry(view, LINE_TREE_DIR, "..", "040000", view->ref, 0);
+			report("Tree is empty");
+			return TRUE;
+		}
+
+		tree_sort_entries(view, state);
+
+		if (!tree_read_dates(view, state, OPEN_EXTRA)) {
+			report("Failed to load tree data");
+			return TRUE;
+		}
+
+		return FALSE;
+
+	} else if (*text == 'c' && get_line_type(text) == LINE_COMMIT) {
+		string_copy_rev_from_commit_line(state->commit, text);
+
+	} else if (*text == 'a' && get_line_type(text) == LINE_AUTHOR) {
+		parse_author_line(text + STRING_SIZE("author "),
+				  &state->author, &state->author_time);
+
+	} else if (*text == ':') {
+		struct line *line;
+		struct tree_entry *entry;
+		char *pos;
+
+		pos = strchr(text, '\t');
+		if (!pos)
+			return TRUE;
+		text = pos + 1;
+		if (*opt_path && !strncmp(text, opt_path, strlen(opt_path)))
+			text += strlen(opt_path);
+		pos = strchr(text, '/');
+		if (pos)
+			*pos = 0;
+
+		line = tree_find_entry(view, state, text);
+		entry = line ? line->data : NULL;
+		if (!entry || entry->author)
+			return TRUE;
+
+		string_copy_rev(entry->commit, state->commit);
+		entry->author = state->author;
+		entry->time = state->author_time;
+		line->dirty = 1;
+
+		/* Stop once all entries below the custom lines have a date. */
+		if (++state->annotated == view->lines - view->custom_lines)
+			io_kill(view->pipe);
+	}
+	return TRUE;
+}
+
+static bool
+tree_read(struct view *view, char *text)
+{
+	struct tree_state *state = view->private;
+	enum line_type type;
+	char *path;
+	size_t size;
+
+	if (state->read_date || !text)
+		return tree_read_date(view, text, state);
+
+	path = parse_tree_entry(&state->parser, text, &type, &size);
+	if (!path)
+		return FALSE;
+	if (view->lines == 0 &&
+	    !tree_entry(view, LINE_TREE_HEAD, opt_path, NULL, NULL, 0))
+		return FALSE;
+
+	/* Insert "link" to parent directory. */
+	if (*opt_path && view->lines == 1 &&
+	    !tree_entry(view, LINE_TREE_DIR, "..", "040000", view->ref, 0))
+		return FALSE;
+
+	/* Entries are sorted once all have been read. */
+	if (!tree_entry(view, type, path, text, text + TREE_ID_OFFSET, size))
+		return FALSE;
+
+	tree_restore_lineno(view);
+	return TRUE;
+}
+
+static bool
+tree_draw(struct view *view, struct line *line, unsigned int lineno)
+{
+	struct tree_state *state = view->private;
+	struct tree_entry *entry = line->data;
+
+	if (line->type == LINE_TREE_HEAD) {
+		if (draw_text(view, line->type, "Directory path /"))
+			return TRUE;
+	} else {
+		if (line->type == LINE_TREE_FILE && opt_file_size != FILE_SIZE_NO)
+			tree_ask_size(entry);
+
+		if (draw_mode(view, entry->mode))
+			return TRUE;
+
+		if (draw_author(view, entry->author))
+			return TRUE;
+
+		if (draw_file_size(view, entry->size, state->parser.size_width,
+				   line->type != LINE_TREE_FILE || !entry->size_known))
+			return TRUE;
+
+		if (draw_date(view, &entry->time))
+			return TRUE;
+
+		if (draw_id(view, entry->commit))
+			return TRUE;
+	}
+
+	draw_text(view, line->type, entry->name);
+	return TRUE;
+}
+
+static void
+open_blob_editor(const char *id, const char *name, unsigned int lineno)
+{
+	const char *blob_argv[] = { "git", "cat-file", "blob", id, NULL };
+	char file[SIZEOF_STR];
+	int fd;
+
+	if (!name)
+		name = "unknown";
+
+	if (!string_format(file, "%s/tigblob.XXXXXX.%s", get_temp_dir(), name)) {
+		report("Temporary file name is too long");
+		return;
+	}
+
+	fd = mkstemps(file, strlen(name) + 1);
+
+	if (fd == -1)
+		report("Failed to create temporary file");
+	else if (!io_run_append(blob_argv, fd))
+		report("Failed to save blob data to file");
+	else
+		open_editor(file, lineno);
+	if (fd != -1)
+		unlink(file);
+}
+
+static enum request
+tree_request(struct view *view, enum request request, struct line *line)
+{
+	enum open_flags flags;
+	struct tree_entry *entry = line->data;
+
+	switch (request) {
+	case REQ_VIEW_BLAME:
+		if (line->type != LINE_TREE_FILE) {
+			report("Blame only supported for files");
+			return REQ_NONE;
+		}
+
+		string_copy(opt_ref, view->vid);
+		return request;
+
+	case REQ_EDIT:
+		if (line->type != LINE_TREE_FILE) {
+			report("Edit only supported for files");
+		} else if (!is_head_commit(view->vid)) {
+			open_blob_editor(entry->id, entry->name, 0);
+		} else {
+			open_editor(opt_file, 0);
+		}
+		return REQ_NONE;
+
+	case REQ_TOGGLE_SORT_FIELD:
+	case REQ_TOGGLE_SORT_ORDER:
+		sort_view(view, request, &tree_sort_state, tree_compare);
+		tree_index_entries(view, view->private);
+		return REQ_NONE;
+
+	case REQ_PARENT:
+		if (!*opt_path) {
+			/* quit view if at top of tree */
+			return REQ_VIEW_CLOSE;
+		}
+		/* fake 'cd  ..' */
+		line = &view->line[1];
+		break;
+
+	case REQ_ENTER:
+		break;
+
+	default:
+		return request;
+	}
+
+	/* Cleanup the stack if the tree view is at a different tree. */
+	while (!*opt_path && tree_stack)
+		pop_tree_stack_entry();
+
+	switch (line->type) {
+	case LINE_TREE_DIR:
+		/* Depending on whether it is a subdirectory or parent link
+		 * mangle the path buffer. */
+		if (line == &view->line[1] && *opt_path) {
+			pop_tree_stack_entry();
+
+		} else {
+			const char *basename = tree_path(line);
+
+			push_tree_stack_entry(basename, view->pos.lineno);
+		}
+
+		/* Trees and subtrees share the same ID, so they are not not
+		 * unique like blobs. */
+		flags = OPEN_RELOAD;
+		request = REQ_VIEW_TREE;
+		break;
+
+	case LINE_TREE_FILE:
+		flags = view_is_displayed(view) ? OPEN_SPLIT : OPEN_DEFAULT;
+		request = REQ_VIEW_BLOB;
+		break;
+
+	default:
+		return REQ_NONE;
+	}
+
+	open_view(view, request, flags);
+	/* Cached entries have already been positioned. */
+	if (request == REQ_VIEW_TREE && !view->lines)
+		view->pos.lineno = tree_lineno;
+
+	return REQ_NONE;
+}
+
+static bool
+tree_grep(struct view *view, struct line *line)
+{
+	struct tree_entry *entry = line->data;
+	const char *text[] = {
+		entry->name,
+		mkauthor(entry->author, opt_author_width, opt_author),
+		mkdate(&entry->time, opt_date),
+		NULL
+	};
+
+	return grep_text(view, text);
+}
+
+static void
+tree_select(struct view *view, struct line *line)
+{
+	struct tree_entry *entry = line->data;
+
+	if (line->type == LINE_TREE_HEAD) {
+		string_format(view->ref, "Files in /%s", opt_path);
+		return;
+	}
+
+	if (line->type == LINE_TREE_DIR && tree_path_is_parent(entry->name)) {
+		string_copy(view->ref, "Open parent directory");
+		ref_blob[0] = 0;
+		return;
+	}
+
+	if (line->type == LINE_TREE_FILE) {
+		string_copy_rev(ref_blob, entry->id);
+		string_format(opt_file, "%s%s", opt_path, tree_path(line));
+	} else {
+		tree_prefetch_dir(view, entry->name);
+	}
+
+	string_copy_rev(view->ref, entry->id);
+}
+
+static void
+tree_done(struct view *view)
+{
+	struct tree_state *state = view->private;
+
+	tree_forget_sizes();
+	free(state->index);
+}
+
+static bool
+tree_open(struct view *view, enum open_flags flags)
+{
+	static const char *tree_argv[] = {
+		"git", "ls-tree", "%(commit)", "%(directory)", NULL
+	};
+	struct tree_state *state = view->private;
+	char key[SIZEOF_STR];
+
+	if (string_rev_is_null(ref_commit)) {
+		report("No tree exists for this commit");
+		return FALSE;
+	}
+
+	if (view->lines == 0 && opt_prefix[0]) {
+		char *pos = opt_prefix;
+
+		while (pos && *pos) {
+			char *end = strchr(pos, '/');
+
+			if (end)
+				*end = 0;
+			push_tree_stack_entry(pos, 0);
+			pos = end;
+			if (end) {
+				*end = '/';
+				pos++;
+			}
+		}
+
+	} else if (strcmp(view->vid, view->id)) {
+		opt_path[0] = 0;
+	}
+
+	if (tree_cache_key(view->id, opt_path, key) &&
+	    tree_restore_cache(view, flags, key))
+		return TRUE;
+
+	if (!begin_update(view, opt_cdup, tree_argv, flags))
+		return FALSE;
+
+	state->parser.path = opt_path;
+	string_copy(state->cache_key, key);
+	return TRUE;
+}
+
+static struct view_ops tree_ops = {
+	"file",
+	{ "tree" },
+	VIEW_SEND_CHILD_ENTER,
+	sizeof(struct tree_state),
+	tree_open,
+	tree_read,
+	tree_draw,
+	tree_request,
+	tree_grep,
+	tree_select,
+	tree_done,
+};
+
+static bool
+blob_open(struct view *view, enum open_flags flags)
+{
+	static const char *blob_argv[] = {
+		"git", "cat-file", "blob", "%(blob)", NULL
+	};
+
+	if (!ref_blob[0] && opt_file[0]) {
+		const char *commit = ref_commit[0] ? ref_commit : "HEAD";
+		char blob_spec[SIZEOF_STR];
+		const char *rev_parse_argv[] = {
+			"git", "rev-parse", blob_spec, NULL
+		};
+
+		if (!string_format(blob_spec, "%s:%s", commit, opt_file) ||
+		    !io_run_buf(rev_parse_argv, ref_blob, sizeof(ref_blob))) {
+			report("Failed to resolve blob from file name");
+			return FALSE;
+		}
+	}
+
+	if (!ref_blob[0]) {
+		report("No file chosen, press %s to open tree view",
+			get_view_key(view, REQ_VIEW_TREE));
+		return FALSE;
+	}
+
+	view->encoding = get_path_encoding(opt_file, opt_encoding);
+
+	return begin_update(view, NULL, blob_argv, flags);
+}
+
+static bool
+blob_read(struct view *view, char *line)
+{
+	if (!line)
+		return TRUE;
+	return add_line_text(view, line, LINE_DEFAULT) != NULL;
+}
+
+static enum request
+blob_request(struct view *view, enum request request, struct line *line)
+{
+	switch (request) {
+	case REQ_EDIT:
+		open_blob_editor(view->vid, NULL, (line - view->line) + 1);
 		return REQ_NONE;
 	default:
 		return pager_request(view, request, line);
 	}
 }
 
-static void
-help_done(struct view *view)
-{
-	int i;
-
-	for (i = 0; i < view->lines; i++)
-		if (view->line[i].type == LINE_HELP_KEYMAP)
-			view->line[i].data = NULL;
-}
-
-static struct view_ops help_ops = {
+static struct view_ops blob_ops = {
 	"line",
-	{ "help" },
-	VIEW_NO_GIT_DIR,
+	{ "blob" },
+	VIEW_SPILL_LINES,
 	0,
-	help_open,
-	NULL,
-	help_draw,
-	help_request,
+	blob_open,
+	blob_read,
+	pager_draw,
+	blob_request,
 	pager_grep,
 	pager_select,
-	help_done,
 };
 
-
 /*
- * Tree backend
+ * Blame backend
+ *
+ * Loading the blame view is a two phase job:
+ *
+ *  1. File content is read either using opt_file from the
+ *     filesystem or using git-cat-file.
+ *  2. Then blame information is incrementally added by
+ *     reading output from git-blame.
  */
 
-struct tree_stack_entry {
-	struct tree_stack_entry *prev;	/* Entry below this in the stack */
-	unsigned long lineno;		/* Line number to restore */
-	char *name;			/* Position of name in opt_path */
+struct blame {
+	struct blame_commit *commit;
+	unsigned long lineno;
+	char text[1];
 };
 
-/* The top of the path stack. */
-static struct tree_stack_entry *tree_stack = NULL;
-unsigned long tree_lineno = 0;
+struct blame_state {
+	struct blame_commit *commit;
+	struct blame_commits commits;
+	int blamed;
+	bool done_reading;
+	bool auto_filename_display;
+	bool ranged;			/* Blame the shown lines first. */
+	bool shown_range;		/* Blaming the lines around the shown ones. */
+	size_t range_from, range_to;	/* Lines of the shown range. */
+	int range_blamed;		/* Lines blamed when the range was started. */
+	unsigned long long moved;	/* When the view was last moved, zero
+					 * once the shown lines are checked. */
+	char cache_key[SIZEOF_STR];	/* Key of the blame in the blame cache. */
+	char history_key[SIZEOF_STR];	/* Key of the blame in the blame history. */
+};
 
-static void
-pop_tree_stack_entry(void)
-{
-	struct tree_stack_entry *entry = tree_stack;
+/* Blames moved away from with the parent and blame requests. */
+struct blame_position {
+	char ref[SIZEOF_REF];
+	char file[SIZEOF_STR];
+	unsigned long lineno;
+};
 
-	tree_lineno = entry->lineno;
-	entry->name[0] = 0;
-	tree_stack = entry->prev;
-	free(entry);
-}
+static struct blame_position *blame_positions;
+static size_t blame_positions_size;
+
+DEFINE_ALLOCATOR(realloc_blame_positions, struct blame_position, 16)
 
 static void
-push_tree_stack_entry(const char *name, unsigned long lineno)
+blame_push_position(struct view *view)
 {
-	struct tree_stack_entry *entry = calloc(1, sizeof(*entry));
-	size_t pathlen = strlen(opt_path);
+	struct blame_position *position;
 
-	if (!entry)
-		return;
-
-	entry->prev = tree_stack;
-	entry->name = opt_path + pathlen;
-	tree_stack = entry;
-
-	if (!string_format_from(opt_path, &pathlen, "%s/", name)) {
-		pop_tree_stack_entry();
+	if (!realloc_blame_positions(&blame_positions, blame_positions_size, 1))
 		return;
-	}
 
-	/* Move the current line to the first tree entry. */
-	tree_lineno = 1;
-	entry->lineno = lineno;
+	position = &blame_positions[blame_positions_size++];
+	string_copy(position->ref, opt_ref);
+	string_copy(position->file, opt_file);
+	position->lineno = view->pos.lineno;
 }
 
-/* Parse output from git-ls-tree(1):
- *
- * 100644 blob 95925677ca47beb0b8cce7c0e0011bcc3f61470f  213045	tig.c
- */
-
-#define SIZEOF_TREE_ATTR \
-	STRING_SIZE("100644 blob f931e1d229c3e185caad4449bf5b66ed72462657\t")
-
-#define SIZEOF_TREE_MODE \
-	STRING_SIZE("100644 ")
-
-#define TREE_ID_OFFSET \
-	STRING_SIZE("100644 blob ")
-
-#define tree_path_is_parent(path)	(!strcmp("..", (path)))
-
-struct tree_entry {
-	char id[SIZEOF_REV];
-	char commit[SIZEOF_REV];
-	mode_t mode;
-	struct time time;		/* Date from the author ident. */
-	const struct ident *author;	/* Author of the commit. */
-	unsigned long size;
-	char name[1];
-};
-
-struct tree_state {
-	char commit[SIZEOF_REV];
-	const struct ident *author;
-	struct time author_time;
-	int size_width;
-	bool read_date;
-};
-
-static const char *
-tree_path(const struct line *line)
+static void
+blame_go_back(struct view *view)
 {
-	return ((struct tree_entry *) line->data)->name;
-}
+	struct blame_position *position;
 
-static int
-tree_compare_entry(const struct line *line1, const struct line *line2)
-{
-	if (line1->type != line2->type)
-		return line1->type == LINE_TREE_DIR ? -1 : 1;
-	return strcmp(tree_path(line1), tree_path(line2));
-}
+	if (!blame_positions_size) {
+		report("There is no previous blame to go back to");
+		return;
+	}
 
-static const enum sort_field tree_sort_fields[] = {
-	ORDERBY_NAME, ORDERBY_DATE, ORDERBY_AUTHOR
-};
-static struct sort_state tree_sort_state = SORT_STATE(tree_sort_fields);
+	position = &blame_positions[--blame_positions_size];
+	string_copy(opt_ref, position->ref);
+	string_copy(opt_file, position->file);
+	view->pos.lineno = position->lineno;
+	opt_goto_line = position->lineno;
+	reload_view(view);
+}
 
-static int
-tree_compare(const void *l1, const void *l2)
+static bool
+blame_detect_filename_display(struct view *view)
 {
-	const struct line *line1 = (const struct line *) l1;
-	const struct line *line2 = (const struct line *) l2;
-	const struct tree_entry *entry1 = ((const struct line *) l1)->data;
-	const struct tree_entry *entry2 = ((const struct line *) l2)->data;
-
-	if (line1->type == LINE_TREE_HEAD)
-		return -1;
-	if (line2->type == LINE_TREE_HEAD)
-		return 1;
-
-	switch (get_sort_field(tree_sort_state)) {
-	case ORDERBY_DATE:
-		return sort_order(tree_sort_state, timecmp(&entry1->time, &entry2->time));
+	bool show_filenames = FALSE;
+	const char *filename = NULL;
+	int i;
 
-	case ORDERBY_AUTHOR:
-		return sort_order(tree_sort_state, ident_compare(entry1->author, entry2->author));
+	if (opt_blame_argv) {
+		for (i = 0; opt_blame_argv[i]; i++) {
+			if (prefixcmp(opt_blame_argv[i], "-C"))
+				continue;
 
-	case ORDERBY_NAME:
-	default:
-		return sort_order(tree_sort_state, tree_compare_entry(line1, line2));
+			show_filenames = TRUE;
+		}
 	}
-}
-
-
-static struct line *
-tree_entry(struct view *view, enum line_type type, const char *path,
-	   const char *mode, const char *id, unsigned long size)
-{
-	bool custom = type == LINE_TREE_HEAD || tree_path_is_parent(path);
-	struct tree_entry *entry;
-	struct line *line = add_line_alloc(view, &entry, type, strlen(path), custom);
 
-	if (!line)
-		return NULL;
+	for (i = 0; i < view->lines; i++) {
+		struct blame *blame = view->line[i].data;
 
-	strncpy(entry->name, path, strlen(path));
-	if (mode)
-		entry->mode = strtoul(mode, NULL, 8);
-	if (id)
-		string_copy_rev(entry->id, id);
-	entry->size = size;
+		if (blame->commit && blame->commit->id[0]) {
+			if (!filename)
+				filename = blame->commit->filename;
+			else if (strcmp(filename, blame->commit->filename))
+				show_filenames = TRUE;
+		}
+	}
 
-	return line;
+	return show_filenames;
 }
 
 static bool
-tree_read_date(struct view *view, char *text, struct tree_state *state)
+blame_open(struct view *view, enum open_flags flags)
 {
-	if (!text && state->read_date) {
-		state->read_date = FALSE;
-		return TRUE;
+	const char *file_argv[] = { opt_cdup, opt_file , NULL };
+	char path[SIZEOF_STR];
 
-	} else if (!text) {
-		/* Find next entry to process */
-		const char *log_file[] = {
-			"git", "log", opt_encoding_arg, "--no-color", "--pretty=raw",
-				"--cc", "--raw", view->id, "--", "%(directory)", NULL
-		};
+	if (!opt_file[0]) {
+		report("No file chosen, press %s to open tree view",
+			get_view_key(view, REQ_VIEW_TREE));
+		return FALSE;
+	}
 
-		if (!view->lines) {
-			tree_entry(view, LINE_TREE_HEAD, opt_path, NULL, NULL, 0);
-			tree_entry(view, LINE_TREE_DIR, "..", "040000", view->ref, 0);
-			report("Tree is empty");
-			return TRUE;
-		}
+	if (!(flags & (OPEN_RELOAD | OPEN_REFRESH)))
+		blame_positions_size = 0;
 
-		if (!begin_update(view, opt_cdup, log_file, OPEN_EXTRA)) {
-			report("Failed to load tree data");
-			return TRUE;
+	if (!view->prev && *opt_prefix && !(flags & (OPEN_RELOAD | OPEN_REFRESH))) {
+		string_copy(path, opt_file);
+		if (!string_format(opt_file, "%s%s", opt_prefix, path)) {
+			report("Failed to setup the blame view");
+			return FALSE;
 		}
+	}
 
-		state->read_date = TRUE;
-		return FALSE;
+	if (*opt_ref || !begin_update(view, opt_cdup, file_argv, flags)) {
+		const char *blame_cat_file_argv[] = {
+			"git", "cat-file", "blob", "%(ref):%(file)", NULL
+		};
 
-	} else if (*text == 'c' && get_line_type(text) == LINE_COMMIT) {
-		string_copy_rev_from_commit_line(state->commit, text);
+		if (!begin_update(view, opt_cdup, blame_cat_file_argv, flags))
+			return FALSE;
+	}
 
-	} else if (*text == 'a' && get_line_type(text) == LINE_AUTHOR) {
-		parse_author_line(text + STRING_SIZE("author "),
-				  &state->author, &state->author_time);
+	string_format(view->vid, "%s", opt_file);
+	string_format(view->ref, "%s ...", opt_file);
 
-	} else if (*text == ':') {
-		char *pos;
-		size_t annotated = 1;
-		size_t i;
+	return TRUE;
+}
 
-		pos = strchr(text, '\t');
-		if (!pos)
-			return TRUE;
-		text = pos + 1;
-		if (*opt_path && !strncmp(text, opt_path, strlen(opt_path)))
-			text += strlen(opt_path);
-		pos = strchr(text, '/');
-		if (pos)
-			*pos = 0;
+static struct blame_commit *
+read_blame_commit(struct view *view, const char *text, struct blame_state *state)
+{
+	struct blame_header header;
+	struct blame_commit *commit;
+	struct blame *blame;
 
-		for (i = 1; i < view->lines; i++) {
-			struct line *line = &view->line[i];
-			struct tree_entry *entry = line->data;
+	if (!parse_blame_header(&header, text, view->lines))
+		return NULL;
 
-			annotated += !!entry->author;
-			if (entry->author || strcmp(entry->name, text))
-				continue;
+	commit = get_blame_commit(&state->commits, text);
+	if (!commit)
+		return NULL;
 
-			string_copy_rev(entry->commit, state->commit);
-			entry->author = state->author;
-			entry->time = state->author_time;
-			line->dirty = 1;
-			break;
-		}
+	while (header.group--) {
+		struct line *line = &view->line[header.lineno + header.group - 1];
 
-		if (annotated == view->lines)
-			io_kill(view->pipe);
+		blame = line->data;
+		if (!blame->commit)
+			state->blamed++;
+		blame->commit = commit;
+		blame->lineno = header.orig_lineno + header.group - 1;
+		line->dirty = 1;
 	}
-	return TRUE;
+
+	return commit;
 }
 
-static inline size_t
-parse_size(const char *text, int *max_digits)
+/* Blaming the shown lines first only pays off when git-blame(1) looks
+ * for moved or copied lines, since the work then depends on the number
+ * of lines being blamed. Otherwise, the same commits are visited either
+ * way and --incremental already shows the shown lines as soon as they
+ * would be found for a range. Ranges given by the user are left to
+ * git-blame(1). */
+static bool
+blame_use_ranges(void)
 {
-	size_t size = 0;
-	int digits = 0;
-
-	while (*text == ' ')
-		text++;
+	bool detect = FALSE;
+	int i;
 
-	while (isdigit(*text)) {
-		size = (size * 10) + (*text++ - '0');
-		digits++;
+	for (i = 0; opt_blame_argv && opt_blame_argv[i]; i++) {
+		if (!prefixcmp(opt_blame_argv[i], "-L"))
+			return FALSE;
+		if (!prefixcmp(opt_blame_argv[i], "-C") ||
+		    !prefixcmp(opt_blame_argv[i], "-M"))
+			detect = TRUE;
 	}
 
-	if (digits > *max_digits)
-		*max_digits = digits;
-
-	return size;
+	return detect;
 }
 
-static bool
-tree_read(struct view *view, char *text)
+/* Get the lines around the shown ones, which are blamed first. */
+static void
+blame_shown_range(struct view *view, size_t *from, size_t *to)
 {
-	struct tree_state *state = view->private;
-	struct tree_entry *data;
-	struct line *entry, *line;
-	enum line_type type;
-	size_t textlen = text ? strlen(text) : 0;
-	const char *attr_offset = text + SIZEOF_TREE_ATTR;
-	char *path;
-	size_t size;
+	size_t height = view_is_displayed(view) && !view->filter ? view->height : 0;
 
-	if (state->read_date || !text)
-		return tree_read_date(view, text, state);
+	*from = view->pos.offset > height ? view->pos.offset - height : 0;
+	*to = MIN(view->pos.offset + 2 * height, view->lines);
+}
 
-	if (textlen <= SIZEOF_TREE_ATTR)
-		return FALSE;
-	if (view->lines == 0 &&
-	    !tree_entry(view, LINE_TREE_HEAD, opt_path, NULL, NULL, 0))
-		return FALSE;
+static bool
+blame_is_blamed(struct view *view, size_t lineno)
+{
+	struct blame *blame = view->line[lineno].data;
 
-	size = parse_size(attr_offset, &state->size_width);
-	path = strchr(attr_offset, '\t');
-	if (!path)
-		return FALSE;
-	path++;
+	return !!blame->commit;
+}
 
-	/* Strip the path part ... */
-	if (*opt_path) {
-		size_t pathlen = textlen - SIZEOF_TREE_ATTR;
-		size_t striplen = strlen(opt_path);
+static bool
+blame_add_range_arg(const char ***argv, size_t from, size_t to)
+{
+	char range[SIZEOF_STR];
 
-		if (pathlen > striplen)
-			memmove(path, path + striplen,
-				pathlen - striplen + 1);
+	return string_format(range, "-L%zu,%zu", from + 1, to) &&
+	       argv_append(argv, range);
+}
 
-		/* Insert "link" to parent directory. */
-		if (view->lines == 1 &&
-		    !tree_entry(view, LINE_TREE_DIR, "..", "040000", view->ref, 0))
-			return FALSE;
-	}
+/* Number of ranges of unblamed lines passed to one git-blame(1). */
+#define BLAME_MAX_RANGES	16
 
-	type = text[SIZEOF_TREE_MODE] == 't' ? LINE_TREE_DIR : LINE_TREE_FILE;
-	entry = tree_entry(view, type, path, text, text + TREE_ID_OFFSET, size);
-	if (!entry)
-		return FALSE;
-	data = entry->data;
+/* Add the unblamed lines between from and to as -L ranges. Ranges past
+ * the maximum are merged with the last one. */
+static size_t
+blame_add_unblamed_ranges(struct view *view, const char ***argv, size_t from, size_t to, bool *ok)
+{
+	size_t range_from = 0, range_to = 0;
+	size_t ranges = 0;
+	size_t i;
 
-	/* Skip "Directory ..." and ".." line. */
-	for (line = &view->line[1 + !!*opt_path]; line < entry; line++) {
-		if (tree_compare_entry(line, entry) <= 0)
+	for (i = from; i < to && *ok; i++) {
+		if (blame_is_blamed(view, i))
 			continue;
 
-		memmove(line + 1, line, (entry - line) * sizeof(*entry));
+		if (ranges && (i == range_to || ranges == BLAME_MAX_RANGES)) {
+			range_to = i + 1;
+			continue;
+		}
 
-		line->data = data;
-		line->type = type;
-		for (; line <= entry; line++)
-			line->dirty = line->cleareol = 1;
-		return TRUE;
+		if (ranges)
+			*ok = blame_add_range_arg(argv, range_from, range_to);
+		range_from = i;
+		range_to = i + 1;
+		ranges++;
 	}
 
-	if (tree_lineno <= view->pos.lineno)
-		tree_lineno = view->custom_lines;
+	if (ranges && *ok)
+		*ok = blame_add_range_arg(argv, range_from, range_to);
 
-	if (tree_lineno > view->pos.lineno) {
-		view->pos.lineno = tree_lineno;
-		tree_lineno = 0;
+	return ranges;
+}
+
+/* Start git-blame(1) for the unblamed lines around the shown ones or,
+ * when these are all blamed, for the rest of the file. Returns FALSE
+ * when there are no lines left to blame or it failed to start. */
+static bool
+blame_next_range(struct view *view, struct blame_state *state)
+{
+	const char *blame_argv[] = {
+		"git", "blame", opt_encoding_arg, "%(blameargs)", "--incremental", NULL
+	};
+	const char **argv = NULL;
+	size_t from, to;
+	bool ok = argv_append_array(&argv, blame_argv);
+	bool started = FALSE;
+
+	blame_shown_range(view, &from, &to);
+	state->shown_range = ok && blame_add_unblamed_ranges(view, &argv, from, to, &ok);
+	state->range_from = from;
+	state->range_to = to;
+	state->range_blamed = state->blamed;
+
+	if (ok && (state->shown_range ||
+		   blame_add_unblamed_ranges(view, &argv, 0, view->lines, &ok)) &&
+	    (!*opt_ref || argv_append(&argv, opt_ref)) &&
+	    argv_append(&argv, "--") && argv_append(&argv, opt_file)) {
+		if (view->pipe)
+			io_kill(view->pipe);
+		started = begin_update(view, opt_cdup, argv, OPEN_EXTRA);
+		state->commit = NULL;
 	}
 
-	return TRUE;
+	argv_free(argv);
+	free(argv);
+	return started;
 }
 
+/* Time the view must stay in place after it was moved before the shown
+ * lines are blamed next. */
+#define BLAME_RANGE_DELAY	300000
+
+/* Blame the shown lines first when they are scrolled to while the rest
+ * of the file is being blamed. Returns TRUE while waiting for the view
+ * to stay in place. */
 static bool
-tree_draw(struct view *view, struct line *line, unsigned int lineno)
+blame_range_update(void)
 {
-	struct tree_state *state = view->private;
-	struct tree_entry *entry = line->data;
+	struct view *view = VIEW(REQ_VIEW_BLAME);
+	struct blame_state *state = view->private;
+	size_t lineno, end;
 
-	if (line->type == LINE_TREE_HEAD) {
-		if (draw_text(view, line->type, "Directory path /"))
-			return TRUE;
-	} else {
-		if (draw_mode(view, entry->mode))
-			return TRUE;
+	if (!state || !state->moved)
+		return FALSE;
 
-		if (draw_author(view, entry->author))
-			return TRUE;
+	if (view_stats_clock() - state->moved < BLAME_RANGE_DELAY)
+		return TRUE;
 
-		if (draw_file_size(view, entry->size, state->size_width,
-				   line->type != LINE_TREE_FILE))
-			return TRUE;
+	state->moved = 0;
+	if (!state->ranged || !state->done_reading || !view->pipe || view->filter)
+		return FALSE;
 
-		if (draw_date(view, &entry->time))
-			return TRUE;
+	end = MIN(view->lines, view->pos.offset + view->height);
+	for (lineno = view->pos.offset; lineno < end; lineno++)
+		if (!blame_is_blamed(view, lineno) &&
+		    (!state->shown_range || lineno < state->range_from ||
+		     state->range_to <= lineno))
+			break;
+	if (lineno == end)
+		return FALSE;
 
-		if (draw_id(view, entry->commit))
-			return TRUE;
+	if (!blame_next_range(view, state)) {
+		state->ranged = FALSE;
+		report("Failed to load blame data");
+		end_update(view, TRUE);
 	}
-
-	draw_text(view, line->type, entry->name);
-	return TRUE;
+	return FALSE;
 }
 
-static void
-open_blob_editor(const char *id, const char *name, unsigned int lineno)
+static bool
+blame_cache_dir(char path[SIZEOF_STR], bool create)
 {
-	const char *blob_argv[] = { "git", "cat-file", "blob", id, NULL };
-	char file[SIZEOF_STR];
-	int fd;
-
-	if (!name)
-		name = "unknown";
-
-	if (!string_format(file, "%s/tigblob.XXXXXX.%s", get_temp_dir(), name)) {
-		report("Temporary file name is too long");
-		return;
-	}
+	return string_format_size(path, SIZEOF_STR, "%s/tig", opt_git_dir) &&
+	       (!create || !access(path, F_OK) || !mkdir(path, 0777)) &&
+	       string_format_size(path, SIZEOF_STR, "%s/tig/blame", opt_git_dir) &&
+	       (!create || !access(path, F_OK) || !mkdir(path, 0777));
+}
 
-	fd = mkstemps(file, strlen(name) + 1);
+static bool
+blame_args_string(struct view *view, char buf[SIZEOF_STR])
+{
+	const char *blameargs_argv[] = { "%(blameargs)", NULL };
+	const char **args = NULL;
+	bool ok = format_argv(view, &args, blameargs_argv, FALSE, TRUE);
 
-	if (fd == -1)
-		report("Failed to create temporary file");
-	else if (!io_run_append(blob_argv, fd))
-		report("Failed to save blob data to file");
-	else
-		open_editor(file, lineno);
-	if (fd != -1)
-		unlink(file);
+	buf[0] = 0;
+	ok = ok && (!args || argv_to_string(args, buf, SIZEOF_STR, " "));
+	argv_free(args);
+	free(args);
+	return ok;
 }
 
-static enum request
-tree_request(struct view *view, enum request request, struct line *line)
+/* A blame is identified by the commit and the blob being blamed and the
+ * options passed to git-blame(1). When blaming the working tree, the
+ * blob is the one of the file in the working tree. */
+static bool
+blame_cache_key(struct view *view, char key[SIZEOF_STR])
 {
-	enum open_flags flags;
-	struct tree_entry *entry = line->data;
-
-	switch (request) {
-	case REQ_VIEW_BLAME:
-		if (line->type != LINE_TREE_FILE) {
-			report("Blame only supported for files");
-			return REQ_NONE;
-		}
+	char commit[SIZEOF_STR], blob[SIZEOF_STR];
+	char args_string[SIZEOF_STR];
+	bool ok;
 
-		string_copy(opt_ref, view->vid);
-		return request;
+	if (*opt_ref) {
+		char commit_spec[SIZEOF_STR], blob_spec[SIZEOF_STR];
+		const char *commit_argv[] = { "git", "rev-parse", "--verify", "--quiet", commit_spec, NULL };
+		const char *blob_argv[] = { "git", "rev-parse", "--verify", "--quiet", blob_spec, NULL };
 
-	case REQ_EDIT:
-		if (line->type != LINE_TREE_FILE) {
-			report("Edit only supported for files");
-		} else if (!is_head_commit(view->vid)) {
-			open_blob_editor(entry->id, entry->name, 0);
-		} else {
-			open_editor(opt_file, 0);
-		}
-		return REQ_NONE;
+		ok = string_format(commit_spec, "%s^{commit}", opt_ref) &&
+		     string_format(blob_spec, "%s:%s", opt_ref, opt_file) &&
+		     io_run_buf(commit_argv, commit, sizeof(commit)) &&
+		     io_run_buf(blob_argv, blob, sizeof(blob));
 
-	case REQ_TOGGLE_SORT_FIELD:
-	case REQ_TOGGLE_SORT_ORDER:
-		sort_view(view, request, &tree_sort_state, tree_compare);
-		return REQ_NONE;
+	} else {
+		char path[SIZEOF_STR];
+		const char *commit_argv[] = { "git", "rev-parse", "--verify", "--quiet", "HEAD", NULL };
+		const char *blob_argv[] = { "git", "hash-object", "--", path, NULL };
 
-	case REQ_PARENT:
-		if (!*opt_path) {
-			/* quit view if at top of tree */
-			return REQ_VIEW_CLOSE;
-		}
-		/* fake 'cd  ..' */
-		line = &view->line[1];
-		break;
+		ok = string_format(path, "%s%s", opt_cdup, opt_file) &&
+		     io_run_buf(commit_argv, commit, sizeof(commit)) &&
+		     io_run_buf(blob_argv, blob, sizeof(blob));
+	}
 
-	case REQ_ENTER:
-		break;
+	ok = ok && blame_args_string(view, args_string) &&
+	     string_format_size(key, SIZEOF_STR, "%s\n%s\n%s\n%s\n%s", commit, blob,
+				opt_file, opt_encoding_arg, args_string);
 
-	default:
-		return request;
-	}
+	if (!ok)
+		key[0] = 0;
+	return ok;
+}
 
-	/* Cleanup the stack if the tree view is at a different tree. */
-	while (!*opt_path && tree_stack)
-		pop_tree_stack_entry();
+static void
+blame_apply_lines(struct view *view, struct blame_state *state,
+		  const struct blame_cache_line *lines, size_t lines_size)
+{
+	size_t i;
 
-	switch (line->type) {
-	case LINE_TREE_DIR:
-		/* Depending on whether it is a subdirectory or parent link
-		 * mangle the path buffer. */
-		if (line == &view->line[1] && *opt_path) {
-			pop_tree_stack_entry();
+	for (i = 0; i < lines_size; i++) {
+		struct blame *blame = view->line[i].data;
 
-		} else {
-			const char *basename = tree_path(line);
+		if (!lines[i].commit)
+			continue;
+		if (!blame->commit)
+			state->blamed++;
+		blame->commit = lines[i].commit;
+		blame->lineno = lines[i].lineno;
+		view->line[i].dirty = 1;
+	}
+}
 
-			push_tree_stack_entry(basename, view->pos.lineno);
-		}
+static bool
+blame_load_cache(struct view *view, struct blame_state *state)
+{
+	struct blame_cache_line *lines;
+	char dir[SIZEOF_STR];
 
-		/* Trees and subtrees share the same ID, so they are not not
-		 * unique like blobs. */
-		flags = OPEN_RELOAD;
-		request = REQ_VIEW_TREE;
-		break;
+	if (!blame_cache_key(view, state->cache_key) || !blame_cache_dir(dir, FALSE))
+		return FALSE;
 
-	case LINE_TREE_FILE:
-		flags = view_is_displayed(view) ? OPEN_SPLIT : OPEN_DEFAULT;
-		request = REQ_VIEW_BLOB;
-		break;
+	lines = calloc(view->lines, sizeof(*lines));
+	if (!lines)
+		return FALSE;
 
-	default:
-		return REQ_NONE;
+	if (!blame_cache_load(dir, state->cache_key, strlen(state->cache_key),
+			      &state->commits, lines, view->lines)) {
+		free(lines);
+		return FALSE;
 	}
 
-	open_view(view, request, flags);
-	if (request == REQ_VIEW_TREE)
-		view->pos.lineno = tree_lineno;
+	blame_apply_lines(view, state, lines, view->lines);
 
-	return REQ_NONE;
+	/* There is nothing new to store. */
+	state->cache_key[0] = 0;
+	free(lines);
+	return TRUE;
 }
 
-static bool
-tree_grep(struct view *view, struct line *line)
+static struct blame_cache_line *
+blame_get_lines(struct view *view)
 {
-	struct tree_entry *entry = line->data;
-	const char *text[] = {
-		entry->name,
-		mkauthor(entry->author, opt_author_width, opt_author),
-		mkdate(&entry->time, opt_date),
-		NULL
-	};
+	struct blame_cache_line *lines = calloc(view->lines ? view->lines : 1, sizeof(*lines));
+	size_t i;
 
-	return grep_text(view, text);
+	for (i = 0; lines && i < view->lines; i++) {
+		struct blame *blame = view->line[i].data;
+
+		lines[i].commit = blame->commit;
+		lines[i].lineno = blame->lineno;
+	}
+
+	return lines;
 }
 
 static void
-tree_select(struct view *view, struct line *line)
+blame_store_cache(struct view *view, struct blame_state *state)
 {
-	struct tree_entry *entry = line->data;
-
-	if (line->type == LINE_TREE_HEAD) {
-		string_format(view->ref, "Files in /%s", opt_path);
-		return;
-	}
+	struct blame_cache_line *lines = blame_get_lines(view);
+	char dir[SIZEOF_STR];
 
-	if (line->type == LINE_TREE_DIR && tree_path_is_parent(entry->name)) {
-		string_copy(view->ref, "Open parent directory");
-		ref_blob[0] = 0;
+	if (!lines)
 		return;
-	}
 
-	if (line->type == LINE_TREE_FILE) {
-		string_copy_rev(ref_blob, entry->id);
-		string_format(opt_file, "%s%s", opt_path, tree_path(line));
-	}
+	if (!blame_cache_dir(dir, TRUE) ||
+	    !blame_cache_store(dir, state->cache_key, strlen(state->cache_key),
+			       lines, view->lines, (size_t) opt_blame_cache * 1024 * 1024))
+		report("Failed to update the blame cache");
 
-	string_copy_rev(view->ref, entry->id);
+	free(lines);
 }
 
-static bool
-tree_open(struct view *view, enum open_flags flags)
-{
-	static const char *tree_argv[] = {
-		"git", "ls-tree", "-l", "%(commit)", "%(directory)", NULL
-	};
+/*
+ * Blame history and prefetching
+ *
+ * The blames of commits are kept in memory when the blame view moves on
+ * to another one, so that going back to them does not run git-blame(1)
+ * again. While the view is idle, the blame of the parent of the selected
+ * line is loaded in the background, so that moving to it is quick.
+ */
 
-	if (string_rev_is_null(ref_commit)) {
-		report("No tree exists for this commit");
-		return FALSE;
-	}
+struct blame_history {
+	char key[SIZEOF_STR];
+	struct blame_commits commits;
+	struct blame_cache_line *lines;
+	size_t lines_size;
+	unsigned long used;		/* When the entry was last used. */
+};
 
-	if (view->lines == 0 && opt_prefix[0]) {
-		char *pos = opt_prefix;
+static struct blame_history *blame_history;
+static size_t blame_history_size;
+static unsigned long blame_history_clock;
 
-		while (pos && *pos) {
-			char *end = strchr(pos, '/');
+DEFINE_ALLOCATOR(realloc_blame_history, struct blame_history, 8)
 
-			if (end)
-				*end = 0;
-			push_tree_stack_entry(pos, 0);
-			pos = end;
-			if (end) {
-				*end = '/';
-				pos++;
-			}
-		}
+/* Only the blames of commit IDs are kept, since the commit a ref points
+ * to and the working tree may change. */
+static bool
+blame_history_key(struct view *view, const char *ref, const char *file, char key[SIZEOF_STR])
+{
+	char args[SIZEOF_STR];
 
-	} else if (strcmp(view->vid, view->id)) {
-		opt_path[0] = 0;
+	if (strlen(ref) != SIZEOF_REV - 1 || strspn(ref, "0123456789abcdef") != SIZEOF_REV - 1 ||
+	    !blame_args_string(view, args) ||
+	    !string_format_size(key, SIZEOF_STR, "%s\n%s\n%s\n%s", ref, file, opt_encoding_arg, args)) {
+		key[0] = 0;
+		return FALSE;
 	}
 
-	return begin_update(view, opt_cdup, tree_argv, flags);
+	return TRUE;
 }
 
-static struct view_ops tree_ops = {
-	"file",
-	{ "tree" },
-	VIEW_SEND_CHILD_ENTER,
-	sizeof(struct tree_state),
-	tree_open,
-	tree_read,
-	tree_draw,
-	tree_request,
-	tree_grep,
-	tree_select,
-};
+static struct blame_history *
+blame_history_find(const char *key)
+{
+	size_t i;
 
-static bool
-blob_open(struct view *view, enum open_flags flags)
+	for (i = 0; i < blame_history_size; i++)
+		if (!strcmp(blame_history[i].key, key))
+			return &blame_history[i];
+	return NULL;
+}
+
+static void
+blame_history_remove(struct blame_history *entry)
 {
-	static const char *blob_argv[] = {
-		"git", "cat-file", "blob", "%(blob)", NULL
-	};
+	free_blame_commits(&entry->commits);
+	free(entry->lines);
+	*entry = blame_history[--blame_history_size];
+}
 
-	if (!ref_blob[0] && opt_file[0]) {
-		const char *commit = ref_commit[0] ? ref_commit : "HEAD";
-		char blob_spec[SIZEOF_STR];
-		const char *rev_parse_argv[] = {
-			"git", "rev-parse", blob_spec, NULL
-		};
+/* Add a blame, taking over its commits and lines. The least recently
+ * used blame is dropped when the history is full. */
+static void
+blame_history_add(const char *key, struct blame_commits *commits,
+		  struct blame_cache_line *lines, size_t lines_size)
+{
+	struct blame_history *entry = blame_history_find(key);
 
-		if (!string_format(blob_spec, "%s:%s", commit, opt_file) ||
-		    !io_run_buf(rev_parse_argv, ref_blob, sizeof(ref_blob))) {
-			report("Failed to resolve blob from file name");
-			return FALSE;
-		}
-	}
+	if (entry)
+		blame_history_remove(entry);
 
-	if (!ref_blob[0]) {
-		report("No file chosen, press %s to open tree view",
-			get_view_key(view, REQ_VIEW_TREE));
-		return FALSE;
+	while (blame_history_size && blame_history_size >= opt_blame_history) {
+		struct blame_history *oldest = &blame_history[0];
+		size_t i;
+
+		for (i = 1; i < blame_history_size; i++)
+			if (blame_history[i].used < oldest->used)
+				oldest = &blame_history[i];
+		blame_history_remove(oldest);
 	}
 
-	view->encoding = get_path_encoding(opt_file, opt_encoding);
+	if (!opt_blame_history ||
+	    !realloc_blame_history(&blame_history, blame_history_size, 1)) {
+		free_blame_commits(commits);
+		free(lines);
+		return;
+	}
 
-	return begin_update(view, NULL, blob_argv, flags);
+	entry = &blame_history[blame_history_size++];
+	string_ncopy(entry->key, key, strlen(key));
+	entry->commits = *commits;
+	entry->lines = lines;
+	entry->lines_size = lines_size;
+	entry->used = ++blame_history_clock;
+	memset(commits, 0, sizeof(*commits));
 }
 
 static bool
-blob_read(struct view *view, char *line)
+blame_restore_history(struct view *view, struct blame_state *state)
 {
-	if (!line)
-		return TRUE;
-	return add_line_text(view, line, LINE_DEFAULT) != NULL;
-}
+	struct blame_history *entry = blame_history_find(state->history_key);
 
-static enum request
-blob_request(struct view *view, enum request request, struct line *line)
-{
-	switch (request) {
-	case REQ_EDIT:
-		open_blob_editor(view->vid, NULL, (line - view->line) + 1);
-		return REQ_NONE;
-	default:
-		return pager_request(view, request, line);
-	}
+	if (!*state->history_key || !entry || entry->lines_size != view->lines)
+		return FALSE;
+
+	state->commits = entry->commits;
+	memset(&entry->commits, 0, sizeof(entry->commits));
+	blame_apply_lines(view, state, entry->lines, entry->lines_size);
+	blame_history_remove(entry);
+	return TRUE;
 }
 
-static struct view_ops blob_ops = {
-	"line",
-	{ "blob" },
-	VIEW_NO_FLAGS,
-	0,
-	blob_open,
-	blob_read,
-	pager_draw,
-	blob_request,
-	pager_grep,
-	pager_select,
+struct blame_prefetch {
+	char key[SIZEOF_STR];		/* Key of the blame in the blame history. */
+	char ref[SIZEOF_REV];
+	char file[SIZEOF_STR];
+	unsigned long long wanted;	/* When the blame was selected. */
+	time_t start;
+	struct io io;
+	bool running;
+	bool done;
+	bool failed;
+	struct blame_commits commits;
+	struct blame_commit *commit;	/* Commit whose info is being read. */
+	struct blame_cache_line *lines;
+	size_t lines_size;
 };
 
-/*
- * Blame backend
- *
- * Loading the blame view is a two phase job:
- *
- *  1. File content is read either using opt_file from the
- *     filesystem or using git-cat-file.
- *  2. Then blame information is incrementally added by
- *     reading output from git-blame.
- */
+static struct blame_prefetch blame_prefetch;
 
-struct blame {
-	struct blame_commit *commit;
-	unsigned long lineno;
-	char text[1];
-};
+DEFINE_ALLOCATOR(realloc_blame_prefetch_lines, struct blame_cache_line, 1024)
 
-struct blame_state {
-	struct blame_commit *commit;
-	int blamed;
-	bool done_reading;
-	bool auto_filename_display;
-};
+/* Time the selection must stay on a line before its parent is blamed. */
+#define BLAME_PREFETCH_DELAY	300000
 
-static bool
-blame_detect_filename_display(struct view *view)
+static void
+blame_prefetch_reset(struct blame_prefetch *prefetch)
 {
-	bool show_filenames = FALSE;
-	const char *filename = NULL;
-	int i;
+	if (prefetch->running) {
+		io_kill(&prefetch->io);
+		io_done(&prefetch->io);
+	}
+	free_blame_commits(&prefetch->commits);
+	free(prefetch->lines);
+	memset(prefetch, 0, sizeof(*prefetch));
+}
 
-	if (opt_blame_argv) {
-		for (i = 0; opt_blame_argv[i]; i++) {
-			if (prefixcmp(opt_blame_argv[i], "-C"))
-				continue;
+static void
+blame_prefetch_parent(struct view *view, struct blame *blame)
+{
+	struct blame_prefetch *prefetch = &blame_prefetch;
+	struct blame_commit *commit = blame->commit;
+	char key[SIZEOF_STR];
 
-			show_filenames = TRUE;
-		}
-	}
+	if (!opt_blame_prefetch || !commit || !*commit->parent_id ||
+	    !blame_history_key(view, commit->parent_id, commit->parent_filename, key) ||
+	    !strcmp(key, prefetch->key) || blame_history_find(key))
+		return;
 
-	for (i = 0; i < view->lines; i++) {
-		struct blame *blame = view->line[i].data;
+	blame_prefetch_reset(prefetch);
+	string_copy(prefetch->key, key);
+	string_copy_rev(prefetch->ref, commit->parent_id);
+	string_copy(prefetch->file, commit->parent_filename);
+	prefetch->wanted = view_stats_clock();
+}
 
-		if (blame->commit && blame->commit->id[0]) {
-			if (!filename)
-				filename = blame->commit->filename;
-			else if (strcmp(filename, blame->commit->filename))
-				show_filenames = TRUE;
-		}
-	}
+static bool
+blame_prefetch_start(struct view *view, struct blame_prefetch *prefetch)
+{
+	const char *blame_argv[] = {
+		"git", "blame", opt_encoding_arg, "%(blameargs)", "--incremental",
+			prefetch->ref, "--", prefetch->file, NULL
+	};
+	const char **argv = NULL;
 
-	return show_filenames;
+	prefetch->running = format_argv(view, &argv, blame_argv, FALSE, TRUE) &&
+			    io_run(&prefetch->io, IO_RD, opt_cdup, opt_env, argv);
+	prefetch->start = time(NULL);
+	argv_free(argv);
+	free(argv);
+	return prefetch->running;
 }
 
 static bool
-blame_open(struct view *view, enum open_flags flags)
+blame_prefetch_read(struct blame_prefetch *prefetch, char *line)
 {
-	const char *file_argv[] = { opt_cdup, opt_file , NULL };
-	char path[SIZEOF_STR];
-	size_t i;
+	struct blame_header header;
 
-	if (!opt_file[0]) {
-		report("No file chosen, press %s to open tree view",
-			get_view_key(view, REQ_VIEW_TREE));
-		return FALSE;
+	if (prefetch->commit) {
+		if (parse_blame_info(prefetch->commit, line))
+			prefetch->commit = NULL;
+		return TRUE;
 	}
 
-	if (!view->prev && *opt_prefix && !(flags & (OPEN_RELOAD | OPEN_REFRESH))) {
-		string_copy(path, opt_file);
-		if (!string_format(opt_file, "%s%s", opt_prefix, path)) {
-			report("Failed to setup the blame view");
-			return FALSE;
-		}
-	}
+	/* The number of lines is not known until the view reads the file,
+	 * so the lines are allowed to grow. */
+	if (!parse_blame_header(&header, line, 9999999))
+		return TRUE;
 
-	if (*opt_ref || !begin_update(view, opt_cdup, file_argv, flags)) {
-		const char *blame_cat_file_argv[] = {
-			"git", "cat-file", "blob", "%(ref):%(file)", NULL
-		};
+	if (header.lineno + header.group - 1 > prefetch->lines_size) {
+		size_t lines_size = header.lineno + header.group - 1;
 
-		if (!begin_update(view, opt_cdup, blame_cat_file_argv, flags))
+		if (!realloc_blame_prefetch_lines(&prefetch->lines, prefetch->lines_size,
+						  lines_size - prefetch->lines_size))
 			return FALSE;
+		prefetch->lines_size = lines_size;
 	}
 
-	/* First pass: remove multiple references to the same commit. */
-	for (i = 0; i < view->lines; i++) {
-		struct blame *blame = view->line[i].data;
-
-		if (blame->commit && blame->commit->id[0])
-			blame->commit->id[0] = 0;
-		else
-			blame->commit = NULL;
-	}
+	prefetch->commit = get_blame_commit(&prefetch->commits, line);
+	if (!prefetch->commit)
+		return FALSE;
 
-	/* Second pass: free existing references. */
-	for (i = 0; i < view->lines; i++) {
-		struct blame *blame = view->line[i].data;
+	while (header.group--) {
+		struct blame_cache_line *blame = &prefetch->lines[header.lineno + header.group - 1];
 
-		if (blame->commit)
-			free(blame->commit);
+		blame->commit = prefetch->commit;
+		blame->lineno = header.orig_lineno + header.group - 1;
 	}
 
-	string_format(view->vid, "%s", opt_file);
-	string_format(view->ref, "%s ...", opt_file);
-
 	return TRUE;
 }
 
-static struct blame_commit *
-get_blame_commit(struct view *view, const char *id)
+/* Start or continue reading the prefetched blame. Returns TRUE while
+ * there is more to do. */
+static bool
+blame_prefetch_update(void)
 {
-	size_t i;
+	struct blame_prefetch *prefetch = &blame_prefetch;
+	struct view *view = VIEW(REQ_VIEW_BLAME);
+	struct encoding *encoding = view->encoding ? view->encoding : opt_encoding;
+	bool can_read;
+	char *line;
 
-	for (i = 0; i < view->lines; i++) {
-		struct blame *blame = view->line[i].data;
+	if (!*prefetch->key || prefetch->done || prefetch->failed)
+		return FALSE;
 
-		if (!blame->commit)
-			continue;
+	if (!prefetch->running) {
+		if (view->pipe || view_stats_clock() - prefetch->wanted < BLAME_PREFETCH_DELAY)
+			return TRUE;
+		prefetch->failed = !blame_prefetch_start(view, prefetch);
+		return !prefetch->failed;
+	}
 
-		if (!strncmp(blame->commit->id, id, SIZEOF_REV - 1))
-			return blame->commit;
+	for (can_read = io_can_read(&prefetch->io, FALSE);
+	     (line = io_get(&prefetch->io, '\n', can_read));
+	     can_read = FALSE) {
+		if (encoding)
+			line = encoding_convert(encoding, line);
+		if (!blame_prefetch_read(prefetch, line))
+			break;
 	}
 
-	{
-		struct blame_commit *commit = calloc(1, sizeof(*commit));
+	if (line || io_error(&prefetch->io) ||
+	    time(NULL) - prefetch->start >= opt_blame_prefetch) {
+		/* Keep the key so the blame is not started again. */
+		char key[SIZEOF_STR];
+
+		string_copy(key, prefetch->key);
+		blame_prefetch_reset(prefetch);
+		string_copy(prefetch->key, key);
+		prefetch->failed = TRUE;
 
-		if (commit)
-			string_ncopy(commit->id, id, SIZEOF_REV);
-		return commit;
+	} else if (io_eof(&prefetch->io)) {
+		prefetch->running = FALSE;
+		prefetch->done = io_done(&prefetch->io);
+		prefetch->failed = !prefetch->done;
 	}
+
+	return prefetch->running;
 }
 
-static struct blame_commit *
-read_blame_commit(struct view *view, const char *text, struct blame_state *state)
+/* Use the prefetched blame when it is for the file being blamed. When
+ * the prefetch is still running, the view continues reading from it. */
+static bool
+blame_adopt_prefetch(struct view *view, struct blame_state *state)
 {
-	struct blame_header header;
-	struct blame_commit *commit;
-	struct blame *blame;
-
-	if (!parse_blame_header(&header, text, view->lines))
-		return NULL;
+	struct blame_prefetch *prefetch = &blame_prefetch;
 
-	commit = get_blame_commit(view, text);
-	if (!commit)
-		return NULL;
+	if (!*state->history_key || strcmp(prefetch->key, state->history_key) ||
+	    !(prefetch->running || prefetch->done) || prefetch->lines_size > view->lines)
+		return FALSE;
 
-	state->blamed += header.group;
-	while (header.group--) {
-		struct line *line = &view->line[header.lineno + header.group - 1];
+	state->commits = prefetch->commits;
+	state->commit = prefetch->commit;
+	blame_apply_lines(view, state, prefetch->lines, prefetch->lines_size);
 
-		blame = line->data;
-		blame->commit = commit;
-		blame->lineno = header.orig_lineno + header.group - 1;
-		line->dirty = 1;
+	if (prefetch->running) {
+		io_done(view->pipe);
+		view->io = prefetch->io;
+		view->pipe = &view->io;
 	}
 
-	return commit;
+	free(prefetch->lines);
+	memset(prefetch, 0, sizeof(*prefetch));
+	return TRUE;
+}
+
+static bool
+blame_finish(struct view *view, struct blame_state *state)
+{
+	state->auto_filename_display = blame_detect_filename_display(view);
+	string_format(view->ref, "%s", view->vid);
+	if (view_is_displayed(view)) {
+		update_view_title(view);
+		redraw_view_from(view, 0);
+	}
+	if (view->pos.lineno < view->lines)
+		blame_prefetch_parent(view, view->line[view->pos.lineno].data);
+	return TRUE;
 }
 
 static bool
@@ -5945,16 +8278,32 @@ blame_read_file(struct view *view, const char *text, struct blame_state *state)
 		if (view->lines == 0 && !view->prev)
 			die("No blame exist for %s", view->vid);
 
-		if (view->lines == 0 || !begin_update(view, opt_cdup, blame_argv, OPEN_EXTRA)) {
-			report("Failed to load blame data");
-			return TRUE;
-		}
-
-		if (opt_goto_line > 0) {
+		if (opt_goto_line > 0 && view->lines > 0) {
 			select_view_line(view, opt_goto_line);
 			opt_goto_line = 0;
 		}
 
+		blame_history_key(view, opt_ref, opt_file, state->history_key);
+		if (view->lines > 0 &&
+		    (blame_restore_history(view, state) ||
+		     (opt_blame_cache && blame_load_cache(view, state)))) {
+			state->done_reading = TRUE;
+			return blame_finish(view, state);
+		}
+
+		if (view->lines > 0 && blame_adopt_prefetch(view, state)) {
+			state->done_reading = TRUE;
+			return io_eof(view->pipe) ? blame_finish(view, state) : FALSE;
+		}
+
+		state->ranged = blame_use_ranges();
+		if (view->lines == 0 ||
+		    (state->ranged ? !blame_next_range(view, state)
+				   : !begin_update(view, opt_cdup, blame_argv, OPEN_EXTRA))) {
+			report("Failed to load blame data");
+			return TRUE;
+		}
+
 		state->done_reading = TRUE;
 		return FALSE;
 
@@ -5981,13 +8330,17 @@ blame_read(struct view *view, char *line)
 		return blame_read_file(view, line, state);
 
 	if (!line) {
-		state->auto_filename_display = blame_detect_filename_display(view);
-		string_format(view->ref, "%s", view->vid);
-		if (view_is_displayed(view)) {
-			update_view_title(view);
-			redraw_view_from(view, 0);
-		}
-		return TRUE;
+		/* Continue with the next range unless the last one was
+		 * aborted or did not blame any new lines. */
+		if (state->ranged && io_eof(view->pipe) &&
+		    state->blamed > state->range_blamed &&
+		    blame_next_range(view, state))
+			return FALSE;
+
+		if (*state->cache_key && io_eof(view->pipe) && state->blamed == view->lines)
+			blame_store_cache(view, state);
+
+		return blame_finish(view, state);
 	}
 
 	if (!state->commit) {
@@ -6002,6 +8355,22 @@ blame_read(struct view *view, char *line)
 	return TRUE;
 }
 
+static void
+blame_done(struct view *view)
+{
+	struct blame_state *state = view->private;
+
+	if (*state->history_key && opt_blame_history &&
+	    view->lines > 0 && state->blamed == view->lines) {
+		struct blame_cache_line *lines = blame_get_lines(view);
+
+		if (lines)
+			blame_history_add(state->history_key, &state->commits, lines, view->lines);
+	}
+
+	free_blame_commits(&state->commits);
+}
+
 static bool
 blame_draw(struct view *view, struct line *line, unsigned int lineno)
 {
@@ -6044,7 +8413,7 @@ blame_draw(struct view *view, struct line *line, unsigned int lineno)
 	if (draw_id_custom(view, id_type, id, opt_id_cols))
 		return TRUE;
 
-	if (draw_lineno(view, lineno))
+	if (draw_lineno(view))
 		return TRUE;
 
 	draw_text(view, LINE_DEFAULT, blame->text);
@@ -6106,12 +8475,14 @@ setup_blame_parent_line(struct view *view, struct blame *blame)
 static enum request
 blame_request(struct view *view, enum request request, struct line *line)
 {
+	struct blame_state *state = view->private;
 	enum open_flags flags = view_is_displayed(view) ? OPEN_SPLIT : OPEN_DEFAULT;
 	struct blame *blame = line->data;
 
 	switch (request) {
 	case REQ_VIEW_BLAME:
 		if (check_blame_commit(blame, TRUE)) {
+			blame_push_position(view);
 			string_copy(opt_ref, blame->commit->id);
 			string_copy(opt_file, blame->commit->filename);
 			if (blame->lineno)
@@ -6126,6 +8497,7 @@ blame_request(struct view *view, enum request request, struct line *line)
 		if (!*blame->commit->parent_id) {
 			report("The selected commit has no parents");
 		} else {
+			blame_push_position(view);
 			string_copy_rev(opt_ref, blame->commit->parent_id);
 			string_copy(opt_file, blame->commit->parent_filename);
 			setup_blame_parent_line(view, blame);
@@ -6134,6 +8506,24 @@ blame_request(struct view *view, enum request request, struct line *line)
 		}
 		break;
 
+	case REQ_BACK:
+		blame_go_back(view);
+		break;
+
+	case REQ_MOVE_UP:
+	case REQ_MOVE_DOWN:
+	case REQ_MOVE_PAGE_UP:
+	case REQ_MOVE_PAGE_DOWN:
+	case REQ_MOVE_FIRST_LINE:
+	case REQ_MOVE_LAST_LINE:
+	case REQ_SCROLL_LINE_DOWN:
+	case REQ_SCROLL_LINE_UP:
+	case REQ_SCROLL_PAGE_DOWN:
+	case REQ_SCROLL_PAGE_UP:
+		if (state->ranged)
+			state->moved = view_stats_clock();
+		return request;
+
 	case REQ_ENTER:
 		if (!check_blame_commit(blame, FALSE))
 			break;
@@ -6202,6 +8592,9 @@ blame_select(struct view *view, struct line *line)
 		string_ncopy(ref_commit, "HEAD", 4);
 	else
 		string_copy_rev(ref_commit, commit->id);
+
+	if (!view->pipe)
+		blame_prefetch_parent(view, blame);
 }
 
 static struct view_ops blame_ops = {
@@ -6215,6 +8608,7 @@ static struct view_ops blame_ops = {
 	blame_request,
 	blame_grep,
 	blame_select,
+	blame_done,
 };
 
 /*
@@ -6274,7 +8668,7 @@ branch_draw(struct view *view, struct line *line, unsigned int lineno)
 	enum line_type type = branch_is_all(branch) ? LINE_DEFAULT : get_line_type_from_ref(branch->ref);
 	const char *branch_name = branch_is_all(branch) ? BRANCH_ALL_NAME : branch->ref->name;
 
-	if (draw_lineno(view, lineno))
+	if (draw_lineno(view))
 		return TRUE;
 
 	if (draw_date(view, &branch->time))
@@ -6472,26 +8866,10 @@ static struct view_ops branch_ops = {
  * Status backend
  */
 
-struct status {
-	char status;
-	struct {
-		mode_t mode;
-		char rev[SIZEOF_REV];
-		char name[SIZEOF_STR];
-	} old;
-	struct {
-		mode_t mode;
-		char rev[SIZEOF_REV];
-		char name[SIZEOF_STR];
-	} new;
-};
-
 static char status_onbranch[SIZEOF_STR];
 static struct status stage_status;
 static enum line_type stage_line_type;
 
-DEFINE_ALLOCATOR(realloc_ints, int, 32)
-
 /* This should work even for the "On branch" line. */
 static inline bool
 status_has_none(struct view *view, struct line *line)
@@ -6499,52 +8877,17 @@ status_has_none(struct view *view, struct line *line)
 	return view_has_line(view, line) && !line[1].data;
 }
 
-/* Get fields from the diff line:
- * :100644 100644 06a5d6ae9eca55be2e0e585a152e6b1336f2b20e 0000000000000000000000000000000000000000 M
- */
-static inline bool
-status_get_diff(struct status *file, const char *buf, size_t bufsize)
-{
-	const char *old_mode = buf +  1;
-	const char *new_mode = buf +  8;
-	const char *old_rev  = buf + 15;
-	const char *new_rev  = buf + 56;
-	const char *status   = buf + 97;
-
-	if (bufsize < 98 ||
-	    old_mode[-1] != ':' ||
-	    new_mode[-1] != ' ' ||
-	    old_rev[-1]  != ' ' ||
-	    new_rev[-1]  != ' ' ||
-	    status[-1]   != ' ')
-		return FALSE;
-
-	file->status = *status;
-
-	string_copy_rev(file->old.rev, old_rev);
-	string_copy_rev(file->new.rev, new_rev);
-
-	file->old.mode = strtoul(old_mode, NULL, 8);
-	file->new.mode = strtoul(new_mode, NULL, 8);
-
-	file->old.name[0] = file->new.name[0] = 0;
-
-	return TRUE;
-}
-
+/* Add a section with the files listed by a command started with
+ * io_run(). The command is finished and closed in all cases. */
 static bool
-status_run(struct view *view, const char *argv[], char status, enum line_type type)
+status_read_files(struct view *view, struct io *io, char status, enum line_type type)
 {
 	struct status *unmerged = NULL;
 	char *buf;
-	struct io io;
-
-	if (!io_run(&io, IO_RD, opt_cdup, opt_env, argv))
-		return FALSE;
 
 	add_line_nodata(view, type);
 
-	while ((buf = io_get(&io, 0, TRUE))) {
+	while ((buf = io_get(io, 0, TRUE))) {
 		struct status *file = unmerged;
 
 		if (!file) {
@@ -6562,7 +8905,7 @@ status_run(struct view *view, const char *argv[], char status, enum line_type ty
 			if (!status_get_diff(file, buf, strlen(buf)))
 				goto error_out;
 
-			buf = io_get(&io, 0, TRUE);
+			buf = io_get(io, 0, TRUE);
 			if (!buf)
 				break;
 
@@ -6581,7 +8924,7 @@ status_run(struct view *view, const char *argv[], char status, enum line_type ty
 		    (file->status == 'R' || file->status == 'C')) {
 			string_ncopy(file->old.name, buf, strlen(buf));
 
-			buf = io_get(&io, 0, TRUE);
+			buf = io_get(io, 0, TRUE);
 			if (!buf)
 				break;
 		}
@@ -6595,16 +8938,17 @@ status_run(struct view *view, const char *argv[], char status, enum line_type ty
 		file = NULL;
 	}
 
-	if (io_error(&io)) {
+	if (io_error(io)) {
 error_out:
-		io_done(&io);
+		io_kill(io);
+		io_done(io);
 		return FALSE;
 	}
 
 	if (!view->line[view->lines - 1].data)
 		add_line_nodata(view, LINE_STAT_NONE);
 
-	io_done(&io);
+	io_done(io);
 	return TRUE;
 }
 
@@ -6652,6 +8996,16 @@ status_restore(struct view *view)
 	clear_position(&view->prev_pos);
 }
 
+/* Whether a file is listed at or after the line. */
+static bool
+status_has_file_from(struct view *view, unsigned long lineno)
+{
+	for (; lineno < view->lines; lineno++)
+		if (view->line[lineno].data)
+			return TRUE;
+	return FALSE;
+}
+
 static void
 status_update_onbranch(void)
 {
@@ -6700,15 +9054,46 @@ status_update_onbranch(void)
 	string_copy(status_onbranch, "Not currently on any branch");
 }
 
+/* Untracked files are added by status_read() while the status view is
+ * shown, since listing them can take longer than the other sections. */
+struct status_state {
+	struct io untracked;
+	bool listing;		/* Untracked files are being listed. */
+	bool has_untracked;	/* The section of untracked files is added. */
+	struct position restore; /* Position among the untracked files. */
+};
+
+static void
+status_stop_untracked(struct status_state *state)
+{
+	if (state->listing) {
+		io_kill(&state->untracked);
+		io_done(&state->untracked);
+		state->listing = FALSE;
+	}
+}
+
+static void
+status_done(struct view *view)
+{
+	struct status_state *state = view->private;
+
+	if (state)
+		status_stop_untracked(state);
+}
+
 /* First parse staged info using git-diff-index(1), then parse unstaged
  * info using git-diff-files(1), and finally untracked files using
- * git-ls-files(1). */
+ * git-ls-files(1). The commands are started together and the untracked
+ * files are read in the background. */
 static bool
 status_open(struct view *view, enum open_flags flags)
 {
+	struct status_state *state = view->private;
 	const char **staged_argv = is_initial_commit() ?
 		status_list_no_head_argv : status_diff_index_argv;
 	char staged_status = staged_argv == status_list_no_head_argv ? 'A' : 0;
+	struct io staged, unstaged;
 
 	if (opt_is_inside_work_tree == FALSE) {
 		report("The status view requires a working tree");
@@ -6720,24 +9105,157 @@ status_open(struct view *view, enum open_flags flags)
 	add_line_nodata(view, LINE_STAT_HEAD);
 	status_update_onbranch();
 
-	io_run_bg(update_index_argv);
-
 	status_list_other_argv[ARRAY_SIZE(status_list_other_argv) - 2] =
 		opt_untracked_dirs_content ? NULL : "--directory";
 
-	if (!status_run(view, staged_argv, staged_status, LINE_STAT_STAGED) ||
-	    !status_run(view, status_diff_files_argv, 0, LINE_STAT_UNSTAGED) ||
-	    !status_run(view, status_list_other_argv, '?', LINE_STAT_UNTRACKED)) {
+	/* Neither the staged nor the untracked files depend on the stat
+	 * info of the index, so they are listed while it is refreshed. */
+	if (!io_run(&staged, IO_RD, opt_cdup, opt_env, staged_argv)) {
+		report("Failed to load status data");
+		return FALSE;
+	}
+
+	if (opt_untracked_files)
+		state->listing = io_run(&state->untracked, IO_RD, opt_cdup, opt_env,
+					status_list_other_argv);
+
+	io_run_bg(update_index_argv);
+
+	if (!io_run(&unstaged, IO_RD, opt_cdup, opt_env, status_diff_files_argv)) {
+		io_kill(&staged);
+		io_done(&staged);
+		goto error_out;
+	}
+
+	if (!status_read_files(view, &staged, staged_status, LINE_STAT_STAGED)) {
+		io_kill(&unstaged);
+		io_done(&unstaged);
+		goto error_out;
+	}
+
+	if (!status_read_files(view, &unstaged, 0, LINE_STAT_UNSTAGED) ||
+	    (opt_untracked_files && !state->listing)) {
+error_out:
+		status_stop_untracked(state);
 		report("Failed to load status data");
 		return FALSE;
 	}
 
 	/* Restore the exact position or use the specialized restore
-	 * mode? */
-	status_restore(view);
+	 * mode? A position among the untracked files is restored once
+	 * they have been read. */
+	if (!state->listing || status_has_file_from(view, view->prev_pos.lineno)) {
+		status_restore(view);
+	} else {
+		state->restore = view->prev_pos;
+		clear_position(&view->prev_pos);
+	}
+	return TRUE;
+}
+
+static bool
+status_read(struct view *view, char *name)
+{
+	struct status_state *state = view->private;
+	struct status *file;
+
+	if (!state->has_untracked) {
+		if (!add_line_nodata(view, LINE_STAT_UNTRACKED))
+			return FALSE;
+		state->has_untracked = TRUE;
+	}
+
+	if (!name) {
+		if (!view->line[view->lines - 1].data &&
+		    !add_line_nodata(view, LINE_STAT_NONE))
+			return FALSE;
+		return TRUE;
+	}
+
+	if (!add_line_alloc(view, &file, LINE_STAT_UNTRACKED, 0, FALSE))
+		return FALSE;
+
+	/* git-ls-files just delivers a NUL separated list of file names. */
+	file->status = '?';
+	string_ncopy(file->new.name, name, strlen(name));
+	string_copy(file->old.name, file->new.name);
 	return TRUE;
 }
 
+/* Add the untracked files listed so far, or all of them when blocking.
+ * Returns TRUE while the listing is running. */
+static bool
+status_read_untracked(struct view *view, bool block)
+{
+	struct status_state *state = view->private;
+	bool can_read;
+	char *name;
+	int digits;
+
+	if (!state || !state->listing)
+		return FALSE;
+
+	can_read = block || io_can_read(&state->untracked, FALSE);
+	while ((name = io_get(&state->untracked, 0, can_read))) {
+		can_read = block;
+		if (!read_view_line(view, name)) {
+			report("Allocation failure");
+			status_stop_untracked(state);
+			return FALSE;
+		}
+	}
+
+	if (io_error(&state->untracked)) {
+		report("Failed to read untracked files: %s", io_strerror(&state->untracked));
+		status_stop_untracked(state);
+
+	} else if (io_eof(&state->untracked)) {
+		if (!read_view_line(view, NULL))
+			report("Allocation failure");
+		io_done(&state->untracked);
+		state->listing = FALSE;
+	}
+
+	/* Restore the position unless it has been changed meanwhile. */
+	if (check_position(&state->restore) &&
+	    (!state->listing || status_has_file_from(view, state->restore.lineno))) {
+		if (!check_position(&view->pos)) {
+			view->prev_pos = state->restore;
+			status_restore(view);
+			goto_view_line(view, view->pos.offset, view->pos.lineno);
+			if (view_is_displayed(view))
+				werase(view->win);
+			view->force_redraw = TRUE;
+		}
+		clear_position(&state->restore);
+	}
+
+	digits = count_digits(view->lines);
+	if (digits != view->digits) {
+		view->digits = digits;
+		view->force_redraw = TRUE;
+	}
+
+	if (view_is_displayed(view))
+		view->redraw_pending = TRUE;
+
+	return state->listing;
+}
+
+static bool
+status_untracked_update(void)
+{
+	return status_read_untracked(VIEW(REQ_VIEW_STATUS), FALSE);
+}
+
+static struct io *
+status_untracked_pipe(void)
+{
+	struct status_state *state = VIEW(REQ_VIEW_STATUS)->private;
+
+	return state && state->listing ? &state->untracked : NULL;
+}
+
 static bool
 status_draw(struct view *view, struct line *line, unsigned int lineno)
 {
@@ -6842,6 +9360,9 @@ status_exists(struct view *view, struct status *status, enum line_type type)
 {
 	unsigned long lineno;
 
+	if (type == LINE_STAT_UNTRACKED)
+		status_read_untracked(view, TRUE);
+
 	for (lineno = 0; lineno < view->lines; lineno++) {
 		struct line *line = &view->line[lineno];
 		struct status *pos = line->data;
@@ -6961,6 +9482,12 @@ status_update(struct view *view)
 
 	assert(view->lines);
 
+	/* Updating the untracked files at once needs all of them. */
+	if (line->type == LINE_STAT_UNTRACKED && !line->data) {
+		status_read_untracked(view, TRUE);
+		line = &view->line[view->pos.lineno];
+	}
+
 	if (!line->data) {
 		if (status_has_none(view, line)) {
 			report("Nothing to update");
@@ -7190,20 +9717,19 @@ static struct view_ops status_ops = {
 	"file",
 	{ "status" },
 	VIEW_CUSTOM_STATUS | VIEW_SEND_CHILD_ENTER | VIEW_STATUS_LIKE,
-	0,
+	sizeof(struct status_state),
 	status_open,
-	NULL,
+	status_read,
 	status_draw,
 	status_request,
 	status_grep,
 	status_select,
+	status_done,
 };
 
 
 struct stage_state {
-	struct diff_state diff;
-	size_t chunks;
-	int *chunk;
+	struct diff_state diff;	/* Must be first for the diff helpers. */
 };
 
 static bool
@@ -7223,19 +9749,28 @@ stage_diff_write(struct io *io, struct line *line, struct line *end)
 }
 
 static bool
-stage_apply_chunk(struct view *view, struct line *chunk, struct line *line, bool revert)
+stage_apply_chunk(struct view *view, struct diff_chunk *diff_chunk, struct line *line, bool revert)
 {
 	const char *apply_argv[SIZEOF_ARG] = {
 		"git", "apply", "--whitespace=nowarn", NULL
 	};
+	struct diff_state *state = view->private;
+	struct diff_file *diff_file = diff_find_file(state, diff_chunk->lineno);
+	struct line *chunk = diff_get_line(view, diff_chunk->lineno);
+	struct line *end;
 	struct line *diff_hdr;
 	struct io io;
 	int argc = 3;
 
-	diff_hdr = find_prev_line_by_type(view, chunk, LINE_DIFF_HEADER);
-	if (!diff_hdr)
+	if (!diff_file)
 		return FALSE;
 
+	diff_hdr = diff_get_line(view, diff_file->lineno);
+	end = view->filter ? view->filter->line + view->filter->lines
+			   : view->line + view->lines;
+	if (line)
+		line = diff_get_line(view, diff_line_index(view, line));
+
 	if (!revert)
 		apply_argv[argc++] = "--cached";
 	if (line != NULL)
@@ -7255,7 +9790,9 @@ stage_apply_chunk(struct view *view, struct line *chunk, struct line *line, bool
 			line->type == LINE_DIFF_DEL ? ",0" : "",
 		};
 
-		parse_chunk_lineno(&lineno, chunk->data, line->type == LINE_DIFF_DEL ? '+' : '-');
+		if (diff_chunk->old_start >= 0)
+			lineno = line->type == LINE_DIFF_DEL
+			       ? diff_chunk->new_start : diff_chunk->old_start;
 
 		while (context < line) {
 			if (context->type == LINE_DIFF_CHUNK || context->type == LINE_DIFF_HEADER) {
@@ -7274,7 +9811,7 @@ stage_apply_chunk(struct view *view, struct line *chunk, struct line *line, bool
 		}
 	} else {
 		if (!stage_diff_write(&io, diff_hdr, chunk) ||
-		    !stage_diff_write(&io, chunk, view->line + view->lines))
+		    !stage_diff_write(&io, chunk, end))
 			chunk = NULL;
 	}
 
@@ -7286,10 +9823,11 @@ stage_apply_chunk(struct view *view, struct line *chunk, struct line *line, bool
 static bool
 stage_update(struct view *view, struct line *line, bool single)
 {
-	struct line *chunk = NULL;
+	struct stage_state *state = view->private;
+	struct diff_chunk *chunk = NULL;
 
 	if (!is_initial_commit() && stage_line_type != LINE_STAT_UNTRACKED)
-		chunk = find_prev_line_by_type(view, line, LINE_DIFF_CHUNK);
+		chunk = diff_find_chunk(&state->diff, diff_line_index(view, line));
 
 	if (chunk) {
 		if (!stage_apply_chunk(view, chunk, single ? line : NULL, FALSE)) {
@@ -7320,10 +9858,11 @@ stage_update(struct view *view, struct line *line, bool single)
 static bool
 stage_revert(struct view *view, struct line *line)
 {
-	struct line *chunk = NULL;
+	struct stage_state *state = view->private;
+	struct diff_chunk *chunk = NULL;
 
 	if (!is_initial_commit() && stage_line_type == LINE_STAT_UNSTAGED)
-		chunk = find_prev_line_by_type(view, line, LINE_DIFF_CHUNK);
+		chunk = diff_find_chunk(&state->diff, diff_line_index(view, line));
 
 	if (chunk) {
 		if (!prompt_yesno("Are you sure you want to revert changes?"))
@@ -7345,27 +9884,21 @@ stage_revert(struct view *view, struct line *line)
 static void
 stage_next(struct view *view, struct line *line)
 {
-	struct stage_state *state = view->private;
-	int i;
-
-	if (!state->chunks) {
-		for (line = view->line; view_has_line(view, line); line++) {
-			if (line->type != LINE_DIFF_CHUNK)
-				continue;
+	struct diff_state *state = view->private;
+	struct diff_chunk *chunk = NULL;
+	size_t i = 0;
 
-			if (!realloc_ints(&state->chunk, state->chunks, 1)) {
-				report("Allocation failure");
-				return;
-			}
+	if (view->lines)
+		chunk = diff_find_chunk(state, diff_line_index(view, &view->line[view->pos.lineno]));
+	if (chunk)
+		i = chunk - state->chunk + 1;
 
-			state->chunk[state->chunks++] = line - view->line;
-		}
-	}
+	if (i < state->chunks) {
+		unsigned long lineno = diff_view_lineno(view, state->chunk[i].lineno);
 
-	for (i = 0; i < state->chunks; i++) {
-		if (state->chunk[i] > view->pos.lineno) {
-			do_scroll_view(view, state->chunk[i] - view->pos.lineno);
-			report("Chunk %d of %zd", i + 1, state->chunks);
+		if (lineno < view->lines) {
+			do_scroll_view(view, lineno - view->pos.lineno);
+			report("Chunk %zd of %zd", i + 1, state->chunks);
 			return;
 		}
 	}
@@ -7552,7 +10085,7 @@ stage_read(struct view *view, char *data)
 static struct view_ops stage_ops = {
 	"line",
 	{ "stage" },
-	VIEW_DIFF_LIKE,
+	VIEW_DIFF_LIKE | VIEW_WRAP_LINES,
 	sizeof(struct stage_state),
 	stage_open,
 	stage_read,
@@ -7560,6 +10093,7 @@ static struct view_ops stage_ops = {
 	stage_request,
 	pager_grep,
 	pager_select,
+	diff_done,
 };
 
 
@@ -7636,33 +10170,13 @@ static bool draw_graph(struct view *view, struct graph_canvas *canvas)
  * Main view backend
  */
 
-struct commit {
-	char id[SIZEOF_REV];		/* SHA1 ID. */
-	const struct ident *author;	/* Author of the commit. */
-	struct time time;		/* Date from the author ident. */
-	struct graph_canvas graph;	/* Ancestry chain graphics. */
-	char title[1];			/* First line of the commit message. */
-};
-
 struct main_state {
 	struct graph graph;
-	struct commit current;
+	struct commit_parser parser;	/* Graph is NULL when not drawn. */
 	int id_width;
-	bool in_header;
 	bool added_changes_commits;
-	bool with_graph;
 };
 
-static void
-main_register_commit(struct view *view, struct commit *commit, const char *ids, bool is_boundary)
-{
-	struct main_state *state = view->private;
-
-	string_copy_rev(commit->id, ids);
-	if (state->with_graph)
-		graph_add_commit(&state->graph, &commit->graph, commit->id, ids, is_boundary);
-}
-
 static struct commit *
 main_add_commit(struct view *view, enum line_type type, struct commit *template,
 		const char *title, bool custom)
@@ -7681,10 +10195,7 @@ main_add_commit(struct view *view, enum line_type type, struct commit *template,
 	if (!add_line_alloc(view, &commit, type, titlelen, custom))
 		return NULL;
 
-	*commit = *template;
-	strncpy(commit->title, title, titlelen);
-	state->graph.canvas = &commit->graph;
-	memset(template, 0, sizeof(*template));
+	move_commit(commit, template, state->parser.graph, title, titlelen);
 	return commit;
 }
 
@@ -7726,9 +10237,9 @@ main_add_changes_commit(struct view *view, enum line_type type, const char *pare
 	}
 
 	commit.author = &unknown_ident;
-	main_register_commit(view, &commit, ids, FALSE);
-	if (main_add_commit(view, type, &commit, title, TRUE) && state->with_graph)
-		graph_render_parents(&state->graph);
+	parse_commit_ids(&commit, state->parser.graph, ids, FALSE);
+	if (main_add_commit(view, type, &commit, title, TRUE) && state->parser.graph)
+		graph_render_parents(state->parser.graph);
 }
 
 static void
@@ -7767,8 +10278,11 @@ main_open(struct view *view, enum open_flags flags)
 	};
 	struct main_state *state = view->private;
 
-	state->with_graph = opt_rev_graph;
-	return begin_update(view, NULL, main_argv, flags);
+	if (!begin_update(view, NULL, main_argv, flags))
+		return FALSE;
+
+	state->parser.graph = opt_rev_graph ? &state->graph : NULL;
+	return TRUE;
 }
 
 static void
@@ -7808,7 +10322,7 @@ main_draw(struct view *view, struct line *line, unsigned int lineno)
 	if (!commit->author)
 		return FALSE;
 
-	if (draw_lineno(view, lineno))
+	if (draw_lineno(view))
 		return TRUE;
 
 	if (opt_show_id) {
@@ -7827,7 +10341,7 @@ main_draw(struct view *view, struct line *line, unsigned int lineno)
 	if (draw_author(view, commit->author))
 		return TRUE;
 
-	if (state->with_graph && draw_graph(view, &commit->graph))
+	if (state->parser.graph && draw_graph(view, &commit->graph))
 		return TRUE;
 
 	if ((refs = main_get_commit_refs(line, commit)) && draw_refs(view, refs))
@@ -7843,9 +10357,9 @@ static bool
 main_read(struct view *view, char *line)
 {
 	struct main_state *state = view->private;
-	struct graph *graph = &state->graph;
-	enum line_type type;
-	struct commit *commit = &state->current;
+	struct commit_parser *parser = &state->parser;
+	struct commit *commit = &parser->commit;
+	char *text;
 
 	if (!line) {
 		main_flush_commit(view, commit);
@@ -7862,74 +10376,337 @@ main_read(struct view *view, char *line)
 			}
 		}
 
-		if (state->with_graph)
-			done_graph(graph);
-		return TRUE;
-	}
+		if (parser->graph)
+			done_graph(parser->graph);
+		return TRUE;
+	}
+
+	switch (parse_commit_line(parser, line, &text)) {
+	case COMMIT_LINE_ID:
+		if (!state->added_changes_commits && opt_show_changes && opt_is_inside_work_tree)
+			main_add_changes_commits(view, state, text);
+		else
+			main_flush_commit(view, commit);
+
+		parse_commit_ids(commit, parser->graph, text, parser->is_boundary);
+		break;
+
+	case COMMIT_LINE_TITLE:
+		main_add_commit(view, LINE_MAIN_COMMIT, commit, text, FALSE);
+		break;
+
+	default:
+		break;
+	}
+
+	return TRUE;
+}
+
+static bool
+main_search_history_arg(char search[SIZEOF_STR], const char *pattern)
+{
+	if (!prefixcmp(pattern, "author:"))
+		return string_format_size(search, SIZEOF_STR, "--author=%s", pattern + STRING_SIZE("author:"));
+	if (!prefixcmp(pattern, "-G") || !prefixcmp(pattern, "-S"))
+		return string_format_size(search, SIZEOF_STR, "%s", pattern);
+	return string_format_size(search, SIZEOF_STR, "--grep=%s", pattern);
+}
+
+static bool
+main_search_history_argv(struct view *view, const char ***argv, const char *search)
+{
+	bool searching = FALSE;
+	int i;
+
+	/* Reuse the arguments of the main view to get the commits in the
+	 * same order, but only ask for the IDs of the matching commits. */
+	for (i = 0; view->argv[i]; i++) {
+		const char *arg = view->argv[i];
+
+		if (!strcmp(arg, "--pretty=raw")) {
+			arg = "--pretty=format:%H";
+
+		} else if (!strcmp(arg, "--")) {
+			if (search &&
+			    (!argv_append(argv, "--extended-regexp") ||
+			     (opt_ignore_case && !argv_append(argv, "--regexp-ignore-case")) ||
+			     !argv_append(argv, search)))
+				return FALSE;
+			searching = TRUE;
+		}
+
+		if (!argv_append(argv, arg))
+			return FALSE;
+	}
+
+	return searching;
+}
+
+struct main_search {
+	const char *pattern;
+	unsigned long long progress;	/* When the progress was last shown. */
+	bool interrupted;		/* Escape was pressed. */
+	bool indexing;			/* The search index is being updated. */
+};
+
+/* Usecs between showing how far a history search has come. */
+#define MAIN_SEARCH_PROGRESS	100000
+
+/* Wait until there is something to read while showing the number of
+ * loaded commits now and then. Returns FALSE when the search has been
+ * stopped by pressing Escape. */
+static bool
+main_search_wait(struct view *view, struct main_search *search, struct io *io)
+{
+	while (TRUE) {
+		unsigned long long now = view_stats_clock();
+		unsigned long long next = search->progress + MAIN_SEARCH_PROGRESS;
+
+		if (now >= next) {
+			if (input_interrupted()) {
+				search->interrupted = TRUE;
+				return FALSE;
+			}
+
+			if (search->indexing)
+				report("Updating the search index, press Escape to stop");
+			else
+				report("Searching for '%s' in %lu loaded commits, press Escape to stop",
+				       search->pattern, view->lines);
+			doupdate();
+			search->progress = now;
+			next = now + MAIN_SEARCH_PROGRESS;
+		}
+
+		/* Sleep until the next progress report is due. */
+		if (io_can_read_within(io, next - now))
+			return TRUE;
+	}
+}
+
+/* Make sure the given line has been loaded. */
+static bool
+main_load_line(struct view *view, struct main_search *search, unsigned long lineno)
+{
+	while (lineno >= view->lines && view->pipe) {
+		if (!main_search_wait(view, search, view->pipe) ||
+		    !update_view(view))
+			break;
+	}
+
+	return lineno < view->lines;
+}
+
+static char *
+main_search_get(struct view *view, struct main_search *search, struct io *io)
+{
+	char *line = io_get(io, '\n', FALSE);
+
+	if (line || io_eof(io) || !main_search_wait(view, search, io))
+		return line;
+	return io_get(io, '\n', TRUE);
+}
+
+static int
+compare_trigram_candidate(const void *id, const void *candidate)
+{
+	return strcmp(id, candidate);
+}
+
+/* Let git find the commits matching the pattern. Since the matching commits
+ * are streamed in the same order as they appear in the main view, it is only
+ * loaded up to the first match after the current line. When the matching
+ * commits are already known, git only lists the commits of the view and
+ * the ones which are not among the given IDs are skipped. */
+static bool
+main_search_git(struct view *view, struct main_search *progress, const char *search,
+		char (*ids)[SIZEOF_REV], size_t ids_size,
+		unsigned long *lineno, char unloaded[SIZEOF_REV])
+{
+	const char **argv = NULL;
+	bool found = FALSE;
+	struct io io;
+	char *id;
+
+	if (!main_search_history_argv(view, &argv, search) ||
+	    !io_run(&io, IO_RD, NULL, opt_env, argv)) {
+		argv_free(argv);
+		free(argv);
+		return FALSE;
+	}
+
+	for (*lineno = 0; !found && (id = main_search_get(view, progress, &io)); ) {
+		if (ids && !bsearch(id, ids, ids_size, sizeof(*ids), compare_trigram_candidate))
+			continue;
+
+		for (; main_load_line(view, progress, *lineno); (*lineno)++) {
+			struct commit *commit = view->line[*lineno].data;
+
+			if (strncmp(commit->id, id, SIZEOF_REV - 1))
+				continue;
+
+			found = *lineno > view->pos.lineno;
+			break;
+		}
+
+		/* The view has been loaded without finding the commit. */
+		if (*lineno >= view->lines) {
+			if (!progress->interrupted)
+				string_copy_rev(unloaded, id);
+			break;
+		}
+	}
+
+	io_kill(&io);
+	io_done(&io);
+	argv_free(argv);
+	free(argv);
+
+	if (!found)
+		*lineno = view->lines;
+	return TRUE;
+}
+
+static struct trigram_index *main_trigram_index;
+
+static bool
+main_trigram_index_path(char path[SIZEOF_STR])
+{
+	return string_format_size(path, SIZEOF_STR, "%s/tig", opt_git_dir) &&
+	       (!access(path, F_OK) || !mkdir(path, 0777)) &&
+	       string_format_size(path, SIZEOF_STR, "%s/tig/trigrams", opt_git_dir);
+}
+
+/* Let git check which of the commits found in the index match the
+ * search. The matching IDs replace the candidates and are sorted. */
+static bool
+main_search_verify(const char *search, char (*ids)[SIZEOF_REV], size_t *ids_size)
+{
+	const char *verify_argv[] = {
+		"git", "rev-list", "--no-walk", "--stdin", "--ignore-missing",
+			"--extended-regexp", NULL, NULL, NULL
+	};
+	int argc = 6;
+	size_t matches = 0;
+	struct io io;
+	char *id;
+	size_t i;
+
+	if (opt_ignore_case)
+		verify_argv[argc++] = "--regexp-ignore-case";
+	verify_argv[argc++] = search;
+
+	if (!io_run(&io, IO_RD_WR, NULL, opt_env, verify_argv))
+		return FALSE;
+
+	/* All candidates are read before any commit is listed. */
+	for (i = 0; i < *ids_size; i++)
+		if (!io_printf(&io, "%s\n", ids[i]))
+			break;
+	io_close_write(&io);
+
+	while (i == *ids_size && matches < *ids_size &&
+	       (id = io_get(&io, '\n', TRUE)))
+		string_copy_rev(ids[matches++], id);
+
+	if (!io_done(&io) || i < *ids_size)
+		return FALSE;
 
-	type = get_line_type(line);
-	if (type == LINE_COMMIT) {
-		bool is_boundary;
+	qsort(ids, matches, sizeof(*ids), compare_trigram_candidate);
+	*ids_size = matches;
+	return TRUE;
+}
 
-		state->in_header = TRUE;
-		line += STRING_SIZE("commit ");
-		is_boundary = *line == '-';
-		if (is_boundary || !isalnum(*line))
-			line++;
+/* Show the progress while git lists the commits to add to the index. */
+static bool
+main_search_index_wait(struct io *io, void *data)
+{
+	return main_search_wait(VIEW(REQ_VIEW_MAIN), data, io);
+}
 
-		if (!state->added_changes_commits && opt_show_changes && opt_is_inside_work_tree)
-			main_add_changes_commits(view, state, line);
-		else
-			main_flush_commit(view, commit);
+/* Use the trigram index to find the commits which may match and let git
+ * check them in one go. The matches may be on branches which are not in
+ * the view, so unless one of them has already been loaded after the
+ * current line, the view's own commits are listed to find the next one.
+ * Returns FALSE if the index cannot answer the search or updating it
+ * was stopped. */
+static bool
+main_search_index(struct view *view, struct main_search *progress, const char *pattern,
+		  const char *search, unsigned long *lineno, char unloaded[SIZEOF_REV])
+{
+	char path[SIZEOF_STR];
+	enum trigram_field field = TRIGRAM_MESSAGE;
+	char (*ids)[SIZEOF_REV];
+	size_t ids_size;
+	bool ok;
 
-		main_register_commit(view, &state->current, line, is_boundary);
-		return TRUE;
+	if (!prefixcmp(pattern, "-G") || !prefixcmp(pattern, "-S"))
+		return FALSE;
+	if (!prefixcmp(pattern, "author:")) {
+		pattern += STRING_SIZE("author:");
+		field = TRIGRAM_AUTHOR;
 	}
 
-	if (!*commit->id)
-		return TRUE;
+	/* The index is only used once it is up to date. */
+	progress->indexing = TRUE;
+	ok = main_trigram_index_path(path) &&
+	     trigram_index_update(&main_trigram_index, path, main_search_index_wait, progress);
+	progress->indexing = FALSE;
 
-	/* Empty line separates the commit header from the log itself. */
-	if (*line == '\0')
-		state->in_header = FALSE;
+	if (!ok || !trigram_index_search(main_trigram_index, field, pattern, &ids, &ids_size))
+		return FALSE;
 
-	switch (type) {
-	case LINE_PARENT:
-		if (state->with_graph && !graph->has_parents)
-			graph_add_parent(graph, line + STRING_SIZE("parent "));
-		break;
+	if (ids_size && !main_search_verify(search, ids, &ids_size)) {
+		free(ids);
+		return FALSE;
+	}
 
-	case LINE_AUTHOR:
-		parse_author_line(line + STRING_SIZE("author "),
-				  &commit->author, &commit->time);
-		if (state->with_graph)
-			graph_render_parents(graph);
-		break;
+	for (*lineno = view->pos.lineno + 1; *lineno < view->lines; (*lineno)++) {
+		struct commit *commit = view->line[*lineno].data;
 
-	default:
-		/* Fill in the commit title if it has not already been set. */
-		if (*commit->title)
+		if (bsearch(commit->id, ids, ids_size, sizeof(*ids), compare_trigram_candidate))
 			break;
+	}
 
-		/* Skip lines in the commit header. */
-		if (state->in_header)
-			break;
+	ok = *lineno < view->lines || !ids_size ||
+	     main_search_git(view, progress, NULL, ids, ids_size, lineno, unloaded);
+	free(ids);
+	return ok;
+}
 
-		/* Require titles to start with a non-space character at the
-		 * offset used by git log. */
-		if (strncmp(line, "    ", 4))
-			break;
-		line += 4;
-		/* Well, if the title starts with a whitespace character,
-		 * try to be forgiving.  Otherwise we end up with no title. */
-		while (isspace(*line))
-			line++;
-		if (*line == '\0')
-			break;
-		main_add_commit(view, LINE_MAIN_COMMIT, commit, line, FALSE);
+static void
+main_search_history(struct view *view, const char *pattern)
+{
+	struct main_search progress = { pattern, view_stats_clock() };
+	char search[SIZEOF_STR];
+	char unloaded[SIZEOF_REV] = "";
+	unsigned long lineno;
+
+	if (view->unrefreshable || !view->argv) {
+		report("Searching the history is not supported for this main view");
+		return;
 	}
 
-	return TRUE;
+	clear_view_filter(view);
+
+	if (!main_search_history_arg(search, pattern) ||
+	    (!(opt_search_index && main_search_index(view, &progress, pattern, search, &lineno, unloaded)) &&
+	     !progress.interrupted &&
+	     !main_search_git(view, &progress, search, NULL, 0, &lineno, unloaded))) {
+		report("Failed to search the history");
+		return;
+	}
+
+	if (progress.interrupted) {
+		report("Stopped searching for '%s'", pattern);
+	} else if (lineno < view->lines) {
+		select_view_line(view, lineno);
+		report("Commit %d matches '%s'", view->line[lineno].lineno, pattern);
+	} else if (*unloaded) {
+		report("Commit %.7s matches '%s' but is not in this view", unloaded, pattern);
+	} else {
+		report("No match found for '%s'", pattern);
+	}
 }
 
 static enum request
@@ -7980,6 +10757,18 @@ main_request(struct view *view, enum request request, struct line *line)
 		refresh_view(view);
 		break;
 
+	case REQ_SEARCH_HISTORY:
+	{
+		static char pattern[SIZEOF_STR];
+		const char *search = read_prompt("Search history: ");
+
+		if (search)
+			string_ncopy(pattern, search, strlen(search));
+		if (*pattern)
+			main_search_history(view, pattern);
+		break;
+	}
+
 	case REQ_JUMP_COMMIT:
 	{
 		int lineno;
@@ -8076,11 +10865,11 @@ static bool
 stash_read(struct view *view, char *line)
 {
 	struct main_state *state = view->private;
-	struct commit *commit = &state->current;
+	struct commit *commit = &state->parser.commit;
 
 	if (!state->added_changes_commits) {
 		state->added_changes_commits = TRUE;
-		state->with_graph = FALSE;
+		state->parser.graph = NULL;
 	}
 
 	if (commit && line && get_line_type(line) == LINE_PP_REFLOG) {
@@ -8123,6 +10912,7 @@ static struct view_ops stash_ops = {
 
 /* Whether or not the curses interface has been initialized. */
 static bool cursed = FALSE;
+static bool headless = FALSE;
 
 /* Terminal hacks and workarounds. */
 static bool use_scroll_redrawwin;
@@ -8183,7 +10973,15 @@ init_display(void)
 	int x, y;
 
 	/* Initialize the curses library */
-	if (isatty(STDIN_FILENO)) {
+	if (getenv("TIG_NO_DISPLAY")) {
+		/* Draw to a screen which is never shown. The screen size
+		 * can be controlled using the LINES and COLUMNS variables. */
+		headless = TRUE;
+		opt_tty = fopen("/dev/null", "r+");
+		if (!opt_tty)
+			die("Failed to open /dev/null");
+		cursed = !!newterm(getenv("TERM") ? NULL : "vt100", opt_tty, opt_tty);
+	} else if (isatty(STDIN_FILENO)) {
 		cursed = !!initscr();
 		opt_tty = stdin;
 	} else {
@@ -8202,8 +11000,8 @@ init_display(void)
 	noecho();       /* Don't echo input */
 	leaveok(stdscr, FALSE);
 
-	if (has_colors())
-		init_colors();
+	if (has_colors() && !init_colors())
+		die("Failed to initialize colors");
 
 	getmaxyx(stdscr, y, x);
 	status_win = newwin(1, x, y - 1, 0);
@@ -8242,6 +11040,442 @@ init_display(void)
 	}
 }
 
+/*
+ * Headless mode.
+ *
+ * When TIG_NO_DISPLAY is set, the view given on the command line is
+ * loaded and every line is drawn page by page to the hidden screen. The
+ * drawn text is written to stdout and timing to stderr.
+ */
+
+static void
+headless_dump_view(struct view *view)
+{
+	unsigned long rows = get_view_row(view, view->lines);
+	char text[SIZEOF_STR];
+	unsigned long top;
+	int row;
+
+	for (top = 0; top < rows; top += view->height) {
+		set_view_top_row(view, top);
+		view->pos.lineno = view->pos.offset;
+		redraw_view(view);
+
+		for (row = 0; row < view->height && top + row < rows; row++) {
+			int length = mvwinnstr(view->win, row, 0, text, sizeof(text) - 1);
+
+			if (length < 0)
+				length = 0;
+			while (length > 0 && text[length - 1] == ' ')
+				length--;
+			printf("%.*s\n", length, text);
+		}
+	}
+}
+
+static void TIG_NORETURN
+run_headless(enum request request)
+{
+	unsigned long long start = view_stats_clock();
+	unsigned long long loaded, drawn;
+	char stats[SIZEOF_STR];
+	size_t statspos = 0;
+	struct view *view;
+	int i;
+
+	view_driver(display[current_view], request);
+
+	/* Sleep until one of the views has something to read instead of
+	 * polling them. */
+	while (TRUE) {
+		struct io *pipes[ARRAY_SIZE(views) + 1];
+		size_t pipes_size = 0;
+
+		foreach_view (view, i)
+			if (view->pipe)
+				pipes[pipes_size++] = view->pipe;
+		if (status_untracked_pipe())
+			pipes[pipes_size++] = status_untracked_pipe();
+		if (!pipes_size)
+			break;
+
+		io_can_read_any(pipes, pipes_size);
+		foreach_view (view, i)
+			update_view(view);
+		status_untracked_update();
+	}
+
+	loaded = view_stats_clock();
+	view = display[current_view];
+	headless_dump_view(view);
+	drawn = view_stats_clock();
+
+	fflush(stdout);
+	format_view_stats(view, stats, sizeof(stats), &statspos);
+	fprintf(stderr, "%s view: loaded in %.3fs, drew %zu lines in %.3fs\n",
+		view->name, (loaded - start) / 1000000.0, view->lines,
+		(drawn - loaded) / 1000000.0);
+	if (view->stats.lines)
+		fprintf(stderr, "%s view: %s\n", view->name, stats);
+
+	quit(0);
+}
+
+/*
+ * Latency instrumentation.
+ *
+ * When TIG_LATENCY names a file, the time from reading a key until the
+ * screen has been updated is recorded for each request in a histogram
+ * and written to the file when tig exits.
+ */
+
+#define LATENCY_BUCKETS		32
+#define LATENCY_REQUESTS	(REQ_NONE - REQ_OFFSET + 1)
+
+struct latency_histogram {
+	unsigned long count;
+	unsigned long buckets[LATENCY_BUCKETS];	/* Latencies below 2^i usecs. */
+	unsigned long max;
+	unsigned long long dispatch;		/* Time spent in view_driver(). */
+	unsigned long long git;			/* Time spent waiting for git. */
+	unsigned long git_runs;
+};
+
+static struct latency_histogram *latency_histograms;
+static struct timeval latency_key_time;
+static struct timeval latency_dispatch_time;
+static unsigned long latency_dispatch;
+static struct io_sync_stats latency_sync;
+static enum request latency_request;
+static bool latency_pending;
+
+static unsigned long
+latency_usecs_since(struct timeval *start)
+{
+	struct timeval now;
+	long usecs;
+
+	gettimeofday(&now, NULL);
+	usecs = (now.tv_sec - start->tv_sec) * 1000000 + (now.tv_usec - start->tv_usec);
+	return usecs > 0 ? usecs : 0;
+}
+
+static void
+latency_init(void)
+{
+	const char *file = getenv("TIG_LATENCY");
+
+	if (file && *file)
+		latency_histograms = calloc(LATENCY_REQUESTS, sizeof(*latency_histograms));
+}
+
+static void
+latency_key_read(void)
+{
+	if (latency_histograms)
+		gettimeofday(&latency_key_time, NULL);
+}
+
+static void
+latency_begin(enum request request)
+{
+	if (!latency_histograms)
+		return;
+
+	gettimeofday(&latency_dispatch_time, NULL);
+	latency_sync = *io_get_sync_stats();
+	latency_request = request;
+	latency_dispatch = 0;
+	latency_pending = TRUE;
+}
+
+/* Called when the request has been handled and the result is about to be
+ * drawn, or when the request asks for more input. */
+static void
+latency_dispatched(void)
+{
+	if (latency_pending && !latency_dispatch)
+		latency_dispatch = MAX(latency_usecs_since(&latency_dispatch_time), 1);
+}
+
+static void
+latency_painted(void)
+{
+	const struct io_sync_stats *sync = io_get_sync_stats();
+	struct latency_histogram *histogram;
+	unsigned long usecs;
+	int bucket;
+
+	if (!latency_pending)
+		return;
+
+	latency_dispatched();
+	latency_pending = FALSE;
+	usecs = latency_usecs_since(&latency_key_time);
+
+	/* Slot zero is used for run requests and unbound keys. */
+	histogram = &latency_histograms[0];
+	if (REQ_OFFSET < latency_request && latency_request <= REQ_NONE)
+		histogram = &latency_histograms[latency_request - REQ_OFFSET];
+
+	for (bucket = 0; bucket < LATENCY_BUCKETS - 1; bucket++)
+		if (usecs < (1UL << bucket))
+			break;
+	histogram->buckets[bucket]++;
+	histogram->count++;
+	histogram->max = MAX(histogram->max, usecs);
+	histogram->dispatch += latency_dispatch;
+	histogram->git += sync->usecs - latency_sync.usecs;
+	histogram->git_runs += sync->runs - latency_sync.runs;
+}
+
+/* Returns the upper bound of the bucket containing the given percentile. */
+static unsigned long
+latency_percentile(struct latency_histogram *histogram, int percentile)
+{
+	unsigned long rank = (histogram->count * percentile + 99) / 100;
+	unsigned long count = 0;
+	int bucket;
+
+	for (bucket = 0; bucket < LATENCY_BUCKETS - 1; bucket++) {
+		count += histogram->buckets[bucket];
+		if (count >= rank)
+			break;
+	}
+
+	return MIN(1UL << bucket, histogram->max);
+}
+
+static void
+latency_dump(void)
+{
+	FILE *file;
+	int i;
+
+	if (!latency_histograms || !(file = fopen(getenv("TIG_LATENCY"), "w")))
+		return;
+
+	fprintf(file, "# Time in usecs from reading a key until the screen is updated.\n");
+	fprintf(file, "# Percentiles are the upper bound of the histogram bucket.\n");
+	fprintf(file, "# Dispatch and git are averages of the time spent handling\n");
+	fprintf(file, "# the request and waiting for git commands.\n");
+	fprintf(file, "%-24s %8s %9s %9s %9s %9s %9s %6s\n",
+		"# request", "count", "p50", "p99", "max", "dispatch", "git", "runs");
+
+	for (i = 0; i < LATENCY_REQUESTS; i++) {
+		struct latency_histogram *histogram = &latency_histograms[i];
+		const char *name = "other";
+		int j;
+
+		if (!histogram->count)
+			continue;
+
+		for (j = 0; i && j < ARRAY_SIZE(req_info); j++)
+			if (req_info[j].request == i + REQ_OFFSET)
+				name = enum_name(req_info[j]);
+
+		fprintf(file, "%-24s %8lu %9lu %9lu %9lu %9llu %9llu %6lu\n",
+			name, histogram->count,
+			latency_percentile(histogram, 50),
+			latency_percentile(histogram, 99),
+			histogram->max,
+			histogram->dispatch / histogram->count,
+			histogram->git / histogram->count,
+			histogram->git_runs);
+	}
+
+	fclose(file);
+}
+
+/*
+ * Script replay.
+ *
+ * When TIG_SCRIPT names a file, keys are read from it instead of from
+ * the terminal. Each line is a step: either key names separated by
+ * spaces, where a key name can be followed by '*' and a repeat count, or
+ * a prompt (':'), search ('/') or backward search ('?') followed by the
+ * text to enter. The next step is started once all views have finished
+ * loading, and the time at which each step completed is written to
+ * stdout when the end of the script is reached.
+ */
+
+struct script_step {
+	char *text;			/* The script line. */
+	size_t key;			/* Index of the first key. */
+	size_t keys;			/* Number of keys. */
+	unsigned long long done;	/* Time the step was completed. */
+};
+
+static struct script_step *script_steps;
+static size_t script_steps_size;
+static int *script_keys;
+static size_t script_keys_size;
+static size_t script_step;
+static size_t script_pos;
+static unsigned long long script_start;
+
+DEFINE_ALLOCATOR(realloc_script_steps, struct script_step, 16)
+DEFINE_ALLOCATOR(realloc_script_keys, int, 256)
+
+static bool
+script_add_key(int key, int count)
+{
+	if (!realloc_script_keys(&script_keys, script_keys_size, count))
+		return FALSE;
+	while (count-- > 0)
+		script_keys[script_keys_size++] = key;
+	return TRUE;
+}
+
+static bool
+script_add_step(const char *text)
+{
+	struct script_step *step;
+
+	if (!realloc_script_steps(&script_steps, script_steps_size, 1))
+		return FALSE;
+	step = &script_steps[script_steps_size++];
+	step->text = strdup(text);
+	step->key = script_keys_size;
+	step->keys = 0;
+	return step->text != NULL;
+}
+
+static bool
+script_parse_line(char *line, int lineno)
+{
+	struct script_step *step;
+	char *name;
+
+	if (!script_add_step(line))
+		return FALSE;
+
+	if (strchr(":/?", *line)) {
+		for (; *line; line++)
+			if (!script_add_key((unsigned char) *line, 1))
+				return FALSE;
+		if (!script_add_key(KEY_RETURN, 1))
+			return FALSE;
+
+	} else {
+		for (name = strtok(line, " \t"); name; name = strtok(NULL, " \t")) {
+			char *repeat = strrchr(name, '*');
+			int count = 1;
+			int key;
+
+			if (repeat && repeat > name && isdigit(repeat[1])) {
+				*repeat = 0;
+				count = atoi(repeat + 1);
+			}
+
+			key = get_key_value(name);
+			if (key == ERR)
+				die("Invalid key '%s' in script line %d", name, lineno);
+			if (!script_add_key(key, count))
+				return FALSE;
+		}
+	}
+
+	step = &script_steps[script_steps_size - 1];
+	step->keys = script_keys_size - step->key;
+	return TRUE;
+}
+
+static bool
+script_init(void)
+{
+	const char *path = getenv("TIG_SCRIPT");
+	char line[SIZEOF_STR];
+	int lineno = 0;
+	FILE *file;
+
+	if (!path || !*path)
+		return FALSE;
+
+	file = fopen(path, "r");
+	if (!file)
+		die("Failed to open script %s", path);
+
+	script_start = view_stats_clock();
+	if (!script_add_step("(startup)"))
+		die("Failed to allocate script");
+
+	while (fgets(line, sizeof(line), file)) {
+		size_t linelen = strlen(line);
+
+		lineno++;
+		while (linelen > 0 && isspace(line[linelen - 1]))
+			line[--linelen] = 0;
+		if (!*line || *line == '#')
+			continue;
+		if (!script_parse_line(line, lineno))
+			die("Failed to allocate script");
+	}
+
+	fclose(file);
+	return TRUE;
+}
+
+static void TIG_NORETURN
+script_done(void)
+{
+	unsigned long long prev = script_start;
+	int i;
+
+	latency_dump();
+	if (cursed) {
+		endwin();
+		cursed = FALSE;
+	}
+
+	for (i = 0; i < script_steps_size; i++) {
+		struct script_step *step = &script_steps[i];
+
+		printf("%9.3fs %9.3fs  %s\n", (step->done - script_start) / 1000000.0,
+		       (step->done - prev) / 1000000.0, step->text);
+		prev = step->done;
+	}
+
+	quit(0);
+}
+
+static int
+script_next_key(void)
+{
+	unsigned long long now = view_stats_clock();
+
+	while (script_step < script_steps_size) {
+		struct script_step *step = &script_steps[script_step];
+
+		if (script_pos < step->key + step->keys)
+			return script_keys[script_pos++];
+
+		/* All keys have been handled and loading has finished. */
+		step->done = now;
+		script_step++;
+	}
+
+	script_done();
+}
+
+/* Check whether Escape has been pressed during a request which keeps
+ * the input from being read. Other keys are dropped. */
+static bool
+input_interrupted(void)
+{
+	int key;
+
+	if (script_steps)
+		return FALSE;
+
+	wtimeout(status_win, 0);
+	while ((key = wgetch(status_win)) != ERR)
+		if (key == KEY_ESC)
+			return TRUE;
+
+	return FALSE;
+}
+
 static int
 get_input(int prompt_position)
 {
@@ -8251,8 +11485,12 @@ get_input(int prompt_position)
 	if (prompt_position)
 		input_mode = TRUE;
 
+	latency_dispatched();
+
 	while (TRUE) {
 		bool loading = FALSE;
+		bool background;
+		bool redraw;
 
 		foreach_view (view, i) {
 			update_view(view);
@@ -8264,6 +11502,24 @@ get_input(int prompt_position)
 				loading = TRUE;
 		}
 
+		if (status_untracked_update())
+			loading = TRUE;
+
+		background = blame_prefetch_update();
+		if (blame_range_update())
+			background = TRUE;
+		if (tree_prefetch_update())
+			background = TRUE;
+		if (tree_sizes_update())
+			background = TRUE;
+
+		redraw = !loading || redraw_is_due();
+		if (redraw) {
+			foreach_displayed_view (view, i)
+				redraw_pending_view(view);
+			redraw_forced = FALSE;
+		}
+
 		/* Update the cursor position. */
 		if (prompt_position) {
 			getbegyx(status_win, cursor_y, cursor_x);
@@ -8272,17 +11528,26 @@ get_input(int prompt_position)
 			view = display[current_view];
 			getbegyx(view->win, cursor_y, cursor_x);
 			cursor_x = view->width - 1;
-			cursor_y += view->pos.lineno - view->pos.offset;
+			cursor_y += get_view_row(view, view->pos.lineno) -
+				    MIN(get_view_top_row(view), get_view_row(view, view->pos.lineno));
 		}
 		setsyx(cursor_y, cursor_x);
 
 		/* Refresh, accept single keystroke of input */
-		doupdate();
-		nodelay(status_win, loading);
-		key = wgetch(status_win);
+		if (redraw) {
+			doupdate();
+			latency_painted();
+		}
+		if (script_steps) {
+			key = loading ? ERR : script_next_key();
+		} else {
+			/* Wake up now and then to continue background work. */
+			wtimeout(status_win, loading ? 0 : background ? 20 : -1);
+			key = wgetch(status_win);
+		}
 
-		/* wgetch() with nodelay() enabled returns ERR when
-		 * there's no input. */
+		/* wgetch() with a timeout returns ERR when there's no
+		 * input. */
 		if (key == ERR) {
 
 		} else if (key == KEY_RESIZE) {
@@ -8298,6 +11563,8 @@ get_input(int prompt_position)
 
 		} else {
 			input_mode = FALSE;
+			redraw_forced = TRUE;
+			latency_key_read();
 			if (key == erasechar())
 				key = KEY_BACKSPACE;
 			return key;
@@ -8329,10 +11596,12 @@ prompt_input(const char *prompt, input_handler handler, void *data)
 			break;
 
 		case KEY_BACKSPACE:
-			if (pos > 0)
+			if (pos > 0) {
 				buf[--pos] = 0;
-			else
+				status = handler(data, buf, key);
+			} else {
 				status = INPUT_CANCEL;
+			}
 			break;
 
 		case KEY_ESC:
@@ -8340,14 +11609,16 @@ prompt_input(const char *prompt, input_handler handler, void *data)
 			break;
 
 		default:
-			if (pos >= sizeof(buf)) {
+			if (pos >= sizeof(buf) - 1) {
 				report("Input string too long");
 				return NULL;
 			}
 
 			status = handler(data, buf, key);
-			if (status == INPUT_OK)
+			if (status == INPUT_OK) {
 				buf[pos++] = (char) key;
+				buf[pos] = 0;
+			}
 		}
 	}
 
@@ -8387,7 +11658,7 @@ prompt_yesno(const char *prompt)
 static enum input_status
 read_prompt_handler(void *data, char *buf, int c)
 {
-	return isprint(c) ? INPUT_OK : INPUT_SKIP;
+	return c < 256 && isprint(c) ? INPUT_OK : INPUT_SKIP;
 }
 
 static char *
@@ -8524,7 +11795,7 @@ set_work_tree(const char *value)
 static void
 parse_git_color_option(enum line_type type, char *value)
 {
-	struct line_info *info = &line_info[type];
+	struct line_info *info = get_line(type);
 	const char *argv[SIZEOF_ARG];
 	int argc = 0;
 	bool first_color = TRUE;
@@ -8837,9 +12108,14 @@ parse_options(int argc, const char *argv[])
 	const char *subcommand;
 	bool seen_dashdash = FALSE;
 	const char **filter_argv = NULL;
+	struct stat stdin_stat;
 	int i;
 
 	opt_stdin = !isatty(STDIN_FILENO);
+	/* Without a display only use stdin if something is piped to it. */
+	if (opt_stdin && getenv("TIG_NO_DISPLAY") &&
+	    !fstat(STDIN_FILENO, &stdin_stat) && S_ISCHR(stdin_stat.st_mode))
+		opt_stdin = FALSE;
 	request = opt_stdin ? REQ_VIEW_PAGER : REQ_VIEW_MAIN;
 
 	if (argc <= 1)
@@ -8973,6 +12249,7 @@ run_prompt_command(struct view *view, char *cmd) {
 		if (args) {
 			*args++ = 0;
 			if (set_option(cmd, args) == OPT_OK) {
+				invalidate_render_cache();
 				request = !view->unrefreshable ? REQ_REFRESH : REQ_SCREEN_REDRAW;
 				if (!strcmp(cmd, "color"))
 					init_colors();
@@ -9030,7 +12307,17 @@ main(int argc, const char *argv[])
 	if (load_refs(FALSE) == ERR)
 		die("Failed to load refs.");
 
+	if (opt_search_index) {
+		char path[SIZEOF_STR];
+
+		if (string_format(path, "%s/tig/trigrams", opt_git_dir))
+			main_trigram_index = trigram_index_open(path);
+	}
+
 	init_display();
+	if (!script_init() && headless)
+		run_headless(request);
+	latency_init();
 
 	while (view_driver(display[current_view], request)) {
 		int key = get_input(0);
@@ -9073,8 +12360,11 @@ main(int argc, const char *argv[])
 		default:
 			break;
 		}
+
+		latency_begin(request);
 	}
 
+	latency_dump();
 	quit(0);
 
 	return 0;
@@ -40,6 +40,7 @@
 #include <ctype.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -58,6 +59,10 @@
 #include <langinfo.h>
 #include <iconv.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /* ncurses(3): Must be defined to have extended wide-character functions. */
 #define _XOPEN_SOURCE_EXTENDED
 
@@ -313,12 +318,59 @@ string_expanded_length(const char *src, size_t srclen, size_t tabsize, size_t ma
 	return pos;
 }
 
+/* Returns the number of leading bytes of string up to the first tab or, if
+ * ascii is TRUE, the first byte which is not an ASCII character. Runs of
+ * ASCII characters other than tab are all one byte long and one column
+ * wide. */
+static inline size_t
+string_span_plain(const char *string, size_t length, bool ascii)
+{
+	size_t pos = 0;
+
+#ifdef __SSE2__
+	const __m128i tabs = _mm_set1_epi8('\t');
+
+	for (; pos + 16 <= length; pos += 16) {
+		__m128i bytes = _mm_loadu_si128((const __m128i *) (string + pos));
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, tabs));
+
+		if (ascii)
+			mask |= _mm_movemask_epi8(bytes);
+		if (mask)
+			return pos + __builtin_ctz(mask);
+	}
+#endif
+
+	/* Check 8 bytes at a time for tabs by looking for zero bytes after
+	 * XOR'ing with tabs, and optionally for high bits. The exact
+	 * position is found by the byte loop below. */
+	for (; pos + 8 <= length; pos += 8) {
+		const uint64_t ones = 0x0101010101010101ULL;
+		const uint64_t highs = 0x8080808080808080ULL;
+		uint64_t bytes, tabs;
+
+		memcpy(&bytes, string + pos, sizeof(bytes));
+		tabs = bytes ^ (ones * '\t');
+		if ((((tabs - ones) & ~tabs) | (ascii ? bytes : 0)) & highs)
+			break;
+	}
+
+	for (; pos < length; pos++)
+		if (string[pos] == '\t' || (ascii && (unsigned char) string[pos] >= 0x80))
+			break;
+
+	return pos;
+}
+
 static inline size_t
 string_expand(char *dst, size_t dstlen, const char *src, int tabsize)
 {
+	/* At least one byte is written for each source byte, so there is
+	 * no need to look further than the size of the destination. */
+	size_t srclen = strnlen(src, dstlen);
 	size_t size, pos;
 
-	for (size = pos = 0; size < dstlen - 1 && src[pos]; pos++) {
+	for (size = pos = 0; size < dstlen - 1 && pos < srclen; ) {
 		if (src[pos] == '\t') {
 			size_t expanded = tabsize - (size % tabsize);
 
@@ -326,8 +378,21 @@ string_expand(char *dst, size_t dstlen, const char *src, int tabsize)
 				expanded = dstlen - size - 1;
 			memcpy(dst + size, "        ", expanded);
 			size += expanded;
+			pos++;
 		} else {
-			dst[size++] = src[pos];
+			size_t length = MIN(srclen - pos, dstlen - 1 - size);
+			size_t run = 0;
+
+			/* Short runs between tabs are faster to scan byte by
+			 * byte. */
+			while (run < length && run < 16 && src[pos + run] != '\t')
+				run++;
+			if (run == 16)
+				run += string_span_plain(src + pos + run, length - run, FALSE);
+
+			memcpy(dst + size, src + pos, run);
+			size += run;
+			pos += run;
 		}
 	}
 
@@ -591,6 +656,24 @@ utf8_length(const char **start, size_t skip, int *width, size_t max_width, int *
 		unsigned char bytes = utf8_char_length(string, end);
 		size_t ucwidth;
 		unsigned long unicode;
+		size_t ascii;
+
+		/* Take runs of ASCII characters fitting within the maximum
+		 * width in one go and leave the rest to the loop below. */
+		ascii = bytes == 1 && *string != '\t' && *width < max_width
+		      ? string_span_plain(string, MIN(max_width - *width, end - string), TRUE)
+		      : 0;
+		if (ascii > 0) {
+			size_t skipped = MIN(skip, ascii);
+
+			skip -= skipped;
+			*start += skipped;
+			*width += ascii;
+			string += ascii;
+			last_bytes = 1;
+			last_ucwidth = 1;
+			continue;
+		}
 
 		if (string + bytes > end)
 			break;
@@ -0,0 +1,277 @@
+/* Copyright (c) 2006-2013 Jonas Fonseca <fonseca@diku.dk>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "../tig.h"
+#include "../io.h"
+#include "../line.h"
+#include "../parse.h"
+
+#define USAGE \
+"bench-blame [iterations [file]]\n" \
+"\n" \
+"Measures how fast the commits of `git blame --incremental` output are\n" \
+"looked up when loading the blame view, once by scanning the lines of\n" \
+"the view like older versions did and once with the commit table. Without\n" \
+"a file, output is generated for a file with 50000 lines changed by 5000\n" \
+"commits."
+
+#define BENCH_LINES	50000
+#define BENCH_COMMITS	5000
+
+/*
+ * Blame output
+ */
+
+struct recording {
+	char *buf;
+	size_t size;
+	size_t lines;		/* Lines of the blamed file. */
+};
+
+DEFINE_ALLOCATOR(realloc_recording, char, 65536)
+
+static bool
+record_line(struct recording *recording, const char *line)
+{
+	size_t linelen = strlen(line) + 1;
+
+	if (!realloc_recording(&recording->buf, recording->size, linelen))
+		return FALSE;
+	memcpy(recording->buf + recording->size, line, linelen);
+	recording->size += linelen;
+	return TRUE;
+}
+
+static bool
+record_blame(struct recording *recording, const char *file)
+{
+	const char *cat_argv[] = { "git", "cat-file", "-p", NULL, NULL };
+	const char *blame_argv[] = {
+		"git", "blame", "--incremental", "HEAD", "--", file, NULL
+	};
+	char spec[SIZEOF_STR];
+	struct io io;
+	char *line;
+
+	if (!string_format(spec, "HEAD:%s", file))
+		return FALSE;
+	cat_argv[3] = spec;
+
+	/* The blame parser needs the number of lines in the file. */
+	if (!io_run(&io, IO_RD, NULL, NULL, cat_argv))
+		return FALSE;
+	while ((line = io_get(&io, '\n', TRUE)))
+		recording->lines++;
+	if (!io_done(&io) || !recording->lines)
+		return FALSE;
+
+	if (!io_run(&io, IO_RD, NULL, NULL, blame_argv))
+		return FALSE;
+	while ((line = io_get(&io, '\n', TRUE)))
+		if (!record_line(recording, line)) {
+			io_done(&io);
+			return FALSE;
+		}
+
+	return io_done(&io) && recording->size > 0;
+}
+
+/* Generate output where each group of lines is blamed on a random one of
+ * the commits, the way a file is after years of small edits. */
+static bool
+generate_blame(struct recording *recording)
+{
+	unsigned int seed = 1;
+	size_t lineno = 1;
+	bool *described = calloc(BENCH_COMMITS, sizeof(*described));
+
+	if (!described)
+		return FALSE;
+
+	recording->lines = BENCH_LINES;
+	while (lineno <= BENCH_LINES) {
+		char line[SIZEOF_STR];
+		size_t commit, group;
+
+		seed = seed * 1103515245 + 12345;
+		commit = (seed >> 8) % BENCH_COMMITS;
+		group = MIN(1 + (seed >> 4) % 4, BENCH_LINES - lineno + 1);
+
+		if (!string_format(line, "%08zx%032zx %zu %zu %zu",
+				   commit * 2654435761U % 0xffffffff, commit,
+				   lineno, lineno, group) ||
+		    !record_line(recording, line))
+			break;
+
+		if (!described[commit]) {
+			described[commit] = TRUE;
+			if (!string_format(line, "author Dev %zu", commit % 50) ||
+			    !record_line(recording, line) ||
+			    !record_line(recording, "author-mail <dev@example.com>") ||
+			    !record_line(recording, "author-time 1000000000") ||
+			    !record_line(recording, "author-tz +0000") ||
+			    !string_format(line, "summary Change %zu", commit) ||
+			    !record_line(recording, line))
+				break;
+		}
+
+		if (!record_line(recording, "filename file.c"))
+			break;
+		lineno += group;
+	}
+
+	free(described);
+	return lineno > BENCH_LINES;
+}
+
+/*
+ * Lookups
+ */
+
+/* Find the commit the way the blame view did before it kept a table. */
+static struct blame_commit *
+scan_blame_commit(struct blame_commit **lines, size_t nlines, const char *id)
+{
+	struct blame_commit *commit;
+	size_t i;
+
+	for (i = 0; i < nlines; i++) {
+		if (lines[i] && !strncmp(lines[i]->id, id, SIZEOF_REV - 1))
+			return lines[i];
+	}
+
+	commit = calloc(1, sizeof(*commit));
+	if (commit)
+		string_ncopy(commit->id, id, SIZEOF_REV);
+	return commit;
+}
+
+static unsigned long long
+clock_usecs(void)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (unsigned long long) now.tv_sec * 1000000 + now.tv_usec;
+}
+
+/* Feed the output through the blame parser and return the number of
+ * distinct commits. */
+static size_t
+read_blame(struct recording *recording, char *work, struct blame_commit **lines, bool scan)
+{
+	struct blame_commits commits = {};
+	struct blame_commit *commit = NULL;
+	size_t ncommits = 0;
+	size_t pos, i;
+
+	memcpy(work, recording->buf, recording->size);
+	memset(lines, 0, recording->lines * sizeof(*lines));
+
+	for (pos = 0; pos < recording->size; pos += strlen(work + pos) + 1) {
+		char *line = work + pos;
+		struct blame_header header;
+
+		if (commit) {
+			if (parse_blame_info(commit, line))
+				commit = NULL;
+			continue;
+		}
+
+		if (!parse_blame_header(&header, line, recording->lines))
+			continue;
+
+		if (scan)
+			commit = scan_blame_commit(lines, recording->lines, line);
+		else
+			commit = get_blame_commit(&commits, line);
+		if (!commit)
+			break;
+
+		while (header.group--)
+			lines[header.lineno + header.group - 1] = commit;
+	}
+
+	if (scan) {
+		/* Each commit is freed once by clearing its ID first. */
+		for (i = 0; i < recording->lines; i++) {
+			if (lines[i] && lines[i]->id[0])
+				lines[i]->id[0] = 0;
+			else
+				lines[i] = NULL;
+		}
+		for (i = 0; i < recording->lines; i++) {
+			ncommits += !!lines[i];
+			free(lines[i]);
+		}
+	} else {
+		ncommits = commits.count;
+		free_blame_commits(&commits);
+	}
+
+	return ncommits;
+}
+
+static void
+bench_lookup(struct recording *recording, int iterations, bool scan)
+{
+	struct blame_commit **lines = calloc(recording->lines, sizeof(*lines));
+	char *work = malloc(recording->size);
+	unsigned long long usecs = 0;
+	size_t ncommits = 0;
+	int i;
+
+	if (lines && work) {
+		for (i = 0; i < iterations; i++) {
+			unsigned long long start = clock_usecs();
+
+			ncommits = read_blame(recording, work, lines, scan);
+			usecs += clock_usecs() - start;
+		}
+
+		printf("%-5s %8zu lines %6zu commits %10.3f ms\n",
+		       scan ? "scan" : "table", recording->lines, ncommits,
+		       (double) usecs / iterations / 1000);
+	}
+
+	free(work);
+	free(lines);
+}
+
+int
+main(int argc, const char *argv[])
+{
+	struct recording recording = {};
+	int iterations = 5;
+
+	if (argc > 1) {
+		iterations = atoi(argv[1]);
+		if (iterations <= 0) {
+			fprintf(stderr, "%s\n", USAGE);
+			return 1;
+		}
+	}
+
+	if (argc > 2 ? !record_blame(&recording, argv[2]) : !generate_blame(&recording)) {
+		fprintf(stderr, "Failed to get blame output\n");
+		return 1;
+	}
+
+	bench_lookup(&recording, iterations, TRUE);
+	bench_lookup(&recording, iterations, FALSE);
+
+	free(recording.buf);
+	return 0;
+}
+
+/* vim: set ts=8 sw=8 noexpandtab: */
@@ -0,0 +1,38 @@
+#!/bin/sh
+#
+# Replay the scripts in tools/bench/ against synthetic repositories and
+# print the time each step completed.
+#
+# Usage: tools/bench-flows.sh <directory> <commits>...
+#
+# Repositories are created in <directory> the first time and reused.
+
+set -e
+
+if test $# -lt 2; then
+	echo "Usage: $0 <directory> <commits>..." >&2
+	exit 1
+fi
+
+TOOLS="$(cd "$(dirname "$0")" && pwd)"
+TIG="$(dirname "$TOOLS")/tig"
+DIR="$1"
+shift
+
+mkdir -p "$DIR"
+
+for commits in "$@"; do
+	repo="$DIR/repo-$commits"
+	if ! test -d "$repo"; then
+		echo "Creating repository with $commits commits in $repo"
+		"$TOOLS/make-bench-repo.sh" "$repo" "$commits"
+	fi
+
+	for script in "$TOOLS"/bench/*.tig; do
+		echo "== $(basename "$script" .tig) ($commits commits)"
+		(cd "$repo" &&
+		 TIG_NO_DISPLAY=1 TIG_SCRIPT="$script" \
+		 TIGRC_USER=/dev/null TIGRC_SYSTEM=/dev/null \
+		 "$TIG" < /dev/null)
+	done
+done
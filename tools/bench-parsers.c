@@ -0,0 +1,335 @@
+/* Copyright (c) 2006-2013 Jonas Fonseca <fonseca@diku.dk>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "../tig.h"
+#include "../io.h"
+#include "../line.h"
+#include "../graph.h"
+#include "../parse.h"
+
+#define USAGE \
+"bench-parsers [iterations [blame-file]]\n" \
+"\n" \
+"Records the output of Git commands run in the current repository and\n" \
+"feeds it through the parsers used by the main, diff, blame, status and\n" \
+"tree views. The blame parser is given the output for blame-file, which\n" \
+"defaults to tig.c."
+
+/* Allocations are counted when the C library lets malloc be replaced. */
+static unsigned long allocations;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *
+malloc(size_t size)
+{
+	allocations++;
+	return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+	allocations++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	allocations++;
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+/*
+ * Parsers
+ */
+
+static struct graph main_graph;
+static struct commit_parser main_parser = { { "" }, &main_graph };
+static struct commit *main_commit;
+
+/* Only the last commit is kept since the graph renders into it. */
+static void
+main_add_commit(const char *title)
+{
+	size_t titlelen = strlen(title);
+	struct commit *commit = calloc(1, sizeof(*commit) + titlelen);
+
+	if (!commit)
+		return;
+
+	move_commit(commit, &main_parser.commit, &main_graph, title, titlelen);
+	if (main_commit) {
+		free(main_commit->graph.symbols);
+		free(main_commit);
+	}
+	main_commit = commit;
+}
+
+static void
+parse_main(char *line)
+{
+	char *text;
+
+	switch (parse_commit_line(&main_parser, line, &text)) {
+	case COMMIT_LINE_ID:
+		if (*main_parser.commit.id)
+			main_add_commit("");
+		parse_commit_ids(&main_parser.commit, &main_graph, text, main_parser.is_boundary);
+		break;
+
+	case COMMIT_LINE_TITLE:
+		main_add_commit(text);
+		break;
+
+	default:
+		break;
+	}
+}
+
+static void
+done_main(void)
+{
+	if (*main_parser.commit.id)
+		main_add_commit("");
+	if (main_commit) {
+		free(main_commit->graph.symbols);
+		free(main_commit);
+		main_commit = NULL;
+	}
+	done_graph(&main_graph);
+	memset(&main_parser, 0, sizeof(main_parser));
+	main_parser.graph = &main_graph;
+}
+
+static void
+parse_diff(char *line)
+{
+	static struct diff_parser parser;
+	bool commit_title;
+
+	/* Each commit is shown as if it was loaded in its own diff view. */
+	if (!prefixcmp(line, "commit "))
+		memset(&parser, 0, sizeof(parser));
+	parse_diff_line(&parser, line, FALSE, &commit_title);
+}
+
+static void
+parse_blame(char *line)
+{
+	static struct blame_header header;
+	static struct blame_commit commit;
+	static bool reading_info;
+
+	if (!reading_info)
+		reading_info = parse_blame_header(&header, line, 9999999);
+	else if (parse_blame_info(&commit, line))
+		reading_info = FALSE;
+}
+
+static void
+parse_status(char *line)
+{
+	static struct status file;
+
+	if (*line == ':')
+		status_get_diff(&file, line, strlen(line));
+	else
+		string_ncopy(file.new.name, line, strlen(line));
+}
+
+static void
+parse_tree(char *line)
+{
+	static struct tree_parser parser = { "" };
+	struct tree_entry *entry;
+	enum line_type type;
+	size_t size;
+	char *name = parse_tree_entry(&parser, line, &type, &size);
+
+	if (!name)
+		return;
+
+	entry = calloc(1, sizeof(*entry) + strlen(name));
+	if (!entry)
+		return;
+
+	set_tree_entry(entry, name, line, line + TREE_ID_OFFSET, size);
+	free(entry);
+}
+
+static const char *main_argv[] = {
+	"git", "log", "--no-color", "--pretty=raw", "--parents",
+		"--topo-order", "-n", "20000", NULL
+};
+
+static const char *diff_argv[] = {
+	"git", "log", "--no-color", "--pretty=fuller", "--patch-with-stat",
+		"-n", "500", NULL
+};
+
+static const char *blame_argv[] = {
+	"git", "blame", "--incremental", "HEAD", "--", "tig.c", NULL
+};
+
+static const char *status_argv[] = {
+	"git", "diff-tree", "-r", "-z", "4b825dc642cb6eb9a060e54bf8d69288fbee4904",
+		"HEAD", NULL
+};
+
+static const char *tree_argv[] = {
+	"git", "ls-tree", "-l", "-r", "HEAD", NULL
+};
+
+struct bench_input {
+	const char *name;
+	const char **argv;
+	char separator;
+	void (*parse)(char *line);
+	void (*done)(void);		/* Called after each pass, if set. */
+};
+
+static const struct bench_input inputs[] = {
+	{ "main",   main_argv,   '\n', parse_main, done_main },
+	{ "diff",   diff_argv,   '\n', parse_diff },
+	{ "blame",  blame_argv,  '\n', parse_blame },
+	{ "status", status_argv, 0,    parse_status },
+	{ "tree",   tree_argv,   '\n', parse_tree },
+};
+
+/*
+ * Recorded output
+ */
+
+struct recording {
+	char *buf;
+	size_t size;
+	size_t lines;
+};
+
+DEFINE_ALLOCATOR(realloc_recording, char, 65536)
+
+static bool
+record_output(struct recording *recording, const char *argv[], char separator)
+{
+	struct io io;
+	char *line;
+
+	memset(recording, 0, sizeof(*recording));
+	if (!io_run(&io, IO_RD, NULL, NULL, argv))
+		return FALSE;
+
+	while (!io_eof(&io)) {
+		bool can_read = io_can_read(&io, TRUE);
+
+		for (; (line = io_get(&io, separator, can_read)); can_read = FALSE) {
+			size_t linelen = strlen(line) + 1;
+
+			if (!realloc_recording(&recording->buf, recording->size, linelen)) {
+				io_done(&io);
+				return FALSE;
+			}
+			memcpy(recording->buf + recording->size, line, linelen);
+			recording->size += linelen;
+			recording->lines++;
+		}
+	}
+
+	return io_done(&io) && recording->lines > 0;
+}
+
+static unsigned long long
+clock_usecs(void)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (unsigned long long) now.tv_sec * 1000000 + now.tv_usec;
+}
+
+static void
+bench_input(const struct bench_input *input, int iterations)
+{
+	struct recording recording;
+	unsigned long long usecs = 0;
+	unsigned long allocs = 0;
+	char *work;
+	int i;
+
+	if (!record_output(&recording, input->argv, input->separator)) {
+		printf("%-6s no output\n", input->name);
+		return;
+	}
+
+	work = malloc(recording.size);
+	if (!work) {
+		free(recording.buf);
+		return;
+	}
+
+	for (i = 0; i < iterations; i++) {
+		unsigned long long start;
+		unsigned long start_allocs;
+		size_t pos;
+
+		/* The parsers modify the lines so give them a fresh copy. */
+		memcpy(work, recording.buf, recording.size);
+
+		start_allocs = allocations;
+		start = clock_usecs();
+		for (pos = 0; pos < recording.size; pos += strlen(work + pos) + 1)
+			input->parse(work + pos);
+		if (input->done)
+			input->done();
+		usecs += clock_usecs() - start;
+		allocs += allocations - start_allocs;
+	}
+
+	printf("%-6s %8zu lines %8.1f MB/s %8.3f allocs/line\n", input->name,
+	       recording.lines,
+	       usecs ? (double) recording.size * iterations / usecs : 0.0,
+	       (double) allocs / iterations / recording.lines);
+
+	free(work);
+	free(recording.buf);
+}
+
+int
+main(int argc, const char *argv[])
+{
+	int iterations = 20;
+	int i;
+
+	if (argc > 1) {
+		iterations = atoi(argv[1]);
+		if (iterations <= 0) {
+			fprintf(stderr, "%s\n", USAGE);
+			return 1;
+		}
+	}
+
+	if (argc > 2)
+		blame_argv[ARRAY_SIZE(blame_argv) - 2] = argv[2];
+
+	for (i = 0; i < ARRAY_SIZE(inputs); i++)
+		bench_input(&inputs[i], iterations);
+
+	return 0;
+}
+
+/* vim: set ts=8 sw=8 noexpandtab: */
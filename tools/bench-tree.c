@@ -0,0 +1,261 @@
+/* Copyright (c) 2006-2013 Jonas Fonseca <fonseca@diku.dk>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "../tig.h"
+#include "../io.h"
+#include "../line.h"
+#include "../parse.h"
+
+#define USAGE \
+"bench-tree [iterations [tree-ish]]\n" \
+"\n" \
+"Measures how fast the entries of `git ls-tree -l` output are put in\n" \
+"order when loading the tree view, once by inserting each entry in place\n" \
+"like older versions did and once by sorting all entries after they have\n" \
+"been read. Without a tree-ish, output is generated for a directory with\n" \
+"100000 entries, one in a hundred being a directory."
+
+#define BENCH_ENTRIES	100000
+
+/*
+ * Tree output
+ */
+
+struct recording {
+	char *buf;
+	size_t size;
+	size_t entries;
+};
+
+DEFINE_ALLOCATOR(realloc_recording, char, 65536)
+
+static bool
+record_line(struct recording *recording, const char *line)
+{
+	size_t linelen = strlen(line) + 1;
+
+	if (!realloc_recording(&recording->buf, recording->size, linelen))
+		return FALSE;
+	memcpy(recording->buf + recording->size, line, linelen);
+	recording->size += linelen;
+	recording->entries++;
+	return TRUE;
+}
+
+static bool
+record_tree(struct recording *recording, const char *tree)
+{
+	const char *ls_tree_argv[] = { "git", "ls-tree", "-l", tree, NULL };
+	struct io io;
+	char *line;
+
+	if (!io_run(&io, IO_RD, NULL, NULL, ls_tree_argv))
+		return FALSE;
+	while ((line = io_get(&io, '\n', TRUE)))
+		if (!record_line(recording, line)) {
+			io_done(&io);
+			return FALSE;
+		}
+
+	return io_done(&io) && recording->entries > 0;
+}
+
+/* Generate the entries in the order git-ls-tree(1) lists them, which
+ * sorts directories by name as if they ended with a slash. */
+static bool
+generate_tree(struct recording *recording)
+{
+	size_t i;
+
+	for (i = 0; i < BENCH_ENTRIES; i++) {
+		char line[SIZEOF_STR];
+		bool dir = i % 100 == 0;
+
+		if (!string_format(line, "%s %040zx %7s\t%s%06zu%s",
+				   dir ? "040000 tree" : "100644 blob", i,
+				   dir ? "-" : "1234", dir ? "d" : "f", i,
+				   dir ? "" : ".c") ||
+		    !record_line(recording, line))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Ordering
+ */
+
+struct bench_line {
+	enum line_type type;
+	unsigned int lineno:24;
+	unsigned int dirty:1;
+	void *data;
+};
+
+struct bench_entry {
+	mode_t mode;
+	size_t size;
+	char name[1];
+};
+
+static int
+compare_entry(const struct bench_line *line1, const struct bench_line *line2)
+{
+	const struct bench_entry *entry1 = line1->data;
+	const struct bench_entry *entry2 = line2->data;
+
+	if (line1->type != line2->type)
+		return line1->type == LINE_TREE_DIR ? -1 : 1;
+	return strcmp(entry1->name, entry2->name);
+}
+
+static int
+compare_line(const void *line1, const void *line2)
+{
+	return compare_entry(line1, line2);
+}
+
+/* Insert the last line in place the way tree_read() did. */
+static void
+insert_line(struct bench_line *lines, size_t nlines)
+{
+	struct bench_line *entry = &lines[nlines - 1];
+	struct bench_line *line;
+	void *data = entry->data;
+	enum line_type type = entry->type;
+
+	for (line = lines; line < entry; line++) {
+		if (compare_entry(line, entry) <= 0)
+			continue;
+
+		memmove(line + 1, line, (entry - line) * sizeof(*entry));
+		line->data = data;
+		line->type = type;
+		for (; line <= entry; line++)
+			line->dirty = 1;
+		return;
+	}
+}
+
+static unsigned long long
+clock_usecs(void)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (unsigned long long) now.tv_sec * 1000000 + now.tv_usec;
+}
+
+static bool
+read_tree(struct recording *recording, struct bench_line *lines, bool sort)
+{
+	size_t nlines = 0;
+	size_t pos, i;
+	int size_width = 0;
+	bool ok = TRUE;
+
+	for (pos = 0; pos < recording->size && ok; ) {
+		char *line = recording->buf + pos;
+		size_t linelen = strlen(line);
+		char *text = malloc(linelen + 1);
+		struct bench_entry *entry;
+		size_t size;
+		char *path;
+
+		pos += linelen + 1;
+		if (!text)
+			return FALSE;
+		memcpy(text, line, linelen + 1);
+
+		path = parse_tree_line(text, linelen, &size, &size_width);
+		entry = path ? calloc(1, sizeof(*entry) + strlen(path)) : NULL;
+		if (entry) {
+			strcpy(entry->name, path);
+			entry->mode = strtoul(text, NULL, 8);
+			entry->size = size;
+			lines[nlines].type = text[SIZEOF_TREE_MODE] == 't' ? LINE_TREE_DIR : LINE_TREE_FILE;
+			lines[nlines].data = entry;
+			lines[nlines].lineno = nlines + 1;
+			lines[nlines].dirty = 1;
+			nlines++;
+			if (!sort)
+				insert_line(lines, nlines);
+		}
+		ok = !!entry;
+		free(text);
+	}
+
+	if (sort)
+		qsort(lines, nlines, sizeof(*lines), compare_line);
+
+	for (i = 0; i + 1 < nlines; i++)
+		if (compare_entry(&lines[i], &lines[i + 1]) >= 0)
+			ok = FALSE;
+	for (i = 0; i < nlines; i++)
+		free(lines[i].data);
+	return ok;
+}
+
+static void
+bench_order(struct recording *recording, int iterations, bool sort)
+{
+	struct bench_line *lines = calloc(recording->entries, sizeof(*lines));
+	unsigned long long usecs = 0;
+	bool ok = !!lines;
+	int i;
+
+	for (i = 0; i < iterations && ok; i++) {
+		unsigned long long start = clock_usecs();
+
+		ok = read_tree(recording, lines, sort);
+		usecs += clock_usecs() - start;
+	}
+
+	if (ok)
+		printf("%-6s %8zu entries %12.3f ms\n",
+		       sort ? "sort" : "insert", recording->entries,
+		       (double) usecs / iterations / 1000);
+	else
+		fprintf(stderr, "Failed to order the entries\n");
+
+	free(lines);
+}
+
+int
+main(int argc, const char *argv[])
+{
+	struct recording recording = {};
+	int iterations = 1;
+
+	if (argc > 1) {
+		iterations = atoi(argv[1]);
+		if (iterations <= 0) {
+			fprintf(stderr, "%s\n", USAGE);
+			return 1;
+		}
+	}
+
+	if (argc > 2 ? !record_tree(&recording, argv[2]) : !generate_tree(&recording)) {
+		fprintf(stderr, "Failed to get tree output\n");
+		return 1;
+	}
+
+	bench_order(&recording, iterations, FALSE);
+	bench_order(&recording, iterations, TRUE);
+
+	free(recording.buf);
+	return 0;
+}
+
+/* vim: set ts=8 sw=8 noexpandtab: */
@@ -0,0 +1,243 @@
+/* Copyright (c) 2006-2013 Jonas Fonseca <fonseca@diku.dk>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "../tig.h"
+
+#define USAGE \
+"bench-utf8 [iterations]\n" \
+"\n" \
+"Measures utf8_length() and string_expand() on lines of ASCII, CJK and\n" \
+"mixed text the way they are used when drawing views, and compares them\n" \
+"with versions looking at one character at a time."
+
+#define BENCH_LINES	4096
+#define BENCH_WIDTH	200
+
+struct bench_input {
+	const char *name;
+	const char *words[4];
+};
+
+static const struct bench_input inputs[] = {
+	{ "ascii", { "static ", "int ", "foo(bar);", "	return 0;" } },
+	{ "cjk",   { "\xe4\xb8\xad\xe6\x96\x87", "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e", "\xed\x95\x9c\xea\xb8\x80", "\xe3\x80\x80" } },
+	{ "mixed", { "fix ", "\xe4\xb8\xad\xe6\x96\x87 ", "caf\xc3\xa9 ", "	- item" } },
+};
+
+static char lines[BENCH_LINES][SIZEOF_STR];
+
+/* The versions of string_expand() and utf8_length() from before the ASCII
+ * runs were handled in bulk. */
+static size_t
+scalar_string_expand(char *dst, size_t dstlen, const char *src, int tabsize)
+{
+	size_t size, pos;
+
+	for (size = pos = 0; size < dstlen - 1 && src[pos]; pos++) {
+		if (src[pos] == '\t') {
+			size_t expanded = tabsize - (size % tabsize);
+
+			if (expanded + size >= dstlen - 1)
+				expanded = dstlen - size - 1;
+			memcpy(dst + size, "        ", expanded);
+			size += expanded;
+		} else {
+			dst[size++] = src[pos];
+		}
+	}
+
+	dst[size] = 0;
+	return pos;
+}
+
+static size_t
+scalar_utf8_length(const char **start, size_t skip, int *width, size_t max_width, int *trimmed, bool reserve, int tab_size)
+{
+	const char *string = *start;
+	const char *end = strchr(string, '\0');
+	unsigned char last_bytes = 0;
+	size_t last_ucwidth = 0;
+
+	*width = 0;
+	*trimmed = 0;
+
+	while (string < end) {
+		unsigned char bytes = utf8_char_length(string, end);
+		size_t ucwidth;
+		unsigned long unicode;
+
+		if (string + bytes > end)
+			break;
+
+		unicode = utf8_to_unicode(string, bytes);
+		if (!unicode)
+			break;
+
+		ucwidth = unicode_width(unicode, tab_size);
+		if (skip > 0) {
+			skip -= ucwidth <= skip ? ucwidth : skip;
+			*start += bytes;
+		}
+		*width  += ucwidth;
+		if (*width > max_width) {
+			*trimmed = 1;
+			*width -= ucwidth;
+			if (reserve && *width == max_width) {
+				string -= last_bytes;
+				*width -= last_ucwidth;
+			}
+			break;
+		}
+
+		string  += bytes;
+		last_bytes = ucwidth ? bytes : 0;
+		last_ucwidth = ucwidth;
+	}
+
+	return string - *start;
+}
+
+static void
+make_lines(const struct bench_input *input)
+{
+	unsigned int seed = 1;
+	int i;
+
+	for (i = 0; i < BENCH_LINES; i++) {
+		size_t length = 80 + (i % 5) * 40;
+		size_t pos = 0;
+
+		while (pos < length) {
+			const char *word;
+
+			seed = seed * 1103515245 + 12345;
+			word = input->words[(seed >> 16) % ARRAY_SIZE(input->words)];
+			if (!string_nformat(lines[i], sizeof(lines[i]), &pos, "%s", word))
+				break;
+		}
+	}
+}
+
+static double
+elapsed(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+static size_t
+run_expand(bool scalar, int iterations)
+{
+	static char expanded[SIZEOF_STR];
+	size_t total = 0;
+	int i, j;
+
+	for (j = 0; j < iterations; j++) {
+		for (i = 0; i < BENCH_LINES; i++) {
+			if (scalar)
+				total += scalar_string_expand(expanded, sizeof(expanded), lines[i], 8);
+			else
+				total += string_expand(expanded, sizeof(expanded), lines[i], 8);
+		}
+	}
+
+	return total;
+}
+
+static size_t
+run_length(bool scalar, int iterations)
+{
+	size_t total = 0;
+	int i, j;
+
+	for (j = 0; j < iterations; j++) {
+		for (i = 0; i < BENCH_LINES; i++) {
+			const char *text = lines[i];
+			int width, trimmed;
+
+			if (scalar)
+				total += scalar_utf8_length(&text, j % 8, &width, BENCH_WIDTH, &trimmed, TRUE, 8);
+			else
+				total += utf8_length(&text, j % 8, &width, BENCH_WIDTH, &trimmed, TRUE, 8);
+			total += width + (text - lines[i]);
+		}
+	}
+
+	return total;
+}
+
+/* Time both versions on the same lines and check that they agree. */
+static void
+bench_compare(const char *input, const char *name, size_t (*run)(bool, int),
+	      size_t bytes, int iterations)
+{
+	struct timeval start;
+	size_t fast, scalar;
+	double fast_secs, scalar_secs;
+
+	gettimeofday(&start, NULL);
+	fast = run(FALSE, iterations);
+	fast_secs = elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	scalar = run(TRUE, iterations);
+	scalar_secs = elapsed(&start);
+
+	printf("%-6s %-13s %8.1f MB/s  scalar %8.1f MB/s  %5.2fx%s\n",
+	       input, name, bytes / fast_secs / 1000000, bytes / scalar_secs / 1000000,
+	       scalar_secs / fast_secs, fast == scalar ? "" : "  MISMATCH");
+}
+
+static void
+bench_input(const struct bench_input *input, int iterations)
+{
+	static char expanded[SIZEOF_STR];
+	size_t bytes = 0;
+	int i;
+
+	make_lines(input);
+	for (i = 0; i < BENCH_LINES; i++)
+		bytes += strlen(lines[i]);
+	bytes *= iterations;
+
+	bench_compare(input->name, "string_expand", run_expand, bytes, iterations);
+
+	for (i = 0; i < BENCH_LINES; i++)
+		string_expand(lines[i], sizeof(lines[i]), strcpy(expanded, lines[i]), 8);
+
+	bench_compare(input->name, "utf8_length", run_length, bytes, iterations);
+}
+
+int
+main(int argc, const char *argv[])
+{
+	int iterations = 200;
+	int i;
+
+	if (argc > 1) {
+		iterations = atoi(argv[1]);
+		if (iterations <= 0) {
+			fprintf(stderr, "%s\n", USAGE);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < ARRAY_SIZE(inputs); i++)
+		bench_input(&inputs[i], iterations);
+
+	return 0;
+}
+
+/* vim: set ts=8 sw=8 noexpandtab: */
@@ -0,0 +1,52 @@
+#!/bin/sh
+#
+# Create a synthetic repository for benchmarking.
+#
+# Usage: tools/make-bench-repo.sh <directory> <commits> [files]
+#
+# Each commit changes one line of one of the files and has a message
+# with a ticket number, which can be used for searching.
+
+set -e
+
+if test $# -lt 2; then
+	echo "Usage: $0 <directory> <commits> [files]" >&2
+	exit 1
+fi
+
+DIR="$1"
+COMMITS="$2"
+FILES="${3:-200}"
+
+git init -q "$DIR"
+cd "$DIR"
+git symbolic-ref HEAD refs/heads/master
+
+awk -v commits="$COMMITS" -v files="$FILES" -v lines=20 -v authors=50 '
+BEGIN {
+	for (i = 1; i <= commits; i++) {
+		file = i % files
+		line = int(i / files) % lines
+		path = "dir" (file % 20) "/file" file ".c"
+		text[file, line] = "line " line " changed by commit " i
+
+		content = ""
+		for (l = 0; l < lines; l++)
+			content = content (((file, l) in text) ? text[file, l] : "line " l) "\n"
+
+		msg = "commit " i " TICKET-" (i % 997) "\n\nChange line " line " of " path ".\n"
+		ident = "Dev " (i % authors) " <dev" (i % authors) "@example.com> " (1000000000 + i * 60) " +0000"
+
+		print "commit refs/heads/master"
+		print "author " ident
+		print "committer " ident
+		print "data " length(msg)
+		printf "%s", msg
+		print "M 100644 inline " path
+		print "data " length(content)
+		printf "%s", content
+		print ""
+	}
+}' | git fast-import --quiet
+
+git reset -q --hard
@@ -0,0 +1,804 @@
+/* Copyright (c) 2006-2013 Jonas Fonseca <fonseca@diku.dk>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "tig.h"
+#include "io.h"
+#include "trigram.h"
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+/*
+ * The index file starts with a header followed by the binary IDs of all
+ * indexed commits and the IDs of the refs the index is up to date with.
+ * Next come the posting lists, each listing the numbers of the commits
+ * containing a trigram, and finally a sorted table mapping each trigram
+ * to its posting list. Commits are numbered by their position in the ID
+ * list so new commits can be appended without renumbering old ones.
+ */
+
+#define TRIGRAM_MAGIC	"TIGTRI1"
+#define TRIGRAM_IDSIZE	20
+
+/* Number of trigram and commit pairs to collect in memory before they are
+ * sorted and written to a temporary file to be merged later. */
+#define TRIGRAM_RUNSIZE	(4 * 1024 * 1024)
+
+/* Seconds after which the lock of an unfinished update is removed. */
+#define TRIGRAM_LOCK_STALE	3600
+
+struct trigram_header {
+	char magic[8];
+	uint32_t commits;		/* Number of indexed commits. */
+	uint32_t tips;			/* Number of indexed ref IDs. */
+	uint64_t trigrams;		/* Size of the trigram table. */
+	uint64_t postings;		/* Total number of postings. */
+	uint64_t postings_offset;
+	uint64_t table_offset;
+};
+
+struct trigram_entry {
+	uint32_t trigram;
+	uint32_t size;			/* Number of commits. */
+	uint64_t offset;		/* Position of the first posting. */
+};
+
+struct trigram_id {
+	unsigned char id[TRIGRAM_IDSIZE];
+};
+
+struct trigram_index {
+	void *map;
+	size_t mapsize;
+	const struct trigram_header *header;
+	const struct trigram_id *ids;
+	const struct trigram_id *tips;
+	const uint32_t *postings;
+	const struct trigram_entry *table;
+};
+
+DEFINE_ALLOCATOR(realloc_trigram_ids, struct trigram_id, 1024)
+DEFINE_ALLOCATOR(realloc_trigram_runs, FILE *, 8)
+DEFINE_ALLOCATOR(realloc_trigram_table, struct trigram_entry, 4096)
+
+static int
+trigram_hexval(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+static bool
+trigram_parse_id(struct trigram_id *id, const char *hex)
+{
+	int i;
+
+	for (i = 0; i < TRIGRAM_IDSIZE; i++) {
+		int hi = trigram_hexval(hex[i * 2]);
+		int lo = hi < 0 ? -1 : trigram_hexval(hex[i * 2 + 1]);
+
+		if (lo < 0)
+			return FALSE;
+		id->id[i] = (hi << 4) | lo;
+	}
+
+	return !hex[i * 2] || isspace(hex[i * 2]);
+}
+
+static void
+trigram_format_id(char hex[SIZEOF_REV], const struct trigram_id *id)
+{
+	static const char digits[] = "0123456789abcdef";
+	int i;
+
+	for (i = 0; i < TRIGRAM_IDSIZE; i++) {
+		hex[i * 2] = digits[id->id[i] >> 4];
+		hex[i * 2 + 1] = digits[id->id[i] & 0xf];
+	}
+	hex[i * 2] = 0;
+}
+
+static int
+compare_trigram_ids(const void *id1, const void *id2)
+{
+	return memcmp(id1, id2, TRIGRAM_IDSIZE);
+}
+
+static int
+compare_trigrams(const void *trigram1_, const void *trigram2_)
+{
+	uint32_t trigram1 = *(const uint32_t *) trigram1_;
+	uint32_t trigram2 = *(const uint32_t *) trigram2_;
+
+	return trigram1 < trigram2 ? -1 : trigram1 > trigram2;
+}
+
+static int
+compare_trigram_pairs(const void *pair1_, const void *pair2_)
+{
+	uint64_t pair1 = *(const uint64_t *) pair1_;
+	uint64_t pair2 = *(const uint64_t *) pair2_;
+
+	return pair1 < pair2 ? -1 : pair1 > pair2;
+}
+
+static int
+compare_trigram_entry(const void *trigram_, const void *entry_)
+{
+	uint32_t trigram = *(const uint32_t *) trigram_;
+	const struct trigram_entry *entry = entry_;
+
+	return trigram < entry->trigram ? -1 : trigram > entry->trigram;
+}
+
+/* Trigrams are case-folded so they can answer case insensitive searches.
+ * The field is stored above the three characters so that searching the
+ * author ident does not return commits mentioning it in their message. */
+static uint32_t
+trigram_key(const char *text, enum trigram_field field)
+{
+	return (uint32_t) field << 24
+	     | (uint32_t) (unsigned char) ascii_tolower(text[0]) << 16
+	     | (uint32_t) (unsigned char) ascii_tolower(text[1]) << 8
+	     | (uint32_t) (unsigned char) ascii_tolower(text[2]);
+}
+
+/*
+ * Reading the index.
+ */
+
+static bool
+trigram_index_valid(const struct trigram_index *index, size_t size)
+{
+	const struct trigram_header *header = index->header;
+	uint64_t ids_end = sizeof(*header) +
+			   ((uint64_t) header->commits + header->tips) * TRIGRAM_IDSIZE;
+	uint64_t i;
+
+	if (memcmp(header->magic, TRIGRAM_MAGIC, sizeof(header->magic)) ||
+	    header->postings_offset % sizeof(uint32_t) ||
+	    header->table_offset % sizeof(uint64_t) ||
+	    ids_end > header->postings_offset ||
+	    header->postings_offset + header->postings * sizeof(uint32_t) > header->table_offset ||
+	    header->table_offset + header->trigrams * sizeof(struct trigram_entry) > size)
+		return FALSE;
+
+	for (i = 0; i < header->trigrams; i++) {
+		const struct trigram_entry *entry = &index->table[i];
+
+		if (entry->offset + entry->size > header->postings ||
+		    (i > 0 && entry[-1].trigram >= entry->trigram))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+struct trigram_index *
+trigram_index_open(const char *path)
+{
+	struct trigram_index *index;
+	struct stat st;
+	char *map;
+	int fd = open(path, O_RDONLY);
+
+	if (fd == -1)
+		return NULL;
+
+	if (fstat(fd, &st) || st.st_size < sizeof(struct trigram_header)) {
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	index = calloc(1, sizeof(*index));
+	if (!index) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	index->map = map;
+	index->mapsize = st.st_size;
+	index->header = (const struct trigram_header *) map;
+	index->ids = (const struct trigram_id *) (map + sizeof(*index->header));
+	index->tips = index->ids + index->header->commits;
+	index->postings = (const uint32_t *) (map + index->header->postings_offset);
+	index->table = (const struct trigram_entry *) (map + index->header->table_offset);
+
+	if (!trigram_index_valid(index, st.st_size)) {
+		trigram_index_close(index);
+		return NULL;
+	}
+
+	return index;
+}
+
+void
+trigram_index_close(struct trigram_index *index)
+{
+	if (index) {
+		munmap(index->map, index->mapsize);
+		free(index);
+	}
+}
+
+/*
+ * Updating the index.
+ */
+
+struct trigram_builder {
+	struct trigram_id *ids;		/* IDs of the new commits. */
+	size_t ids_size;
+	uint32_t first;			/* Number of the first new commit. */
+	uint32_t *trigrams;		/* Trigrams of the current commit. */
+	size_t trigrams_alloc;
+	uint64_t *pairs;		/* Trigram and commit number pairs. */
+	size_t pairs_size;
+	FILE **runs;			/* Sorted runs of pairs. */
+	size_t runs_size;
+	trigram_wait_fn wait;		/* Called while git is quiet. */
+	void *data;
+	bool stopped;			/* The update was stopped. */
+};
+
+static void
+trigram_builder_done(struct trigram_builder *builder)
+{
+	size_t i;
+
+	for (i = 0; i < builder->runs_size; i++)
+		fclose(builder->runs[i]);
+	free(builder->runs);
+	free(builder->pairs);
+	free(builder->trigrams);
+	free(builder->ids);
+}
+
+static bool
+trigram_builder_flush(struct trigram_builder *builder)
+{
+	FILE *run;
+
+	if (!builder->pairs_size)
+		return TRUE;
+
+	qsort(builder->pairs, builder->pairs_size, sizeof(*builder->pairs), compare_trigram_pairs);
+
+	if (!realloc_trigram_runs(&builder->runs, builder->runs_size, 1))
+		return FALSE;
+	run = tmpfile();
+	if (!run)
+		return FALSE;
+	builder->runs[builder->runs_size++] = run;
+
+	if (fwrite(builder->pairs, sizeof(*builder->pairs), builder->pairs_size, run) != builder->pairs_size ||
+	    fflush(run) || fseek(run, 0, SEEK_SET))
+		return FALSE;
+
+	builder->pairs_size = 0;
+	return TRUE;
+}
+
+static bool
+trigram_builder_add(struct trigram_builder *builder, const char *text)
+{
+	uint32_t commit = builder->first + builder->ids_size - 1;
+	enum trigram_field field = TRIGRAM_AUTHOR;
+	size_t length = strlen(text);
+	size_t size = 0;
+	size_t i;
+
+	if (length > builder->trigrams_alloc) {
+		uint32_t *trigrams = realloc(builder->trigrams, length * sizeof(*trigrams));
+
+		if (!trigrams)
+			return FALSE;
+		builder->trigrams = trigrams;
+		builder->trigrams_alloc = length;
+	}
+
+	/* The first line holds the author ident followed by the message.
+	 * Trigrams spanning multiple lines are left out since search
+	 * patterns are always matched against a single line. */
+	for (i = 0; i + 2 < length; i++) {
+		if (text[i] == '\n')
+			field = TRIGRAM_MESSAGE;
+		else if (text[i + 1] != '\n' && text[i + 2] != '\n')
+			builder->trigrams[size++] = trigram_key(text + i, field);
+	}
+
+	qsort(builder->trigrams, size, sizeof(*builder->trigrams), compare_trigrams);
+
+	if (!builder->pairs) {
+		builder->pairs = malloc(TRIGRAM_RUNSIZE * sizeof(*builder->pairs));
+		if (!builder->pairs)
+			return FALSE;
+	}
+
+	for (i = 0; i < size; i++) {
+		if (i > 0 && builder->trigrams[i] == builder->trigrams[i - 1])
+			continue;
+		if (builder->pairs_size == TRIGRAM_RUNSIZE &&
+		    !trigram_builder_flush(builder))
+			return FALSE;
+		builder->pairs[builder->pairs_size++] = (uint64_t) builder->trigrams[i] << 32 | commit;
+	}
+
+	return TRUE;
+}
+
+/* Exclude the commits reachable from the indexed tips which still exist.
+ * Tips which have since been pruned are left out, since git log refuses
+ * to start from a missing commit even with --ignore-missing. Each tip is
+ * answered before the next is asked for to not fill up both pipes. */
+static bool
+trigram_builder_exclude(struct io *log, const struct trigram_index *index)
+{
+	const char *batch_check_argv[] = {
+		"git", "cat-file", "--batch-check=%(objectname)", NULL
+	};
+	bool ok = TRUE;
+	struct io io;
+	uint32_t i;
+
+	if (!index || !index->header->tips)
+		return TRUE;
+	if (!io_run(&io, IO_RD_WR, NULL, NULL, batch_check_argv))
+		return FALSE;
+
+	for (i = 0; ok && i < index->header->tips; i++) {
+		char id[SIZEOF_REV];
+		char *answer;
+
+		trigram_format_id(id, &index->tips[i]);
+		ok = io_printf(&io, "%s\n", id) &&
+		     (answer = io_get(&io, '\n', TRUE)) != NULL;
+
+		/* Missing objects are answered with "<id> missing". */
+		if (ok && !strchr(answer, ' '))
+			ok = io_printf(log, "^%s\n", id);
+	}
+
+	io_close_write(&io);
+	if (!ok)
+		io_kill(&io);
+	return io_done(&io) && ok;
+}
+
+static char *
+trigram_builder_get(struct trigram_builder *builder, struct io *io)
+{
+	char *record = io_get(io, '\0', FALSE);
+
+	if (record || io_eof(io))
+		return record;
+	if (!builder->wait(io, builder->data)) {
+		builder->stopped = TRUE;
+		return NULL;
+	}
+	return io_get(io, '\0', TRUE);
+}
+
+static bool
+trigram_builder_read(struct trigram_builder *builder, const struct trigram_index *index)
+{
+	const char *log_argv[] = {
+		"git", "log", "--all", "--no-color", "-z", "--stdin",
+			"--pretty=format:%H%n%an <%ae>%n%B", NULL
+	};
+	struct io io;
+	char *record;
+	bool ok;
+
+	if (!io_run(&io, IO_RD_WR, NULL, NULL, log_argv))
+		return FALSE;
+
+	/* Only look at commits not reachable from the indexed refs. They
+	 * are passed on stdin so that repositories with many refs do not
+	 * run out of argument space. */
+	ok = trigram_builder_exclude(&io, index);
+	io_close_write(&io);
+
+	while (ok && (record = trigram_builder_get(builder, &io))) {
+		char *text = strchr(record, '\n');
+
+		if (!text || !realloc_trigram_ids(&builder->ids, builder->ids_size, 1) ||
+		    !trigram_parse_id(&builder->ids[builder->ids_size], record)) {
+			ok = FALSE;
+			break;
+		}
+
+		builder->ids_size++;
+		ok = trigram_builder_add(builder, text + 1);
+	}
+
+	if (!ok || builder->stopped)
+		io_kill(&io);
+	ok = ok && !builder->stopped && !io_error(&io) && trigram_builder_flush(builder);
+	ok = io_done(&io) && ok;
+
+	return ok;
+}
+
+/* Pairs are merged from the existing index and the sorted runs. */
+struct trigram_source {
+	uint64_t pair;
+	FILE *run;
+	const struct trigram_index *index;
+	uint64_t entry;
+	uint32_t posting;
+};
+
+static bool
+trigram_source_next(struct trigram_source *source)
+{
+	const struct trigram_index *index = source->index;
+
+	if (source->run)
+		return fread(&source->pair, sizeof(source->pair), 1, source->run) == 1;
+
+	while (source->entry < index->header->trigrams) {
+		const struct trigram_entry *entry = &index->table[source->entry];
+
+		if (source->posting < entry->size) {
+			uint32_t commit = index->postings[entry->offset + source->posting++];
+
+			source->pair = (uint64_t) entry->trigram << 32 | commit;
+			return TRUE;
+		}
+
+		source->entry++;
+		source->posting = 0;
+	}
+
+	return FALSE;
+}
+
+static bool
+trigram_write_padding(FILE *file, uint64_t *offset, size_t alignment)
+{
+	for (; *offset % alignment; (*offset)++)
+		if (fputc(0, file) == EOF)
+			return FALSE;
+	return TRUE;
+}
+
+static bool
+trigram_write_postings(FILE *file, struct trigram_header *header,
+		       struct trigram_source *sources, size_t sources_size,
+		       struct trigram_entry **table)
+{
+	uint64_t last = 0;
+	size_t i;
+
+	for (i = 0; i < sources_size; i++) {
+		if (!trigram_source_next(&sources[i]))
+			sources[i--] = sources[--sources_size];
+	}
+
+	while (sources_size) {
+		struct trigram_source *source = &sources[0];
+		uint32_t trigram, commit;
+
+		for (i = 1; i < sources_size; i++)
+			if (sources[i].pair < source->pair)
+				source = &sources[i];
+
+		trigram = source->pair >> 32;
+		commit = source->pair & 0xffffffff;
+
+		if (!header->postings || source->pair != last) {
+			struct trigram_entry *entry;
+
+			if (!header->trigrams || (*table)[header->trigrams - 1].trigram != trigram) {
+				if (!realloc_trigram_table(table, header->trigrams, 1))
+					return FALSE;
+				(*table)[header->trigrams].trigram = trigram;
+				(*table)[header->trigrams].offset = header->postings;
+				header->trigrams++;
+			}
+
+			entry = &(*table)[header->trigrams - 1];
+
+			if (fwrite(&commit, sizeof(commit), 1, file) != 1)
+				return FALSE;
+			entry->size++;
+			header->postings++;
+			last = source->pair;
+		}
+
+		if (!trigram_source_next(source))
+			*source = sources[--sources_size];
+	}
+
+	return TRUE;
+}
+
+static bool
+trigram_write(FILE *file, const struct trigram_index *index, struct trigram_builder *builder,
+	      const struct trigram_id *tips, size_t tips_size)
+{
+	struct trigram_header header = {};
+	struct trigram_source *sources;
+	struct trigram_entry *table = NULL;
+	size_t sources_size = 0;
+	uint64_t offset;
+	size_t i;
+	bool ok;
+
+	memcpy(header.magic, TRIGRAM_MAGIC, sizeof(header.magic));
+	header.commits = builder->first + builder->ids_size;
+	header.tips = tips_size;
+	offset = sizeof(header) + ((uint64_t) header.commits + header.tips) * TRIGRAM_IDSIZE;
+
+	/* The header is rewritten once the table size is known. */
+	if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+	    (builder->first && fwrite(index->ids, TRIGRAM_IDSIZE, builder->first, file) != builder->first) ||
+	    fwrite(builder->ids, TRIGRAM_IDSIZE, builder->ids_size, file) != builder->ids_size ||
+	    fwrite(tips, TRIGRAM_IDSIZE, tips_size, file) != tips_size ||
+	    !trigram_write_padding(file, &offset, sizeof(uint32_t)))
+		return FALSE;
+
+	sources = calloc(builder->runs_size + 1, sizeof(*sources));
+	if (!sources)
+		return FALSE;
+	if (index)
+		sources[sources_size++].index = index;
+	for (i = 0; i < builder->runs_size; i++)
+		sources[sources_size++].run = builder->runs[i];
+
+	header.postings_offset = offset;
+	ok = trigram_write_postings(file, &header, sources, sources_size, &table);
+	free(sources);
+
+	offset += header.postings * sizeof(uint32_t);
+	header.table_offset = offset;
+	ok = ok &&
+	     trigram_write_padding(file, &header.table_offset, sizeof(uint64_t)) &&
+	     fwrite(table, sizeof(*table), header.trigrams, file) == header.trigrams &&
+	     !fseek(file, 0, SEEK_SET) &&
+	     fwrite(&header, sizeof(header), 1, file) == 1;
+	free(table);
+
+	return ok;
+}
+
+static bool
+trigram_load_tips(struct trigram_id **tips, size_t *tips_size)
+{
+	const char *argv[] = { "git", "rev-parse", "--all", "HEAD", NULL };
+	struct io io;
+	char *line;
+	size_t i, size = 0;
+
+	if (!io_run(&io, IO_RD, NULL, NULL, argv))
+		return FALSE;
+
+	while ((line = io_get(&io, '\n', TRUE))) {
+		/* Skip the unresolved HEAD of a repository without commits. */
+		if (!realloc_trigram_ids(tips, size, 1) ||
+		    !trigram_parse_id(&(*tips)[size], line))
+			continue;
+		size++;
+	}
+
+	io_done(&io);
+
+	qsort(*tips, size, sizeof(**tips), compare_trigram_ids);
+	for (i = 0, *tips_size = 0; i < size; i++)
+		if (!*tips_size || compare_trigram_ids(&(*tips)[*tips_size - 1], &(*tips)[i]))
+			(*tips)[(*tips_size)++] = (*tips)[i];
+
+	return TRUE;
+}
+
+/* Create the lock file of an index update. A lock left behind by a tig
+ * which did not finish its update is removed once it is old enough. */
+static int
+trigram_lock(const char *lock)
+{
+	int fd = open(lock, O_WRONLY | O_CREAT | O_EXCL, 0666);
+	struct stat st;
+
+	if (fd == -1 && errno == EEXIST && !stat(lock, &st) &&
+	    st.st_mtime + TRIGRAM_LOCK_STALE < time(NULL) && !unlink(lock))
+		fd = open(lock, O_WRONLY | O_CREAT | O_EXCL, 0666);
+	return fd;
+}
+
+bool
+trigram_index_update(struct trigram_index **indexp, const char *path,
+		     trigram_wait_fn wait, void *data)
+{
+	struct trigram_index *index = *indexp;
+	struct trigram_builder builder = {};
+	struct trigram_id *tips = NULL;
+	size_t tips_size = 0;
+	char lock[SIZEOF_STR];
+	FILE *file = NULL;
+	int fd = -1;
+	bool ok;
+
+	if (!trigram_load_tips(&tips, &tips_size)) {
+		free(tips);
+		return FALSE;
+	}
+
+	if (index && index->header->tips == tips_size &&
+	    !memcmp(index->tips, tips, tips_size * TRIGRAM_IDSIZE)) {
+		free(tips);
+		return TRUE;
+	}
+
+	/* The index is left alone while another tig is updating it. */
+	if (!string_format(lock, "%s.lock", path) ||
+	    (fd = trigram_lock(lock)) == -1 ||
+	    !(file = fdopen(fd, "wb"))) {
+		if (fd != -1) {
+			close(fd);
+			unlink(lock);
+		}
+		free(tips);
+		return FALSE;
+	}
+
+	builder.first = index ? index->header->commits : 0;
+	builder.wait = wait;
+	builder.data = data;
+	ok = trigram_builder_read(&builder, index) &&
+	     trigram_write(file, index, &builder, tips, tips_size);
+	ok = !fclose(file) && ok;
+	trigram_builder_done(&builder);
+	free(tips);
+
+	if (!ok || rename(lock, path)) {
+		unlink(lock);
+		return FALSE;
+	}
+
+	index = trigram_index_open(path);
+	if (!index)
+		return FALSE;
+
+	trigram_index_close(*indexp);
+	*indexp = index;
+	return TRUE;
+}
+
+/*
+ * Searching the index.
+ */
+
+static bool
+trigram_intersect(uint32_t *commits, size_t *size, const uint32_t *postings, size_t postings_size)
+{
+	size_t i, j, matches = 0;
+
+	for (i = 0, j = 0; i < *size && j < postings_size; ) {
+		if (commits[i] < postings[j]) {
+			i++;
+		} else if (commits[i] > postings[j]) {
+			j++;
+		} else {
+			commits[matches++] = commits[i++];
+			j++;
+		}
+	}
+
+	*size = matches;
+	return matches > 0;
+}
+
+static int
+compare_trigram_hex_ids(const void *id1, const void *id2)
+{
+	return strcmp(id1, id2);
+}
+
+/* Find the commits which may contain the pattern. Returns FALSE if the
+ * index cannot answer, e.g. if the pattern is a non-trivial regex. The
+ * candidates must be checked since the index only knows that all the
+ * trigrams of the pattern occur somewhere on the same commit. */
+bool
+trigram_index_search(struct trigram_index *index, enum trigram_field field,
+		     const char *pattern, char (**ids)[SIZEOF_REV], size_t *ids_size)
+{
+	const struct trigram_entry *entries[SIZEOF_STR];
+	size_t entries_size = 0;
+	const struct trigram_entry *smallest = NULL;
+	uint32_t *commits;
+	size_t size, i, run;
+
+	*ids = NULL;
+	*ids_size = 0;
+
+	if (!index || strpbrk(pattern, "\\[]()|*+?{}^$"))
+		return FALSE;
+
+	/* Only ASCII is case-folded the same way as by git. */
+	for (i = 0; pattern[i]; i++)
+		if ((unsigned char) pattern[i] >= 0x80)
+			return FALSE;
+
+	/* Any character matches a '.' so only search for the trigrams of
+	 * the literal text between them. */
+	for (run = 0, i = 0; pattern[i]; i++) {
+		const struct trigram_entry *entry;
+		uint32_t trigram;
+
+		if (pattern[i] == '.') {
+			run = 0;
+			continue;
+		}
+
+		if (++run < 3)
+			continue;
+
+		trigram = trigram_key(pattern + i - 2, field);
+		entry = bsearch(&trigram, index->table, index->header->trigrams,
+				sizeof(*index->table), compare_trigram_entry);
+		if (!entry)
+			return TRUE;
+
+		if (entries_size < ARRAY_SIZE(entries))
+			entries[entries_size++] = entry;
+		if (!smallest || entry->size < smallest->size)
+			smallest = entry;
+	}
+
+	if (!smallest)
+		return FALSE;
+
+	commits = malloc(smallest->size * sizeof(*commits));
+	if (!commits)
+		return FALSE;
+
+	size = smallest->size;
+	memcpy(commits, index->postings + smallest->offset, size * sizeof(*commits));
+
+	for (i = 0; i < entries_size; i++) {
+		const struct trigram_entry *entry = entries[i];
+
+		if (entry != smallest &&
+		    !trigram_intersect(commits, &size, index->postings + entry->offset, entry->size))
+			break;
+	}
+
+	if (size) {
+		*ids = calloc(size, sizeof(**ids));
+		if (!*ids) {
+			free(commits);
+			return FALSE;
+		}
+	}
+
+	for (i = 0; i < size; i++) {
+		if (commits[i] < index->header->commits)
+			trigram_format_id((*ids)[(*ids_size)++], &index->ids[commits[i]]);
+	}
+
+	free(commits);
+	qsort(*ids, *ids_size, sizeof(**ids), compare_trigram_hex_ids);
+	return TRUE;
+}
+
+/* vim: set ts=8 sw=8 noexpandtab: */
@@ -0,0 +1,43 @@
+/* Copyright (c) 2006-2013 Jonas Fonseca <fonseca@diku.dk>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef TIG_TRIGRAM_H
+#define TIG_TRIGRAM_H
+
+#include "tig.h"
+
+/*
+ * Persistent trigram index of commit messages and author idents.
+ */
+
+struct trigram_index;
+
+enum trigram_field {
+	TRIGRAM_MESSAGE,
+	TRIGRAM_AUTHOR,
+};
+
+/* Called while waiting for git to list the commits to index. Returns
+ * FALSE to stop the update. */
+typedef bool (*trigram_wait_fn)(struct io *io, void *data);
+
+struct trigram_index *trigram_index_open(const char *path);
+void trigram_index_close(struct trigram_index *index);
+bool trigram_index_update(struct trigram_index **index, const char *path,
+			  trigram_wait_fn wait, void *data);
+bool trigram_index_search(struct trigram_index *index, enum trigram_field field,
+			  const char *pattern, char (**ids)[SIZEOF_REV], size_t *ids_size);
+
+#endif
+
+/* vim: set ts=8 sw=8 noexpandtab: */